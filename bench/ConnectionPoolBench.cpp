@@ -0,0 +1,69 @@
+//
+// Created by m8792 on 2021/1/1.
+//
+
+#include <benchmark/benchmark.h>
+
+#include <map>
+#include <mutex>
+
+#include "ConnectionPool.h"
+
+using namespace db;
+
+namespace {
+
+/**
+ * 按分片数和是否开启线程缓存缓存连接池，所有线程共用同一个连接池
+ * @param shardCount
+ * @param stickyCache
+ * @return
+ */
+ConnectionPoolPtr getPool(size_t shardCount, bool stickyCache) {
+    static std::mutex mutex;
+    static std::map<std::pair<size_t, bool>, ConnectionPoolPtr> pools;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    ConnectionPoolPtr& pool = pools[std::make_pair(shardCount, stickyCache)];
+    if (!pool) {
+        PoolOptions options;
+        options.shardCount = shardCount;
+        options.stickyCache = stickyCache;
+        pool = std::make_shared<ConnectionPool>(64, options);
+
+        Status s;
+        pool->connect("127.0.0.1", 0, "root", "wylj", s);
+        if (!s) {
+            pool.reset();
+        }
+    }
+    return pool;
+}
+
+}  // namespace
+
+/**
+ * 只测试取出、归还连接的吞吐，不执行sql
+ *
+ * 第一个参数为分片数，0表示按照硬件线程数分片；第二个参数为是否开启线程缓存
+ */
+static void BM_CheckoutRelease(benchmark::State& state) {
+    ConnectionPoolPtr pool = getPool(state.range(0), state.range(1) != 0);
+    if (!pool) {
+        state.SkipWithError("failed to connect to mysql server");
+        return;
+    }
+
+    for (auto _ : state) {
+        ConnectionPtr conn = pool->getConnection();
+        benchmark::DoNotOptimize(bool(conn));
+        conn.release();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CheckoutRelease)
+    ->Args({1, 0})
+    ->Args({0, 0})
+    ->Args({0, 1})
+    ->ThreadRange(1, 64)
+    ->UseRealTime();
@@ -0,0 +1,185 @@
+//
+// Created by m8792 on 2021/1/12.
+//
+
+#include <benchmark/benchmark.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "Connection.h"
+#include "PreparedStatement.h"
+#include "Statement.h"
+
+using namespace db;
+
+namespace {
+
+/**
+ * 扫描的表的行数
+ */
+const int kRowCount = 100000;
+
+const char* kScanSql = "select id, name from t_bench_cursor where id > ?";
+
+/**
+ * 所有的benchmark共用一个连接，第一次使用时建表并写入kRowCount行
+ * @return      连接失败时为nullptr
+ */
+Connection* getConnection() {
+    static std::once_flag once;
+    static std::unique_ptr<Connection> conn;
+
+    std::call_once(once, [] {
+        std::unique_ptr<Connection> c(new Connection());
+        Status s;
+        c->connect("127.0.0.1", 0, "root", "wylj", "mysql_connector_test", s);
+        if (!s) {
+            return;
+        }
+
+        Statement statement(*c);
+        std::string sqls[] = {
+            "drop table if exists t_bench_cursor",
+            "create table t_bench_cursor (id int primary key, "
+            "name varchar(64) not null)",
+            fmt::sprintf("set session cte_max_recursion_depth = %d",
+                         kRowCount),
+            fmt::sprintf(
+                "insert into t_bench_cursor with recursive seq(n) as "
+                "(select 1 union all select n + 1 from seq where n < %d) "
+                "select n, repeat('x', 64) from seq",
+                kRowCount),
+        };
+        for (const std::string& sql : sqls) {
+            statement.execute(sql, s);
+            if (!s) {
+                return;
+            }
+        }
+        conn = std::move(c);
+    });
+    return conn.get();
+}
+
+/**
+ * 读完整个结果集，返回行数
+ * @param resultSet
+ * @return
+ */
+int64_t scan(PreparedResultSet& resultSet) {
+    int64_t rows = 0;
+    while (resultSet.next()) {
+        benchmark::DoNotOptimize(resultSet.getInt64(0));
+        ++rows;
+    }
+    return rows;
+}
+
+/**
+ * 执行扫描的语句
+ * @param state
+ * @param prefetchRows      为0时不使用游标
+ * @param statement
+ * @return                  失败时返回false
+ */
+bool prepareScan(benchmark::State& state, unsigned long prefetchRows,
+                 PreparedStatement& statement) {
+    Connection* conn = getConnection();
+    if (conn == nullptr) {
+        state.SkipWithError("failed to prepare table");
+        return false;
+    }
+
+    Status s;
+    statement = conn->prepareStatement(kScanSql, s);
+    if (s) {
+        statement.setCursor(prefetchRows, s);
+    }
+    if (s) {
+        statement.bind(0, s);
+    }
+    if (!s) {
+        state.SkipWithError(s.message().c_str());
+        return false;
+    }
+    return true;
+}
+
+}  // namespace
+
+/**
+ * 结果集全部读到本地之后再遍历
+ */
+static void BM_ScanBuffered(benchmark::State& state) {
+    PreparedStatement statement;
+    if (!prepareScan(state, 0, statement)) {
+        return;
+    }
+
+    int64_t rows = 0;
+    for (auto _ : state) {
+        Status s;
+        statement.execute(s);
+        PreparedResultSet resultSet = statement.getResultSet(s);
+        if (!s) {
+            state.SkipWithError(s.message().c_str());
+            return;
+        }
+        rows += scan(resultSet);
+    }
+    state.SetItemsProcessed(rows);
+}
+BENCHMARK(BM_ScanBuffered)->Unit(benchmark::kMillisecond);
+
+/**
+ * 不使用游标，逐行从连接上读取
+ */
+static void BM_ScanStreaming(benchmark::State& state) {
+    PreparedStatement statement;
+    if (!prepareScan(state, 0, statement)) {
+        return;
+    }
+
+    int64_t rows = 0;
+    for (auto _ : state) {
+        Status s;
+        statement.execute(s);
+        PreparedResultSet resultSet = statement.getStreamingResultSet(s);
+        if (!s) {
+            state.SkipWithError(s.message().c_str());
+            return;
+        }
+        rows += scan(resultSet);
+    }
+    state.SetItemsProcessed(rows);
+}
+BENCHMARK(BM_ScanStreaming)->Unit(benchmark::kMillisecond);
+
+/**
+ * 使用服务器端的游标，参数为每次读取的行数
+ */
+static void BM_ScanCursor(benchmark::State& state) {
+    PreparedStatement statement;
+    if (!prepareScan(state, state.range(0), statement)) {
+        return;
+    }
+
+    int64_t rows = 0;
+    for (auto _ : state) {
+        Status s;
+        statement.execute(s);
+        PreparedResultSet resultSet = statement.getStreamingResultSet(s);
+        if (!s) {
+            state.SkipWithError(s.message().c_str());
+            return;
+        }
+        rows += scan(resultSet);
+    }
+    state.SetItemsProcessed(rows);
+}
+BENCHMARK(BM_ScanCursor)
+    ->RangeMultiplier(10)
+    ->Range(1, kRowCount / 10)
+    ->Unit(benchmark::kMillisecond);
@@ -10,6 +10,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <algorithm>
+
 #include "ResultMetaData.h"
 
 namespace db {
@@ -37,8 +39,34 @@ public:
         assign(metaData);
     }
 
+    Bind(const Bind&) = delete;
+
+    Bind& operator=(const Bind&) = delete;
+
+    Bind(Bind&& other)
+        : binds_(other.binds_),
+          bindCount_(other.bindCount_),
+          shape_(std::move(other.shape_)) {
+        other.binds_ = nullptr;
+        other.bindCount_ = 0;
+    }
+
+    Bind& operator=(Bind&& other) {
+        Bind tmp;
+        swap(other);
+        other.swap(tmp);
+        return *this;
+    }
+
     ~Bind() { clear(); }
 
+    void swap(Bind& other) {
+        using std::swap;
+        swap(binds_, other.binds_);
+        swap(bindCount_, other.bindCount_);
+        swap(shape_, other.shape_);
+    }
+
     void assign(size_t paramCount) {
         clear();
 
@@ -54,9 +82,17 @@ public:
         }
     }
 
-    void assign(const ResultMetaData& metaData) {
+    /**
+     * 按结果的元数据分配每一列的缓冲区
+     * @param metaData
+     * @param streaming     为true时按类型分配固定大小的缓冲区，
+     *                      否则按max_length分配，需要先store_result
+     */
+    void assign(const ResultMetaData& metaData, bool streaming = false) {
         clear();
 
+        // 解码时直接使用共享元数据中的类型
+        shape_ = metaData.getShape();
         bindCount_ = metaData.getFieldCount();
         if (bindCount_ == 0) {
             binds_ = nullptr;
@@ -67,8 +103,11 @@ public:
         for (int i = 0; i < bindCount_; ++i) {
             memset(&binds_[i], 0, sizeof(MYSQL_BIND));
 
-            auto p = allocateBuffer(metaData.getOrgFieldType(i),
-                                    metaData.getFieldMaxLength(i));
+            auto p = allocateBuffer(
+                metaData.getOrgFieldType(i),
+                streaming ? fixedBufferLength(metaData.getOrgFieldType(i),
+                                              metaData.getFieldLength(i))
+                          : metaData.getFieldMaxLength(i));
             binds_[i].buffer = p.first;
             binds_[i].buffer_length = p.second;
 
@@ -93,6 +132,7 @@ public:
         }
         delete [] binds_;
         binds_ = nullptr;
+        shape_.reset();
     }
 
     MYSQL_BIND* getBinds() const { return binds_; }
@@ -107,6 +147,18 @@ public:
         return &binds_[index];
     }
 
+    /**
+     * 第index列的数据是否比缓冲区长，只在固定大小的缓冲区中出现
+     * @param index
+     * @return
+     */
+    bool truncated(size_t index) const {
+        checkIndexValid(index);
+
+        const MYSQL_BIND& bind = binds_[index];
+        return !*bind.is_null && *bind.length > bind.buffer_length;
+    }
+
     /**
      * 绑定第index个参数
      * @param index
@@ -166,7 +218,9 @@ public:
             return Value();
         }
 
-        switch (mysqlTypeToDataType(bind->buffer_type)) {
+        int dataType = shape_ ? shape_->getFieldType(index)
+                              : mysqlTypeToDataType(bind->buffer_type);
+        switch (dataType) {
         case DataType::SIGNED_INTEGER: {
             int64_t val = 0;
             switch (*bind->length) {
@@ -243,8 +297,10 @@ public:
                 break;
             }
             default: {
+                // 被截断时只有缓冲区中的部分
                 char* ptr = reinterpret_cast<char*>(bind->buffer);
-                val.assign(ptr, ptr + *bind->length);
+                val.assign(ptr, ptr + std::min(*bind->length,
+                                               bind->buffer_length));
                 break;
             }
             }
@@ -278,6 +334,32 @@ private:
         }
     }
 
+    /**
+     * 流式读取时每一列的缓冲区大小，数值类型8字节足够，变长的类型
+     * 最多kStreamingBufferLength，更长的值通过mysql_stmt_fetch_column读取
+     * @param mysqlFieldType
+     * @param fieldLength       列定义的长度
+     * @return
+     */
+    static int fixedBufferLength(int mysqlFieldType, size_t fieldLength) {
+        switch (mysqlFieldType) {
+        case MYSQL_TYPE_TINY:
+        case MYSQL_TYPE_SHORT:
+        case MYSQL_TYPE_LONG:
+        case MYSQL_TYPE_INT24:
+        case MYSQL_TYPE_LONGLONG:
+        case MYSQL_TYPE_FLOAT:
+        case MYSQL_TYPE_DOUBLE:
+        case MYSQL_TYPE_YEAR:
+            return 0;
+
+        default:
+            return static_cast<int>(fieldLength < kStreamingBufferLength
+                                        ? fieldLength
+                                        : kStreamingBufferLength);
+        }
+    }
+
     std::pair<char*, size_t> allocateBuffer(int mysqlFieldType, int maxLen) {
         char* buffer = nullptr;
         size_t bufferLen = 0;
@@ -321,10 +403,19 @@ private:
     }
 
 private:
+    static const size_t kStreamingBufferLength = 1024;
+
     MYSQL_BIND* binds_;
     size_t bindCount_;
+
+    /**
+     * 结果的元数据，参数的Bind为空
+     */
+    ResultShapePtr shape_;
 };
 
+inline void swap(Bind& lhs, Bind& rhs) { lhs.swap(rhs); }
+
 }  // namespace db
 
 #endif  // MYSQL_CONNECTOR_BIND_H
@@ -8,19 +8,40 @@
 #include <fmt/printf.h>
 #include <mysql/mysql.h>
 
+#include <chrono>
+#include <functional>
+#include <memory>
+
 #include "DBConfig.h"
 #include "Handler.h"
 #include "PreparedStatement.h"
+#include "QueryWatchdog.h"
 #include "Statement.h"
+#include "StatementCache.h"
 #include "Status.h"
 #include "Util.h"
 
+/**
+ * libmysqlclient 8.0.16开始提供非阻塞的接口
+ */
+#if defined(__linux__) && MYSQL_VERSION_ID >= 80016
+#define MYSQL_CONNECTOR_HAS_NONBLOCKING 1
+#endif
+
 namespace db {
 
 /**
  * 到MYSQL服务器 的链接
+ *
+ * 记录通过Connection修改过的会话状态（autocommit、schema、隔离级别），
+ * 执行了无法判断影响的sql时标记为未知，restoreSession据此恢复到
+ * SessionOptions描述的状态。和当前状态相同的设置不会发送到服务器
  */
 class Connection {
+    friend class Statement;
+
+    friend class Reactor;
+
 public:
     /**
      * 事务的隔离级别
@@ -84,6 +105,42 @@ public:
                  const std::string& user, const std::string& password,
                  const std::string& schema, Status& s);
 
+#ifdef MYSQL_CONNECTOR_HAS_NONBLOCKING
+    /**
+     * 非阻塞地连接到数据库
+     *
+     * 返回NET_ASYNC_NOT_READY时，等socket可读写之后用同样的参数再次调用，
+     * 直到返回NET_ASYNC_COMPLETE或者NET_ASYNC_ERROR
+     * @param host          mysql服务器ip地址
+     * @param port          mysql服务端口号，0的话为默认值
+     * @param user          用户名
+     * @param password      密码
+     * @param schema        schema
+     * @param s             失败的原因
+     * @return
+     *
+     * @note 不会为了SessionOptions::autoCommit额外发送请求，
+     * 服务器的默认值和它不一致时getAutoCommit返回服务器的值
+     */
+    net_async_status connectNonblocking(const std::string& host,
+                                        unsigned short port,
+                                        const std::string& user,
+                                        const std::string& password,
+                                        const std::string& schema, Status& s);
+#endif
+
+    /**
+     * 设置连接建立时的会话状态
+     * @param options
+     *
+     * @note 需要在connect之前调用
+     */
+    void setSessionOptions(const SessionOptions& options) {
+        session_ = options;
+    }
+
+    const SessionOptions& getSessionOptions() const { return session_; }
+
     /**
      * 关闭链接，并释放资源
      * @param s     是否成功
@@ -111,12 +168,30 @@ public:
 
     /**
      * 创建一个PreparedStatement
+     *
+     * 开启了StatementCache时，优先使用缓存中同样sql的stmt，
+     * 新prepare的stmt也会放进缓存，PreparedStatement关闭时reset后放回缓存
      * @param sql       要执行的sql
      * @param s         创建结果
      * @return
      */
     PreparedStatement prepareStatement(const std::string& sql, Status& s);
 
+    /**
+     * 设置StatementCache的容量
+     * @param capacity      0表示关闭缓存
+     * @param s             缓存中的stmt被取出还没有归还时失败
+     *
+     * @note 会关闭所有缓存中的stmt
+     */
+    void setStatementCacheSize(size_t capacity, Status& s);
+
+    /**
+     * 获取StatementCache
+     * @return  没有开启时返回nullptr
+     */
+    StatementCache* getStatementCache() const { return stmtCache_.get(); }
+
     /**
      * 切换到schema
      * @param schema    要切换到的schema
@@ -180,6 +255,134 @@ public:
      */
     bool getAutoCommit(Status& s);
 
+    /**
+     * 设置当前会话的事务隔离级别
+     * @param level
+     * @param s
+     */
+    void setIsolationLevel(IsolationLevel level, Status& s);
+
+    /**
+     * 设置是否允许一个请求中包含多条语句，和当前状态相同时不访问服务器
+     * @param enable
+     * @param s         关闭失败时连接会被关闭
+     *
+     * @note Statement执行单条sql之前会关闭，Reactor不会，
+     * 在Reactor中使用之前需要关闭
+     */
+    void setMultiStatements(bool enable, Status& s);
+
+    /**
+     * 是否允许多语句
+     * @return
+     */
+    bool multiStatements() const { return multiStatements_; }
+
+    /**
+     * 是否有未结束的事务，根据服务器返回的状态判断，不需要访问服务器
+     * @return
+     */
+    bool inTransaction() const;
+
+    /**
+     * 会话状态是否和连接建立时一致
+     * @return
+     */
+    bool sessionClean() const;
+
+    /**
+     * 把会话恢复到连接建立时的状态
+     *
+     * 只发送必要的语句：回滚未结束的事务、恢复隔离级别和autocommit、
+     * 切换回原来的schema、关闭多语句；执行过无法判断影响的sql，或者需要恢复到没有schema、
+     * 服务器默认的隔离级别时使用resetConnection
+     * @param s
+     */
+    void restoreSession(Status& s);
+
+    /**
+     * 使用mysql_reset_connection重置会话
+     *
+     * 回滚事务、清除用户变量和临时表、会话变量恢复为全局值，
+     * 之后重新应用SessionOptions并切换回连接建立时的schema。
+     * 连接建立时没有schema的，用mysql_change_user重新登录来取消schema。
+     * 服务器上prepare的语句也会被释放，StatementCache会被清空
+     * @param s
+     */
+    void resetConnection(Status& s);
+
+    /**
+     * 是否有还没有读完的流式结果集
+     *
+     * 包括Statement和PreparedStatement的流式结果集，以及prepared语句执行之后
+     * 还没有获取的结果集。读完或者释放之前，不能在这个连接上执行其他sql
+     * @return
+     */
+    bool streaming() const {
+        if (!conn_.valid()) {
+            return false;
+        }
+        int status = conn_.get()->status;
+        return status == MYSQL_STATUS_USE_RESULT ||
+               status == MYSQL_STATUS_STATEMENT_GET_RESULT;
+    }
+
+    /**
+     * 设置中断超时查询的QueryWatchdog，连接池中的连接由连接池设置
+     * @param watchdog
+     */
+    void setWatchdog(std::shared_ptr<QueryWatchdog> watchdog) {
+        watchdog_ = std::move(watchdog);
+    }
+
+    QueryWatchdog* getWatchdog() const { return watchdog_.get(); }
+
+    /**
+     * 设置在这个连接上执行sql的deadline
+     *
+     * 之后Statement和PreparedStatement的每次执行都不会超过它，
+     * time_point::max()表示没有deadline
+     * @param deadline
+     */
+    void setDeadline(std::chrono::steady_clock::time_point deadline) {
+        deadline_ = deadline;
+    }
+
+    std::chrono::steady_clock::time_point getDeadline() const {
+        return deadline_;
+    }
+
+    /**
+     * 设置执行sql的回调，参数为发送sql到收到服务器响应的微秒数
+     *
+     * Statement和PreparedStatement每次执行之后在当前线程中调用，不能阻塞；
+     * 连接池中的连接由连接池设置
+     * @param observer
+     */
+    void setQueryObserver(std::function<void(uint64_t)> observer) {
+        queryObserver_ = std::move(observer);
+    }
+
+    /**
+     * 收到服务器响应之后调用，通知queryObserver
+     * @param start     开始发送sql的时间
+     */
+    void recordQuery(std::chrono::steady_clock::time_point start) {
+        if (queryObserver_) {
+            queryObserver_(
+                std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - start)
+                    .count());
+        }
+    }
+
+    /**
+     * 服务器的max_allowed_packet，第一次调用时查询，之后使用缓存的值
+     * @param s
+     * @return  失败时返回0
+     */
+    size_t getMaxAllowedPacket(Status& s);
+
     MYSQL* get() const { return conn_.get(); }
 
 private:
@@ -188,6 +391,38 @@ private:
      */
     void initializeHandler();
 
+    /**
+     * prepare一个新的stmt
+     * @param sql
+     * @param s
+     * @return  失败时返回nullptr
+     */
+    MYSQL_STMT* prepare(const std::string& sql, Status& s);
+
+    /**
+     * 检查能否连接，设置字符集和MYSQL_INIT_COMMAND
+     * @param s
+     */
+    void beginConnect(Status& s);
+
+    /**
+     * 握手完成之后记录会话状态
+     * @param schema
+     */
+    void finishConnect(const std::string& schema);
+
+    /**
+     * Statement执行sql之前调用，可能修改会话状态的sql把会话标记为未知
+     * @param sql
+     */
+    void trackSql(const std::string& sql);
+
+    /**
+     * 根据服务器返回的状态，只在和SessionOptions不一致时设置autocommit
+     * @param s
+     */
+    void syncAutoCommit(Status& s);
+
 private:
     /**
      * mysql链接句柄
@@ -199,7 +434,66 @@ private:
      */
     bool connected_;
 
+    /**
+     * 正在非阻塞地建立连接
+     */
+    bool connecting_;
+
     bool autoCommit_;
+
+    /**
+     * 连接建立时的schema
+     */
+    std::string defaultSchema_;
+
+    /**
+     * 当前的schema
+     */
+    std::string schema_;
+
+    /**
+     * 当前的隔离级别，0表示服务器的默认值
+     */
+    int isolationLevel_;
+
+    /**
+     * 连接建立时的会话状态
+     */
+    SessionOptions session_;
+
+    /**
+     * 由session_生成的MYSQL_INIT_COMMAND，重置会话之后需要重新执行
+     */
+    std::string initCommand_;
+
+    /**
+     * 执行过可能修改会话状态的sql
+     */
+    bool sessionDirty_;
+
+    /**
+     * 服务器上是否开启了多语句，executeBatch之后保持开启，减少往返
+     */
+    bool multiStatements_;
+
+    /**
+     * 缓存的max_allowed_packet，0表示还没有查询
+     */
+    size_t maxAllowedPacket_;
+
+    /**
+     * 中断超时查询，没有设置时只能通过MAX_EXECUTION_TIME限制select语句
+     */
+    std::shared_ptr<QueryWatchdog> watchdog_;
+
+    std::chrono::steady_clock::time_point deadline_;
+
+    std::function<void(uint64_t)> queryObserver_;
+
+    /**
+     * 缓存的stmt，没有开启时为空
+     */
+    std::unique_ptr<StatementCache> stmtCache_;
 };
 
 }  // namespace db
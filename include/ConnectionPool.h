@@ -5,62 +5,371 @@
 #ifndef MYSQL_CONNECTOR_CONNECTIONPOOL_H
 #define MYSQL_CONNECTOR_CONNECTIONPOOL_H
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <condition_variable>
-#include <list>
+#include <functional>
+#include <future>
 #include <memory>
 #include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "Connection.h"
 #include "Option.h"
+#include "PoolMetrics.h"
 
 namespace db {
 
 class ConnectionPool;
 
+class Tenant;
+
+/**
+ * 连接池中存放连接的槽位
+ *
+ * 槽位在连接池中预先分配，地址不会改变，取出和归还连接时只传递槽位指针，
+ * 不会移动Connection，也不会分配内存
+ */
+struct ConnectionSlot {
+    Connection connection;
+
+    /**
+     * 空闲链表中的下一个槽位
+     */
+    ConnectionSlot* next;
+
+    /**
+     * 最近一次放回空闲链表的时间
+     */
+    std::chrono::steady_clock::time_point idleSince;
+
+    /**
+     * 最近一次被取出的时间
+     */
+    std::chrono::steady_clock::time_point checkoutTime;
+
+    /**
+     * 维护线程最近一次ping成功的时间，不改变idleSince，不影响空闲回收
+     */
+    std::chrono::steady_clock::time_point lastCheck;
+
+    /**
+     * 取出这个连接的租户，没有指定租户时为nullptr
+     */
+    Tenant* tenant;
+
+    ConnectionSlot() : next(nullptr), tenant(nullptr) {}
+};
+
 /**
  * 连接池提供给外部调用的链接类
+ *
+ * 只是指向连接池中槽位的句柄，连接池在所有连接归还之前不会被析构
  */
 class ConnectionPtr {
     friend class ConnectionPool;
 
 public:
-    ConnectionPtr() {}
+    ConnectionPtr() : slot_(nullptr) {}
+
+    ConnectionPtr(const ConnectionPtr&) = delete;
 
-    ConnectionPtr(std::weak_ptr<ConnectionPool> pool, Connection& connection)
-        : pool_(pool), connection_(std::move(connection)) {}
+    ConnectionPtr& operator=(const ConnectionPtr&) = delete;
 
     ConnectionPtr(ConnectionPtr&& other)
-        : pool_(std::move(other.pool_)),
-          connection_(std::move(other.connection_)) {}
+        : pool_(std::move(other.pool_)), slot_(other.slot_) {
+        other.slot_ = nullptr;
+    }
 
     ConnectionPtr& operator=(ConnectionPtr&& other) {
-        pool_ = std::move(other.pool_);
-        connection_ = std::move(other.connection_);
+        if (this != &other) {
+            release();
+            pool_ = std::move(other.pool_);
+            slot_ = other.slot_;
+            other.slot_ = nullptr;
+        }
+        return *this;
     }
 
-    Connection& operator->() { return connection_; }
+    Connection* operator->() const { return get(); }
+
+    Connection& operator*() const { return *get(); }
+
+    /**
+     * 获取连接，没有连接时返回nullptr
+     * @return
+     */
+    Connection* get() const { return slot_ ? &slot_->connection : nullptr; }
+
+    /**
+     * 连接所属的连接池
+     * @return
+     */
+    ConnectionPool* getPool() const { return pool_.get(); }
 
-    operator bool() { return connection_.connected(); }
+    operator bool() const { return slot_ && slot_->connection.connected(); }
 
     /**
      * 释放链接到连接池
-     *
-     * 还到连接池中，如果没有所属的连接池，就直接关闭
      */
     void release();
 
     ~ConnectionPtr() { release(); }
 
+private:
+    ConnectionPtr(std::shared_ptr<ConnectionPool> pool, ConnectionSlot* slot)
+        : pool_(std::move(pool)), slot_(slot) {}
+
 private:
     /**
      * 链接所属的链接池
      */
-    std::weak_ptr<ConnectionPool> pool_;
+    std::shared_ptr<ConnectionPool> pool_;
+
+    /**
+     * 连接所在的槽位
+     */
+    ConnectionSlot* slot_;
+};
+
+/**
+ * 连接池的选项
+ */
+struct PoolOptions {
+    /**
+     * 空闲连接分片的数量
+     *
+     * 1 - 所有线程共用一个空闲链表（默认）
+     * 0 - 按照硬件线程数分片
+     * n - n个分片，线程优先使用自己的分片，为空时从其他分片窃取
+     */
+    size_t shardCount;
+
+    /**
+     * 建立连接的并发数
+     *
+     * 1 - connect/resize在调用线程中依次建立连接（默认）
+     * n - 最多n个线程同时建立连接，每个连接握手完成后立即可以取用
+     */
+    size_t warmUpConcurrency;
+
+    /**
+     * 至少保持的空闲连接数，空闲连接不够时在后台补充，空闲回收时也会保留
+     */
+    size_t minIdle;
+
+    /**
+     * 连接总数的上限
+     *
+     * 0 - 连接数固定为connectionCount（默认）
+     * n - 有线程在等待连接时在后台新建连接，最多增长到n个
+     */
+    size_t maxTotal;
+
+    /**
+     * 空闲超过这个时间的连接会被关闭，小于等于0不回收
+     *
+     * 只在设置了maxTotal时生效，连接数固定时关闭的连接不会再补充
+     */
+    int idleTimeoutMs;
+
+    /**
+     * 后台维护线程的运行间隔，小于等于0不启动维护线程
+     *
+     * 维护线程负责检查空闲连接、替换断开的连接、回收空闲超时的连接
+     */
+    int healthCheckIntervalMs;
+
+    /**
+     * 空闲超过这个时间的连接由维护线程ping一次，断开的在取用之前就重新连接，
+     * 小于等于0时使用healthCheckIntervalMs
+     */
+    int pingIdleMs;
+
+    /**
+     * 连接是否开启MYSQL_OPT_RECONNECT
+     *
+     * 开启维护线程后建议关闭，断开的连接由维护线程替换，而不是在执行sql时重连
+     */
+    bool autoReconnect;
+
+    /**
+     * 连接归还时的回调，参数为持有连接的微秒数
+     *
+     * 在归还连接的线程中调用，不能阻塞
+     */
+    std::function<void(uint64_t)> onRelease;
+
+    /**
+     * 在连接上执行sql的回调，参数为发送sql到收到服务器响应的微秒数，
+     * 不包括持有连接但没有执行sql的时间
+     *
+     * 在执行sql的线程中调用，不能阻塞
+     */
+    std::function<void(uint64_t)> onQuery;
+
+    /**
+     * 归还的连接最近一次出错是因为连接断开时的回调
+     *
+     * 在归还连接的线程中调用，不能阻塞
+     */
+    std::function<void()> onConnectionLost;
+
+    /**
+     * 是否开启线程本地的连接缓存
+     *
+     * 开启后没有线程在等待时，归还的连接先放在归还线程自己的缓存格里，
+     * 这个线程下次取连接时直接拿走，不访问共享的分片。
+     * 其他线程取不到连接时会从缓存格里回收。缓存格里的连接不计入getIdleCount
+     */
+    bool stickyCache;
+
+    /**
+     * 每个连接StatementCache的容量，0表示不缓存
+     */
+    size_t statementCacheSize;
+
+    /**
+     * 新建连接时预先prepare的sql，需要statementCacheSize大于0
+     *
+     * prepare失败的sql会被忽略，不影响连接的建立
+     */
+    std::vector<std::string> preparedStatements;
+
+    /**
+     * 连接归还时恢复会话状态的方式
+     */
+    enum ResetPolicy {
+        RESET_NONE,     // 不处理（默认），由使用者保证归还前恢复会话
+        RESET_RESTORE,  // 只恢复被修改过的状态，无法判断时重置会话
+        RESET_ALWAYS    // 每次都使用mysql_reset_connection重置会话
+    };
+
+    /**
+     * 恢复会话失败的连接会被重新建立
+     *
+     * 重置会话会释放服务器上prepare的语句，StatementCache在之后按需重新prepare
+     */
+    ResetPolicy resetPolicy;
+
+    /**
+     * 新建连接时设置的会话状态，在握手过程中一次设置好
+     */
+    SessionOptions session;
+
+    /**
+     * 执行getConnectionAsync回调的执行器，参数为要执行的任务
+     *
+     * 为空时在完成的线程中直接执行：归还连接的线程、调用getConnectionAsync的线程，
+     * 或者处理超时的后台线程。执行器不能阻塞，也不能丢弃任务
+     */
+    std::function<void(std::function<void()>)> executor;
+
+    PoolOptions()
+        : shardCount(1),
+          warmUpConcurrency(1),
+          minIdle(0),
+          maxTotal(0),
+          idleTimeoutMs(0),
+          healthCheckIntervalMs(0),
+          pingIdleMs(0),
+          autoReconnect(true),
+          stickyCache(false),
+          statementCacheSize(0),
+          resetPolicy(RESET_NONE) {}
+};
+
+/**
+ * 租户的选项
+ */
+struct TenantOptions {
+    /**
+     * 租户最多同时使用的连接数，包括正在等待的调用
+     *
+     * 0 - 不限制（默认）
+     * n - 已经有n个连接在使用或等待时，新的调用立即失败，不会排队
+     */
+    size_t maxShare;
+
+    /**
+     * 权重，多个租户都在等待时，按权重比例分配归还的连接
+     */
+    unsigned weight;
+
+    TenantOptions() : maxShare(0), weight(1) {}
+};
+
+/**
+ * 共用一个连接池的租户
+ *
+ * 通过ConnectionPool::addTenant创建，取连接时传入，
+ * 限制一个租户能占用的连接数，避免一个租户的慢查询占满整个连接池
+ */
+class Tenant {
+    friend class ConnectionPool;
+
+public:
+    Tenant(const Tenant&) = delete;
+
+    Tenant& operator=(const Tenant&) = delete;
+
+    const std::string& getName() const { return name_; }
+
+    size_t getMaxShare() const { return maxShare_; }
+
+    unsigned getWeight() const { return weight_; }
+
+    /**
+     * 正在使用和等待的连接数
+     * @return
+     */
+    size_t getActiveCount() const { return activeCount_.load(); }
+
+    /**
+     * 超过maxShare被拒绝的次数
+     * @return
+     */
+    uint64_t getRejectedCount() const { return rejectedCount_.load(); }
 
-    Connection connection_;
+private:
+    Tenant(const std::string& name, const TenantOptions& options, size_t index)
+        : name_(name),
+          maxShare_(options.maxShare),
+          weight_(std::max(options.weight, 1u)),
+          index_(index),
+          activeCount_(0),
+          rejectedCount_(0) {}
+
+    /**
+     * 占用一个份额
+     * @return  超过maxShare时返回false
+     */
+    bool acquire();
+
+    void release() { activeCount_.fetch_sub(1); }
+
+private:
+    std::string name_;
+
+    size_t maxShare_;
+
+    unsigned weight_;
+
+    /**
+     * 在连接池中的序号
+     */
+    size_t index_;
+
+    std::atomic<size_t> activeCount_;
+
+    std::atomic<uint64_t> rejectedCount_;
 };
 
+using TenantPtr = std::shared_ptr<Tenant>;
+
 /**
  * 连接池
  *
@@ -80,13 +389,160 @@ class ConnectionPool : public std::enable_shared_from_this<ConnectionPool> {
         Config() : port(0) {}
     };
 
+    /**
+     * 空闲连接的分片
+     *
+     * 每个分片有自己的锁，线程优先在自己的分片上存取，减少锁竞争
+     */
+    struct Shard {
+        std::mutex mutex;
+
+        /**
+         * 空闲槽位组成的侵入式链表
+         */
+        ConnectionSlot* head;
+
+        /**
+         * 在这个分片上取用、归还连接的计数
+         */
+        PoolCounters counters;
+
+        /**
+         * 填充到cache line，避免相邻分片的伪共享
+         */
+        char padding[64];
+
+        Shard() : head(nullptr) {}
+    };
+
+    /**
+     * 线程本地缓存的一个连接，按线程序号映射，多个线程映射到同一格时互相替换
+     */
+    struct ParkCell {
+        std::atomic<ConnectionSlot*> slot;
+
+        /**
+         * 填充到cache line，不同线程的缓存格互不干扰
+         */
+        char padding[64];
+
+        ParkCell() : slot(nullptr) {}
+    };
+
+public:
+    /**
+     * 取连接的优先级，没有空闲连接时高优先级的等待者先拿到归还的连接
+     */
+    enum Priority {
+        INTERACTIVE = 0,  // 在线请求
+        BATCH = 1         // 批处理任务
+    };
+
+private:
+    /**
+     * 等待连接的调用者，在getConnection的栈上，异步等待时在堆上
+     *
+     * 按优先级和到达顺序排队，归还的连接直接交给队首的等待者
+     */
+    struct Waiter {
+        std::condition_variable cond;
+
+        /**
+         * 交给这个等待者的连接
+         */
+        ConnectionSlot* slot;
+
+        int priority;
+
+        /**
+         * 所属租户的序号，0为默认租户
+         */
+        size_t tenant;
+
+        /**
+         * 异步等待的回调，同步等待时为空
+         */
+        std::function<void(ConnectionPtr)> callback;
+
+        /**
+         * 异步等待开始的时间和截止时间
+         */
+        std::chrono::steady_clock::time_point start;
+
+        std::chrono::steady_clock::time_point deadline;
+
+        Waiter* prev;
+
+        Waiter* next;
+
+        Waiter(int priority, size_t tenant)
+            : slot(nullptr),
+              priority(priority),
+              tenant(tenant),
+              prev(nullptr),
+              next(nullptr) {}
+    };
+
+    /**
+     * 一个优先级的等待队列
+     */
+    struct WaiterQueue {
+        Waiter* head;
+
+        Waiter* tail;
+
+        WaiterQueue() : head(nullptr), tail(nullptr) {}
+    };
+
+    static const int kPriorityCount = 2;
+
+    /**
+     * 一个租户的等待者
+     *
+     * 同一优先级下按虚拟时间在租户之间调度：每分配一个连接，
+     * 租户的虚拟时间增加 kStride / weight，虚拟时间最小的租户先得到连接
+     */
+    struct TenantQueue {
+        WaiterQueue queues[kPriorityCount];
+
+        /**
+         * 正在等待的数量
+         */
+        size_t waiting;
+
+        /**
+         * 虚拟时间
+         */
+        uint64_t pass;
+
+        unsigned weight;
+
+        explicit TenantQueue(unsigned weight)
+            : waiting(0), pass(0), weight(weight) {}
+    };
+
+    static const uint64_t kStride = 1 << 20;
+
+    /**
+     * 等待连接就绪的回调
+     */
+    struct ReadyListener {
+        /**
+         * 需要就绪的连接数
+         */
+        size_t count;
+
+        std::function<void(const Status&)> callback;
+    };
+
 public:
     /**
      * 创建一个链接数量为connectionCount的连接池
      * @param connectionCount       链接的数量
+     * @param options               连接池选项
      */
-    ConnectionPool(size_t connectionCount)
-        : connectionCount_(connectionCount) {}
+    explicit ConnectionPool(size_t connectionCount,
+                            const PoolOptions& options = PoolOptions());
 
     ConnectionPool(const ConnectionPool&) = delete;
     ConnectionPool& operator=(const ConnectionPool&) = delete;
@@ -95,45 +551,18 @@ public:
 
     ConnectionPool& operator=(ConnectionPool&& other) = delete;
 
+    /**
+     * 停止维护线程，等待还在建立连接的线程结束
+     */
+    ~ConnectionPool();
+
     /**
      * 改变链接数量
+     *
+     * 减少时优先关闭空闲的连接，不够的部分在连接归还时关闭
      * @param connectionCount
      */
-    void resize(size_t connectionCount) {
-        std::lock_guard<std::mutex> lock(mutex_);
-
-        if (connectionCount_ == connectionCount) {
-            return;
-        }
-
-        if (config_.host.empty()) {
-            // 没有配置过，就是没有创建过连接
-            connectionCount_ = connectionCount;
-            return;
-        }
-
-        if (connectionCount < connectionCount_) {
-            for (int i = connectionCount;
-                 i < connectionCount_ && !connections_.empty(); ++i) {
-                Connection& connection = connections_.front();
-                connection.close();
-                connections_.pop_front();
-            }
-        } else {
-            for (int i = connectionCount_; i < connectionCount; ++i) {
-                // 补上缺少的连接
-                Status s;
-                Connection conn = createConnection(s);
-                connections_.emplace_back(std::move(conn));
-            }
-
-            // 说明之前是空的， 可能有人在等连接
-            if (connections_.size() == connectionCount - connectionCount_) {
-                cond_.notify_all();
-            }
-        }
-        connectionCount_ = connectionCount;
-    }
+    void resize(size_t connectionCount);
 
     /**
      * 创建connectionCount的连接到数据库
@@ -146,36 +575,46 @@ public:
      *
      * @warning
      * 只能调用一次，只有在成功连接之后才有用，在最开始都连不上，错误应该直接报出来
+     * @note warmUpConcurrency大于1时并发建立连接，耗时接近一次握手
      */
     void connect(const std::string& host, unsigned short port,
                  const std::string& user, const std::string& password,
-                 const std::string& schema, Status& s) {
-        s.clear();
+                 const std::string& schema, Status& s);
 
-        std::lock_guard<std::mutex> lock(mutex_);
+    /**
+     * 在后台并发建立connectionCount的连接，立即返回
+     *
+     * 每个连接握手完成后就放入连接池，可以通过whenReady/onReady等待就绪
+     * @param host          服务器地址
+     * @param port          服务器端口 0默认3306
+     * @param user          用户名
+     * @param password      密码
+     * @param schema        数据库
+     * @param s             是否成功开始建立连接
+     *
+     * @warning 和connect一样只能调用一次
+     */
+    void connectAsync(const std::string& host, unsigned short port,
+                      const std::string& user, const std::string& password,
+                      const std::string& schema, Status& s);
 
-        if (connectInvoked()) {
-            s.assign(Status::RUNTIME_ERROR, "connect already invoked");
-            return;
-        }
+    /**
+     * 等待count个连接就绪
+     * @param count     需要就绪的连接数
+     * @return          就绪后为OK，所有连接都建立完仍然不够count个时为错误
+     *
+     * @note 需要在connect/connectAsync之后调用
+     */
+    std::shared_future<Status> whenReady(size_t count);
 
-        config_.host = host;
-        config_.port = port;
-        config_.user = user;
-        config_.password = password;
-        config_.schema = schema;
-
-        for (int i = 0; i < connectionCount_; ++i) {
-            Connection connection = createConnection(s);
-            if (!s) {
-                connections_.clear();
-                config_ = Config();
-                return;
-            }
-
-            connections_.emplace_back(std::move(connection));
-        }
-    }
+    /**
+     * count个连接就绪后回调
+     * @param count     需要就绪的连接数
+     * @param callback  就绪或者不可能就绪时调用，可能在建立连接的线程中调用
+     *
+     * @note 需要在connect/connectAsync之后调用
+     */
+    void onReady(size_t count, std::function<void(const Status&)> callback);
 
     /**
      * 创建connectionCount的连接到数据库
@@ -194,14 +633,9 @@ public:
     /**
      * 关闭现在未被使用的所有连接
      *
-     * @note 在外面使用的连接会直接释放，而不会返回到连接池
-     * @warning 在外面被使用的连接还没有返回回来， 不适合调用第二次
+     * @note 在外面使用的连接会在归还时直接关闭，而不会返回到连接池
      */
-    void close() {
-        std::lock_guard<std::mutex> lock(mutex_);
-        connections_.clear();
-        connectionCount_ = 0;
-    }
+    void close() { resize(0); }
 
     /**
      * 获取一个连接
@@ -211,75 +645,344 @@ public:
 
     /**
      * 获取一个连接
-     * @param timeoutMs         超时时间微秒
+     *
+     * 先从当前线程的分片取，分片为空时从其他分片窃取，
+     * 整个连接池都没有空闲连接时才会等待
+     * @param timeoutMs         超时时间毫秒，小于0一直等待，等于0不等待
+     * @param priority          等待时的优先级
      * @return
      */
-    ConnectionPtr getConnection(int timeoutMs) {
-        std::unique_lock<std::mutex> lock(mutex_);
-        if (connections_.empty()) {
-            if (timeoutMs == 0) {
-                return ConnectionPtr();
-            }
-            if (timeoutMs < 0) {
-                cond_.wait(lock, [this] { return !connections_.empty(); });
-            } else {
-                cond_.wait_for(lock, std::chrono::milliseconds(timeoutMs),
-                               [this] { return !connections_.empty(); });
-            }
-        }
-
-        if (connections_.empty()) {
-            return ConnectionPtr();
-        }
-
-        std::weak_ptr<ConnectionPool> weakPtr = shared_from_this();
-        ConnectionPtr ptr(weakPtr, connections_.front());
-        connections_.pop_front();
-
-        return ptr;
-    }
-
-    size_t getConnectionCount() const {
-        // 获取连接的数量
-        std::lock_guard<std::mutex> lock(mutex_);
-        return connectionCount_;
-    }
+    ConnectionPtr getConnection(int timeoutMs, Priority priority = INTERACTIVE);
 
     /**
-     * 回收一个连接
+     * 获取一个连接，最多等到deadline
+     *
+     * 等待者按优先级和到达顺序排队，归还的连接直接交给最早的等待者，
+     * 被虚假唤醒不会重新计算超时时间
+     * @param deadline          等待的截止时间，time_point::max()表示一直等待
+     * @param priority          等待时的优先级
+     * @return
      */
-    void revokeConnection(ConnectionPtr& ptr) {
-        std::unique_lock<std::mutex> lock(mutex_);
-        connections_.emplace_back(std::move(ptr.connection_));
-        if (connections_.size() == 1) {
-            cond_.notify_one();
-        }
+    ConnectionPtr getConnection(std::chrono::steady_clock::time_point deadline,
+                                Priority priority = INTERACTIVE);
+
+    /**
+     * 获取一个连接，等待连接和之后在这个连接上执行的sql共用deadline
+     *
+     * 连接的deadline在归还时清除，超时的查询由连接池的QueryWatchdog中断
+     * @param deadline          截止时间
+     * @param priority          等待时的优先级
+     * @return
+     */
+    ConnectionPtr getConnectionUntil(
+        std::chrono::steady_clock::time_point deadline,
+        Priority priority = INTERACTIVE);
+
+    /**
+     * 以租户的身份获取一个连接
+     *
+     * 租户使用的连接数达到maxShare时立即返回空的ConnectionPtr，
+     * 多个租户都在等待时按权重分配归还的连接
+     * @param tenant            addTenant返回的租户
+     * @param timeoutMs         超时时间毫秒，小于0一直等待，等于0不等待
+     * @param priority          等待时的优先级
+     * @return
+     */
+    ConnectionPtr getConnection(const TenantPtr& tenant, int timeoutMs,
+                                Priority priority = INTERACTIVE);
+
+    /**
+     * 以租户的身份获取一个连接，最多等到deadline
+     * @param tenant            addTenant返回的租户
+     * @param deadline          等待的截止时间，time_point::max()表示一直等待
+     * @param priority          等待时的优先级
+     * @return
+     */
+    ConnectionPtr getConnection(const TenantPtr& tenant,
+                                std::chrono::steady_clock::time_point deadline,
+                                Priority priority = INTERACTIVE);
+
+    /**
+     * 异步获取一个连接，不会阻塞调用者
+     *
+     * 有空闲连接时立即回调；否则和getConnection一样排队，
+     * 连接归还时直接交给回调，超时由后台线程回调
+     * @param timeoutMs         超时时间毫秒，小于0一直等待，等于0不等待
+     * @param callback          取到连接或者超时时调用，超时时参数为空的ConnectionPtr
+     * @param priority          等待时的优先级
+     *
+     * @note 有回调没有完成时，后台线程持有连接池
+     */
+    void getConnectionAsync(int timeoutMs,
+                            std::function<void(ConnectionPtr)> callback,
+                            Priority priority = INTERACTIVE);
+
+    /**
+     * 异步获取一个连接，最多等到deadline
+     * @param deadline          等待的截止时间，time_point::max()表示一直等待
+     * @param callback          取到连接或者超时时调用，超时时参数为空的ConnectionPtr
+     * @param priority          等待时的优先级
+     */
+    void getConnectionAsync(std::chrono::steady_clock::time_point deadline,
+                            std::function<void(ConnectionPtr)> callback,
+                            Priority priority = INTERACTIVE);
+
+    /**
+     * 异步获取一个连接
+     * @param timeoutMs         超时时间毫秒，小于0一直等待，等于0不等待
+     * @param priority          等待时的优先级
+     * @return                  超时时为空的ConnectionPtr
+     */
+    std::future<ConnectionPtr> getConnectionAsync(
+        int timeoutMs = -1, Priority priority = INTERACTIVE);
+
+    /**
+     * 中断连接池中的连接上正在执行的sql
+     *
+     * 通过连接池的QueryWatchdog的单独连接发送KILL QUERY
+     * @param threadId      要中断的连接的mysql_thread_id
+     * @param s
+     */
+    void killQuery(unsigned long threadId, Status& s);
+
+    /**
+     * 用连接池的服务器配置建立一个不属于连接池的连接，比如监控用的连接
+     * @param connection
+     * @param s             还没有调用connect时报错
+     */
+    void connectDedicated(Connection& connection, Status& s);
+
+    /**
+     * 添加一个租户
+     * @param name          租户的名字
+     * @param options       租户的选项
+     * @return
+     */
+    TenantPtr addTenant(const std::string& name,
+                        const TenantOptions& options = TenantOptions());
+
+    /**
+     * 获取连接的数量，包括正在建立的连接
+     * @return
+     */
+    size_t getConnectionCount() const { return connectionCount_.load(); }
+
+    /**
+     * 获取空闲连接的数量
+     * @return
+     */
+    size_t getIdleCount() const { return idleCount_.load(); }
+
+    /**
+     * 获取空闲连接分片的数量
+     * @return
+     */
+    size_t getShardCount() const { return shards_.size(); }
+
+    /**
+     * 建立连接失败的次数
+     * @return
+     */
+    uint64_t getCreationFailureCount() const {
+        return creationFailures_.load(std::memory_order_relaxed);
     }
 
+    /**
+     * 获取统计信息的快照
+     *
+     * 只读取原子计数，不会阻塞取用和归还连接
+     * @return
+     * @see toPrometheusText
+     */
+    PoolStats getStats() const;
+
+    /**
+     * 回收一个连接
+     */
+    void revokeConnection(ConnectionPtr& ptr);
+
 private:
     /**
-     * 创建一个已经连接到服务器的新连接
+     * 取一个连接，没有空闲连接时排队等待
+     * @param tenant        租户，没有指定租户时为nullptr
+     * @param deadline
+     * @param priority
      * @return
      */
-    Connection createConnection(Status& s) const {
-        s.clear();
+    ConnectionPtr checkout(Tenant* tenant,
+                           std::chrono::steady_clock::time_point deadline,
+                           Priority priority);
 
-        Connection connection;
+    /**
+     * 把空闲槽位放回连接池，有等待者时直接交给等待者
+     * @param slot
+     * @param now   放回的时间
+     */
+    void returnIdle(ConnectionSlot* slot,
+                    std::chrono::steady_clock::time_point now =
+                        std::chrono::steady_clock::now());
 
-        connection.setOption(option::AutoReconnect(true), s);
-        if (!s) {
-            return connection;
-        }
+    /**
+     * 加入等待队列
+     * @param waiter
+     *
+     * @note 需要持有mutex_
+     */
+    void pushWaiter(Waiter* waiter);
 
-        connection.setOption(option::ConnectTimeout(3), s);
-        if (!s) {
-            return connection;
-        }
+    /**
+     * 从等待队列中移除
+     * @param waiter
+     *
+     * @note 需要持有mutex_
+     */
+    void removeWaiter(Waiter* waiter);
 
-        connection.connect(config_.host, config_.port, config_.user,
-                           config_.password, config_.schema, s);
-        return connection;
-    }
+    /**
+     * 取出优先级最高的等待者，同一优先级下选虚拟时间最小的租户中等待最久的
+     * @return      没有等待者返回nullptr
+     *
+     * @note 需要持有mutex_
+     */
+    Waiter* popWaiter();
+
+    /**
+     * 把连接交给等待者
+     * @param waiter
+     * @param slot
+     *
+     * @note 需要持有mutex_
+     */
+    void handOff(Waiter* waiter, ConnectionSlot* slot);
+
+    /**
+     * 把分片中的空闲连接按顺序交给等待者
+     *
+     * @note 需要持有mutex_
+     */
+    void dispatchIdle();
+
+    /**
+     * 不等待地取一个连接，取不到时记录连接池为空
+     * @param counters
+     * @return      没有可用的连接时返回nullptr
+     */
+    ConnectionSlot* takeAvailable(PoolCounters& counters);
+
+    /**
+     * 把取到的槽位交给调用者
+     * @param slot
+     * @param tenant
+     * @param now
+     * @return
+     */
+    ConnectionPtr lease(ConnectionSlot* slot, Tenant* tenant,
+                        std::chrono::steady_clock::time_point now);
+
+    /**
+     * 执行已经完成的异步等待者的回调
+     *
+     * 调用者需要持有连接池，在连接池内部线程中只唤醒异步线程代为执行
+     * @note 不能持有mutex_
+     */
+    void runCompleted();
+
+    /**
+     * 回调一个完成的异步等待者并释放它
+     * @param waiter
+     */
+    void finishAsync(Waiter* waiter);
+
+    /**
+     * 把超时的异步等待者移出等待队列
+     * @param now
+     * @return      剩下的异步等待者中最早的截止时间
+     *
+     * @note 需要持有mutex_
+     */
+    std::chrono::steady_clock::time_point expireAsyncWaiters(
+        std::chrono::steady_clock::time_point now);
+
+    /**
+     * 异步线程，处理超时和内部线程完成的回调，没有异步等待者时退出
+     * @param self      异步线程运行期间持有连接池
+     */
+    void asyncLoop(std::shared_ptr<ConnectionPool> self);
+
+    /**
+     * 有等待者或者空闲连接少于minIdle时，在后台新建一个连接
+     *
+     * @note 需要持有mutex_
+     */
+    void growIfNeeded();
+
+    /**
+     * 每隔一段时间回收一次空闲超时的连接
+     */
+    void reapIfDue();
+
+    /**
+     * 关闭空闲超时的连接，至少保留minIdle个空闲连接，maxTotal_为0时不回收
+     * @return  关闭的连接数
+     */
+    size_t reapIdle();
+
+    /**
+     * 维护线程，定期检查空闲连接
+     */
+    void maintenanceLoop();
+
+    /**
+     * ping空闲超过pingIdle_的连接，重新连接断开的连接
+     *
+     * 每次只从分片中摘下一个连接，检查时不持有任何锁
+     * @note 只在维护线程中调用
+     */
+    void checkIdleConnections();
+
+    /**
+     * 从分片中摘下一个空闲和上次检查都早于expire的连接
+     * @param expire
+     * @return          没有时返回nullptr
+     */
+    ConnectionSlot* takeUnchecked(std::chrono::steady_clock::time_point expire);
+
+    /**
+     * 关闭所有重新连接失败的槽位
+     * @return          关闭的数量
+     *
+     * @note 需要持有mutex_
+     */
+    size_t freeBroken();
+
+    /**
+     * 启动后台线程建立count个连接
+     * @param count
+     *
+     * @note 需要持有mutex_
+     */
+    void startWarmUp(size_t count);
+
+    /**
+     * 后台建立连接的线程
+     * @param remaining     这一批还需要建立的连接数
+     */
+    void warmUpWorker(std::shared_ptr<std::atomic<size_t>> remaining);
+
+    /**
+     * 取出已经可以回调的就绪监听，回调需要在释放mutex_之后调用
+     * @param fired     绑定好结果的回调
+     *
+     * @note 需要持有mutex_
+     */
+    void collectReadyListeners(std::vector<std::function<void()>>& fired);
+
+    /**
+     * 在槽位上创建一个已经连接到服务器的新连接
+     * @param connection    槽位中的连接
+     * @param s
+     */
+    void createConnection(Connection& connection, Status& s);
 
     /**
      * 连接池已经连接到了服务器
@@ -287,16 +990,272 @@ private:
      */
     bool connectInvoked() const { return !config_.host.empty(); }
 
+    /**
+     * 为新建的连接开启StatementCache，并预先prepare配置的sql
+     * @param connection
+     */
+    void prepareStatements(Connection& connection);
+
+    /**
+     * 按resetPolicy恢复归还的连接的会话，失败或者还有没读完的结果集时
+     * 重新建立连接
+     * @param slot
+     * @return      重新建立也失败时释放槽位并返回false
+     */
+    bool restoreSession(ConnectionSlot* slot);
+
+    /**
+     * 当前线程对应的分片下标
+     * @return
+     */
+    size_t localShardIndex() const;
+
+    /**
+     * 取出当前线程缓存的连接
+     * @return      没有缓存的返回nullptr
+     */
+    ConnectionSlot* takeParked();
+
+    /**
+     * 把归还的连接缓存在当前线程的缓存格里
+     * @param slot
+     * @param now
+     * @return      不能缓存时返回false，由调用者放回分片
+     */
+    bool parkSlot(ConnectionSlot* slot,
+                  std::chrono::steady_clock::time_point now);
+
+    /**
+     * 从所有线程的缓存格里回收一个连接
+     * @return
+     */
+    ConnectionSlot* reclaimParked();
+
+    /**
+     * 把所有缓存格里的连接放回分片，回收和检查空闲连接之前调用
+     */
+    void unparkAll();
+
+    /**
+     * 当前线程对应的分片的计数
+     * @return
+     */
+    PoolCounters& localCounters() {
+        return shards_[localShardIndex()]->counters;
+    }
+
+    /**
+     * 从分片中取一个空闲槽位，先取本地分片，再依次窃取相邻分片，
+     * 分片都为空时从线程的缓存格里回收
+     * @return              没有空闲的返回nullptr
+     */
+    ConnectionSlot* takeIdle();
+
+    /**
+     * 把空闲槽位放入分片
+     * @param index         分片下标
+     * @param slot          空闲槽位
+     */
+    void putIdle(size_t index, ConnectionSlot* slot);
+
+    /**
+     * 摘下最多count个空闲连接，先摘重新连接失败的槽位
+     * @param count
+     * @param removed   摘下的槽位加到这个链表上，由调用者在锁外closeSlots
+     * @return          实际摘下的数量
+     *
+     * @note 需要持有mutex_
+     */
+    size_t removeIdle(size_t count, ConnectionSlot*& removed);
+
+    /**
+     * 关闭链表中的连接，再把槽位放回unusedSlots_
+     * @param slots
+     *
+     * @note 不能持有mutex_，关闭连接时不阻塞其他线程
+     */
+    void closeSlots(ConnectionSlot* slots);
+
+    /**
+     * 创建count个连接放入分片
+     * @param count
+     * @param allOrNothing  有连接失败时，是否关闭所有新建的连接
+     * @param s             第一个失败的连接的错误
+     * @return              成功连接的数量
+     *
+     * @note 需要持有mutex_
+     */
+    size_t addConnections(size_t count, bool allOrNothing, Status& s);
+
+    /**
+     * 取一个没有使用的槽位，不够时整块分配
+     * @param reserve   需要分配时，一次分配的槽位数
+     * @return
+     *
+     * @note 需要持有mutex_
+     */
+    ConnectionSlot* allocateSlot(size_t reserve);
+
+    /**
+     * 关闭槽位中的连接，并放回未使用的槽位
+     * @param slot
+     *
+     * @note 需要持有mutex_
+     */
+    void freeSlot(ConnectionSlot* slot);
+
+    /**
+     * 归还的连接是否需要关闭，resize缩小时空闲连接不够会记下需要关闭的数量
+     * @return
+     */
+    bool claimExcess();
+
 private:
     /**
-     * 空闲的连接
+     * 空闲的连接，按分片存放
+     */
+    std::vector<std::unique_ptr<Shard>> shards_;
+
+    /**
+     * 线程本地缓存的连接，没有开启stickyCache时为空
+     */
+    std::unique_ptr<ParkCell[]> parkCells_;
+
+    size_t parkCellCount_;
+
+    /**
+     * 预先分配的槽位，按块存放，地址不会改变
+     */
+    std::vector<std::unique_ptr<ConnectionSlot[]>> chunks_;
+
+    /**
+     * 没有连接的槽位组成的链表
+     */
+    ConnectionSlot* unusedSlots_;
+
+    /**
+     * 所有分片和缓存格中空闲连接的总数，用来快速判断连接池是否为空
+     */
+    std::atomic<size_t> idleCount_;
+
+    /**
+     * 在等待队列中的等待者数
+     */
+    std::atomic<size_t> waiterCount_;
+
+    /**
+     * 每个租户按优先级排队的等待者，下标为租户的序号
+     */
+    std::vector<TenantQueue> tenantQueues_;
+
+    /**
+     * 最近一次分配连接时的虚拟时间，新开始等待的租户从这里开始计算
+     */
+    uint64_t virtualTime_;
+
+    /**
+     * 添加的租户
+     */
+    std::vector<TenantPtr> tenants_;
+
+    /**
+     * 建立成功的连接数
+     */
+    std::atomic<uint64_t> creations_;
+
+    /**
+     * 建立失败的连接数
+     */
+    std::atomic<uint64_t> creationFailures_;
+
+    /**
+     * 归还时需要关闭的连接数
+     */
+    std::atomic<size_t> excessCount_;
+
+    /**
+     * 连接池管理的所有连接数，包括正在建立的连接
+     *
+     * @note 在mutex_中修改，读的时候可以不加锁
+     */
+    std::atomic<size_t> connectionCount_;
+
+    /**
+     * 至少保持的空闲连接数
+     */
+    size_t minIdle_;
+
+    /**
+     * 连接总数的上限，不大于connectionCount_时连接数固定
+     */
+    size_t maxTotal_;
+
+    /**
+     * 空闲连接的超时时间
      */
-    std::list<Connection> connections_;
+    std::chrono::milliseconds idleTimeout_;
 
     /**
-     * 连接池管理的所有连接数
+     * 上次回收空闲连接的时间，steady_clock的纳秒数
      */
-    size_t connectionCount_;
+    std::atomic<int64_t> lastReapTime_;
+
+    /**
+     * 维护线程的运行间隔
+     */
+    std::chrono::milliseconds healthCheckInterval_;
+
+    /**
+     * 空闲超过这个时间的连接需要ping
+     */
+    std::chrono::milliseconds pingIdle_;
+
+    /**
+     * 是否开启自动重连
+     */
+    bool autoReconnect_;
+
+    /**
+     * 连接归还时的回调
+     */
+    std::function<void(uint64_t)> onRelease_;
+
+    /**
+     * 执行sql的回调，设置到每个连接上
+     */
+    std::function<void(uint64_t)> onQuery_;
+
+    /**
+     * 归还的连接已经断开时的回调
+     */
+    std::function<void()> onConnectionLost_;
+
+    /**
+     * 每个连接StatementCache的容量
+     */
+    size_t statementCacheSize_;
+
+    /**
+     * 新建连接时预先prepare的sql
+     */
+    std::vector<std::string> preparedStatements_;
+
+    /**
+     * 连接归还时恢复会话状态的方式
+     */
+    PoolOptions::ResetPolicy resetPolicy_;
+
+    /**
+     * 新建连接时设置的会话状态
+     */
+    SessionOptions session_;
+
+    /**
+     * 重新连接失败的槽位，下次维护时再重试，不会被取用
+     *
+     * 仍然算在连接数里，缩容和空闲回收时优先关闭
+     */
+    ConnectionSlot* brokenSlots_;
 
     /**
      * 服务器配置
@@ -304,24 +1263,104 @@ private:
     Config config_;
 
     /**
-     * 互斥锁保护内部变量
+     * 建立连接的并发数
+     */
+    size_t warmUpConcurrency_;
+
+    /**
+     * 已经建立成功的连接数
+     */
+    size_t readyCount_;
+
+    /**
+     * 后台正在建立的连接数
+     */
+    size_t pendingCount_;
+
+    /**
+     * 最近一次建立连接失败的原因
+     */
+    Status lastError_;
+
+    /**
+     * 等待连接就绪的监听
+     */
+    std::vector<ReadyListener> readyListeners_;
+
+    /**
+     * 还在运行的后台建立连接的线程数
+     */
+    size_t activeWorkers_;
+
+    /**
+     * 连接池正在析构，后台线程不再建立新的连接
+     */
+    bool stopping_;
+
+    /**
+     * 互斥锁保护内部变量和等待队列
      */
     mutable std::mutex mutex_;
 
     /**
-     * notify
+     * 后台线程全部退出时通知
+     */
+    std::condition_variable workerCond_;
+
+    /**
+     * 唤醒维护线程退出
      */
-    std::condition_variable cond_;
+    std::condition_variable maintenanceCond_;
+
+    /**
+     * 执行异步回调的执行器
+     */
+    std::function<void(std::function<void()>)> executor_;
+
+    /**
+     * 等待队列中的异步等待者数
+     */
+    size_t asyncWaiterCount_;
+
+    /**
+     * 已经完成、还没有回调的异步等待者，后完成的在前面
+     */
+    Waiter* completed_;
+
+    /**
+     * completed_不为空，不加锁快速判断
+     */
+    std::atomic<bool> hasCompleted_;
+
+    /**
+     * 异步线程是否在运行
+     */
+    bool asyncRunning_;
+
+    /**
+     * 有新的异步等待者或者完成的回调时唤醒异步线程
+     */
+    std::condition_variable asyncCond_;
+
+    /**
+     * 中断超时的查询，所有连接共用
+     */
+    std::shared_ptr<QueryWatchdog> watchdog_;
+
+    /**
+     * 维护线程
+     */
+    std::thread maintenanceThread_;
 };
 
 inline void ConnectionPtr::release() {
-    auto ptr = pool_.lock();
-    if (ptr) {
-        ptr->revokeConnection(*this);
-        pool_.reset();
-    } else {
-        connection_.close();
+    if (slot_ == nullptr) {
+        return;
     }
+
+    pool_->revokeConnection(*this);
+    slot_ = nullptr;
+    pool_.reset();
 }
 
 using ConnectionPoolPtr = std::shared_ptr<ConnectionPool>;
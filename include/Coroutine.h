@@ -0,0 +1,623 @@
+//
+// Created by m8792 on 2021/1/10.
+//
+
+#ifndef MYSQL_CONNECTOR_COROUTINE_H
+#define MYSQL_CONNECTOR_COROUTINE_H
+
+#if defined(MYSQL_CONNECTOR_WITH_COROUTINE) && __cplusplus >= 202002L
+
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#include "ConnectionPool.h"
+#include "PreparedStatement.h"
+#include "Reactor.h"
+#include "Statement.h"
+#include "Status.h"
+
+namespace db {
+
+namespace coro {
+
+/**
+ * 执行器，参数为要执行的任务
+ */
+using Executor = std::function<void(std::function<void()>)>;
+
+template <typename T>
+class Task;
+
+namespace detail {
+
+template <typename T>
+struct TaskPromise;
+
+/**
+ * Task协程的promise中和返回值无关的部分
+ */
+struct TaskPromiseBase {
+    /**
+     * co_await这个Task的协程，结束时恢复它
+     */
+    std::coroutine_handle<> continuation;
+
+    std::exception_ptr exception;
+
+    struct FinalAwaiter {
+        bool await_ready() const noexcept { return false; }
+
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(
+            std::coroutine_handle<Promise> handle) noexcept {
+            std::coroutine_handle<> continuation =
+                handle.promise().continuation;
+            return continuation ? continuation : std::noop_coroutine();
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+
+    FinalAwaiter final_suspend() const noexcept { return {}; }
+
+    void unhandled_exception() { exception = std::current_exception(); }
+};
+
+template <typename T>
+struct TaskPromise : TaskPromiseBase {
+    std::optional<T> value;
+
+    Task<T> get_return_object();
+
+    void return_value(T result) { value.emplace(std::move(result)); }
+
+    T result() {
+        if (exception) {
+            std::rethrow_exception(exception);
+        }
+        return std::move(*value);
+    }
+};
+
+template <>
+struct TaskPromise<void> : TaskPromiseBase {
+    Task<void> get_return_object();
+
+    void return_void() {}
+
+    void result() {
+        if (exception) {
+            std::rethrow_exception(exception);
+        }
+    }
+};
+
+/**
+ * 不需要等待结果的协程，开始后一直运行到结束并自己释放
+ */
+struct Detached {
+    struct promise_type {
+        Detached get_return_object() const noexcept { return {}; }
+
+        std::suspend_never initial_suspend() const noexcept { return {}; }
+
+        std::suspend_never final_suspend() const noexcept { return {}; }
+
+        void return_void() const noexcept {}
+
+        void unhandled_exception() const noexcept { std::terminate(); }
+    };
+};
+
+}  // namespace detail
+
+/**
+ * 惰性开始的协程，被co_await时才开始执行
+ *
+ * 只能被co_await一次，结束时恢复等待它的协程
+ * @tparam T    co_return的类型
+ */
+template <typename T = void>
+class Task {
+public:
+    using promise_type = detail::TaskPromise<T>;
+
+    Task(Task&& other) noexcept
+        : handle_(std::exchange(other.handle_, nullptr)) {}
+
+    Task(const Task&) = delete;
+
+    Task& operator=(const Task&) = delete;
+
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            if (handle_) {
+                handle_.destroy();
+            }
+            handle_ = std::exchange(other.handle_, nullptr);
+        }
+        return *this;
+    }
+
+    ~Task() {
+        if (handle_) {
+            handle_.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    std::coroutine_handle<> await_suspend(
+        std::coroutine_handle<> continuation) noexcept {
+        handle_.promise().continuation = continuation;
+        return handle_;
+    }
+
+    T await_resume() { return handle_.promise().result(); }
+
+private:
+    friend struct detail::TaskPromise<T>;
+
+    explicit Task(std::coroutine_handle<promise_type> handle)
+        : handle_(handle) {}
+
+private:
+    std::coroutine_handle<promise_type> handle_;
+};
+
+namespace detail {
+
+template <typename T>
+Task<T> TaskPromise<T>::get_return_object() {
+    return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() {
+    return Task<void>(
+        std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+/**
+ * 由回调完成的异步操作
+ *
+ * 派生类实现start()发起操作，在回调中保存结果后调用complete()。
+ * 回调可能在start()返回之前执行，这时协程不会挂起
+ * @tparam Derived
+ */
+template <typename Derived>
+class CallbackAwaiter {
+public:
+    explicit CallbackAwaiter(Executor executor)
+        : executor_(std::move(executor)), completed_(false) {}
+
+    bool await_ready() const noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> handle) {
+        handle_ = handle;
+        static_cast<Derived*>(this)->start();
+        // 后到的一方负责继续执行协程
+        return !completed_.exchange(true);
+    }
+
+protected:
+    void complete() {
+        // exchange之后协程可能已经在其他线程继续执行并销毁了awaiter，
+        // 需要的成员先复制出来，之后不再访问this
+        std::coroutine_handle<> handle = handle_;
+        Executor executor = executor_;
+        if (!completed_.exchange(true)) {
+            return;
+        }
+
+        if (executor) {
+            executor([handle] { handle.resume(); });
+        } else {
+            handle.resume();
+        }
+    }
+
+private:
+    /**
+     * 恢复协程的执行器，为空时在完成回调的线程中恢复
+     */
+    Executor executor_;
+
+    std::coroutine_handle<> handle_;
+
+    std::atomic<bool> completed_;
+};
+
+/**
+ * 在offload上执行阻塞的调用，完成后恢复协程
+ * @tparam Result   调用的返回值
+ */
+template <typename Result>
+class OffloadAwaiter : public CallbackAwaiter<OffloadAwaiter<Result>> {
+public:
+    OffloadAwaiter(std::function<Result()> call, Executor offload,
+                   Executor executor)
+        : CallbackAwaiter<OffloadAwaiter<Result>>(std::move(executor)),
+          call_(std::move(call)),
+          offload_(std::move(offload)) {}
+
+    void start() {
+        offload_([this] {
+            result_.emplace(call_());
+            this->complete();
+        });
+    }
+
+    Result await_resume() { return std::move(*result_); }
+
+private:
+    std::function<Result()> call_;
+
+    Executor offload_;
+
+    std::optional<Result> result_;
+};
+
+}  // namespace detail
+
+/**
+ * 单线程的调度器，在调用run()的线程中依次执行任务和恢复协程
+ */
+class Scheduler {
+public:
+    Scheduler() : stopping_(false) {}
+
+    Scheduler(const Scheduler&) = delete;
+
+    Scheduler& operator=(const Scheduler&) = delete;
+
+    /**
+     * 提交一个任务，可以在任何线程中调用
+     * @param task
+     */
+    void post(std::function<void()> task);
+
+    /**
+     * 把任务提交到这个调度器的执行器
+     * @return
+     */
+    Executor executor() {
+        return [this](std::function<void()> task) { post(std::move(task)); };
+    }
+
+    /**
+     * co_await之后在调度器的线程中继续执行
+     * @return
+     */
+    auto schedule() {
+        struct Awaiter {
+            Scheduler* scheduler;
+
+            bool await_ready() const noexcept { return false; }
+
+            void await_suspend(std::coroutine_handle<> handle) {
+                scheduler->post([handle] { handle.resume(); });
+            }
+
+            void await_resume() const noexcept {}
+        };
+        return Awaiter{this};
+    }
+
+    /**
+     * 在调度器中开始执行协程，不等待结果
+     * @param task
+     */
+    void spawn(Task<void> task) { launch(std::move(task)); }
+
+    /**
+     * 执行任务，直到调用stop()
+     */
+    void run();
+
+    /**
+     * 让run()在执行完已经提交的任务之后返回
+     */
+    void stop();
+
+private:
+    detail::Detached launch(Task<void> task) {
+        co_await schedule();
+        co_await task;
+    }
+
+private:
+    std::mutex mutex_;
+
+    std::condition_variable cond_;
+
+    std::deque<std::function<void()>> tasks_;
+
+    bool stopping_;
+};
+
+/**
+ * 在当前线程中等待协程结束
+ * @tparam T
+ * @param task
+ * @return
+ */
+template <typename T>
+T syncWait(Task<T> task) {
+    std::promise<T> promise;
+    std::future<T> future = promise.get_future();
+    [](Task<T> task, std::promise<T>& promise) -> detail::Detached {
+        try {
+            if constexpr (std::is_void_v<T>) {
+                co_await task;
+                promise.set_value();
+            } else {
+                promise.set_value(co_await task);
+            }
+        } catch (...) {
+            promise.set_exception(std::current_exception());
+        }
+    }(std::move(task), promise);
+    return future.get();
+}
+
+/**
+ * co_await从连接池取连接，等待时不阻塞线程
+ * @param pool
+ * @param timeoutMs     超时时间毫秒，小于0一直等待，等于0不等待
+ * @param executor      恢复协程的执行器，为空时在归还连接的线程中恢复
+ * @return              超时时得到空的ConnectionPtr
+ */
+inline auto getConnection(ConnectionPoolPtr pool, int timeoutMs = -1,
+                          Executor executor = nullptr) {
+    class Awaiter : public detail::CallbackAwaiter<Awaiter> {
+    public:
+        Awaiter(ConnectionPoolPtr pool, int timeoutMs, Executor executor)
+            : detail::CallbackAwaiter<Awaiter>(std::move(executor)),
+              pool_(std::move(pool)),
+              timeoutMs_(timeoutMs) {}
+
+        void start() {
+            pool_->getConnectionAsync(timeoutMs_, [this](ConnectionPtr ptr) {
+                ptr_ = std::move(ptr);
+                complete();
+            });
+        }
+
+        ConnectionPtr await_resume() { return std::move(ptr_); }
+
+    private:
+        ConnectionPoolPtr pool_;
+
+        int timeoutMs_;
+
+        ConnectionPtr ptr_;
+    };
+    return Awaiter(std::move(pool), timeoutMs, std::move(executor));
+}
+
+/**
+ * co_await执行PreparedStatement的select语句并读取全部结果
+ *
+ * libmysqlclient没有PreparedStatement的非阻塞接口，
+ * 阻塞的调用在offload上执行，协程所在的线程不会被阻塞
+ * @param statement
+ * @param s
+ * @param offload       执行阻塞调用的执行器，例如一个线程池
+ * @param executor      恢复协程的执行器，为空时在offload的线程中恢复
+ * @return
+ */
+inline auto executeQuery(PreparedStatement& statement, Status& s,
+                         Executor offload, Executor executor = nullptr) {
+    PreparedStatement* stmt = &statement;
+    Status* status = &s;
+    return detail::OffloadAwaiter<PreparedResultSet>(
+        [stmt, status] {
+            stmt->execute(*status);
+            if (!*status) {
+                return PreparedResultSet();
+            }
+            return stmt->getResultSet(*status);
+        },
+        std::move(offload), std::move(executor));
+}
+
+/**
+ * co_await执行PreparedStatement的update/delete语句
+ * @param statement
+ * @param s
+ * @param offload       执行阻塞调用的执行器，例如一个线程池
+ * @param executor      恢复协程的执行器，为空时在offload的线程中恢复
+ * @return              受影响的行数，失败时为-1
+ */
+inline auto execute(PreparedStatement& statement, Status& s, Executor offload,
+                    Executor executor = nullptr) {
+    PreparedStatement* stmt = &statement;
+    Status* status = &s;
+    return detail::OffloadAwaiter<int64_t>(
+        [stmt, status]() -> int64_t {
+            stmt->execute(*status);
+            if (!*status) {
+                return -1;
+            }
+            return stmt->getAffectedRowCount();
+        },
+        std::move(offload), std::move(executor));
+}
+
+#ifdef MYSQL_CONNECTOR_HAS_NONBLOCKING
+
+namespace detail {
+
+/**
+ * 由Reactor非阻塞地建立连接
+ */
+class ConnectAwaiter : public CallbackAwaiter<ConnectAwaiter> {
+public:
+    ConnectAwaiter(Reactor& reactor, Connection& connection,
+                   const std::string& host, unsigned short port,
+                   const std::string& user, const std::string& password,
+                   const std::string& schema, Status& s, Executor executor)
+        : CallbackAwaiter<ConnectAwaiter>(std::move(executor)),
+          reactor_(reactor),
+          connection_(connection),
+          host_(host),
+          port_(port),
+          user_(user),
+          password_(password),
+          schema_(schema),
+          status_(s) {}
+
+    void start() {
+        reactor_.connect(connection_, host_, port_, user_, password_, schema_,
+                         [this](const Status& s) {
+                             status_ = s;
+                             complete();
+                         });
+    }
+
+    void await_resume() const noexcept {}
+
+private:
+    Reactor& reactor_;
+
+    Connection& connection_;
+
+    std::string host_;
+
+    unsigned short port_;
+
+    std::string user_;
+
+    std::string password_;
+
+    std::string schema_;
+
+    Status& status_;
+};
+
+/**
+ * 由Reactor非阻塞地执行sql
+ * @tparam Result   ResultSet返回结果集，int64_t返回受影响的行数
+ */
+template <typename Result>
+class QueryAwaiter : public CallbackAwaiter<QueryAwaiter<Result>> {
+public:
+    QueryAwaiter(Reactor& reactor, Connection& connection,
+                 const std::string& sql, Status& s, Executor executor)
+        : CallbackAwaiter<QueryAwaiter<Result>>(std::move(executor)),
+          reactor_(reactor),
+          connection_(connection),
+          sql_(sql),
+          status_(s),
+          affectedRows_(-1) {}
+
+    void start() {
+        reactor_.executeQuery(
+            connection_, sql_, [this](ResultSet rs, const Status& s) {
+                status_ = s;
+                result_ = std::move(rs);
+                if (s) {
+                    affectedRows_ = mysql_affected_rows(connection_.get());
+                }
+                this->complete();
+            });
+    }
+
+    Result await_resume() {
+        if constexpr (std::is_same_v<Result, ResultSet>) {
+            return std::move(result_);
+        } else {
+            return affectedRows_;
+        }
+    }
+
+private:
+    Reactor& reactor_;
+
+    Connection& connection_;
+
+    std::string sql_;
+
+    Status& status_;
+
+    ResultSet result_;
+
+    int64_t affectedRows_;
+};
+
+}  // namespace detail
+
+/**
+ * co_await非阻塞地建立连接
+ * @param reactor
+ * @param connection    还没有连接的Connection
+ * @param host
+ * @param port
+ * @param user
+ * @param password
+ * @param schema
+ * @param s
+ * @param executor      恢复协程的执行器，为空时在Reactor的线程中恢复
+ * @return
+ */
+inline auto connect(Reactor& reactor, Connection& connection,
+                    const std::string& host, unsigned short port,
+                    const std::string& user, const std::string& password,
+                    const std::string& schema, Status& s,
+                    Executor executor = nullptr) {
+    return detail::ConnectAwaiter(reactor, connection, host, port, user,
+                                  password, schema, s, std::move(executor));
+}
+
+/**
+ * co_await执行select语句，等待socket就绪时挂起
+ * @param reactor
+ * @param statement     Reactor建立的连接创建的Statement
+ * @param sql
+ * @param s
+ * @param executor      恢复协程的执行器，为空时在Reactor的线程中恢复
+ * @return              全部读到内存中的结果集
+ */
+inline auto executeQuery(Reactor& reactor, Statement& statement,
+                         const std::string& sql, Status& s,
+                         Executor executor = nullptr) {
+    return detail::QueryAwaiter<ResultSet>(
+        reactor, statement.getConnection(), sql, s, std::move(executor));
+}
+
+/**
+ * co_await执行update/delete语句
+ * @param reactor
+ * @param statement     Reactor建立的连接创建的Statement
+ * @param sql
+ * @param s
+ * @param executor      恢复协程的执行器，为空时在Reactor的线程中恢复
+ * @return              受影响的行数，失败时为-1
+ */
+inline auto executeUpdate(Reactor& reactor, Statement& statement,
+                          const std::string& sql, Status& s,
+                          Executor executor = nullptr) {
+    return detail::QueryAwaiter<int64_t>(
+        reactor, statement.getConnection(), sql, s, std::move(executor));
+}
+
+#endif  // MYSQL_CONNECTOR_HAS_NONBLOCKING
+
+}  // namespace coro
+
+}  // namespace db
+
+#endif  // MYSQL_CONNECTOR_WITH_COROUTINE
+
+#endif  // MYSQL_CONNECTOR_COROUTINE_H
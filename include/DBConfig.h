@@ -6,6 +6,8 @@
 #define MYSQL_CONNECTOR_DBCONFIG_H
 
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace db {
 
@@ -41,6 +43,46 @@ struct DBConfig {
     int connectionFlag;
 };
 
+/**
+ * 连接建立时设置的会话状态
+ *
+ * 字符集在握手时协商，其余的合并成一条SET语句作为MYSQL_INIT_COMMAND，
+ * 在握手过程中执行，不需要额外的往返
+ */
+struct SessionOptions {
+    /**
+     * 是否自动提交
+     */
+    bool autoCommit;
+
+    /**
+     * 事务隔离级别，取值为Connection::IsolationLevel，0表示使用服务器的默认值
+     */
+    int isolationLevel;
+
+    /**
+     * 字符集，例如utf8mb4，空表示使用客户端库的默认值
+     */
+    std::string charset;
+
+    /**
+     * 时区，例如+08:00，空表示不设置
+     */
+    std::string timeZone;
+
+    /**
+     * sql_mode，空表示不设置
+     */
+    std::string sqlMode;
+
+    /**
+     * 其他会话变量，值按原样拼接到SET语句中，字符串需要自己加引号
+     */
+    std::vector<std::pair<std::string, std::string>> variables;
+
+    SessionOptions() : autoCommit(true), isolationLevel(0) {}
+};
+
 }  // namespace db
 
 #endif  // MYSQL_CONNECTOR_DBCONFIG_H
@@ -0,0 +1,281 @@
+//
+// Created by m8792 on 2021/1/11.
+//
+
+#ifndef MYSQL_CONNECTOR_FANOUT_H
+#define MYSQL_CONNECTOR_FANOUT_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "ConnectionPool.h"
+#include "PreparedStatement.h"
+#include "ResultSet.h"
+#include "Statement.h"
+#include "Status.h"
+
+namespace db {
+
+/**
+ * FanOut中的一个查询
+ */
+struct FanOutTask {
+    /**
+     * 执行查询的连接池，比如某个分片的连接池
+     */
+    ConnectionPoolPtr pool;
+
+    std::string sql;
+
+    /**
+     * 为空时用Statement执行sql，否则prepare sql之后用它绑定参数
+     */
+    std::function<void(PreparedStatement&, Status&)> bind;
+};
+
+/**
+ * FanOut中一个查询的结果
+ */
+struct FanOutResult {
+    /**
+     * 对应的FanOutTask的下标
+     */
+    size_t index;
+
+    Status status;
+
+    /**
+     * 受影响的行数，有结果集时为-1
+     */
+    int64_t affectedRows;
+
+    /**
+     * Statement执行select语句的结果集
+     */
+    ResultSet resultSet;
+
+    /**
+     * prepared的select语句结果的列名和类型
+     */
+    ResultShapePtr shape;
+
+    /**
+     * prepared的select语句的全部行
+     *
+     * 在查询线程中读出，连接在结果返回之前已经归还，
+     * 持有结果不会占用连接池中的连接
+     */
+    std::vector<std::vector<Value>> rows;
+
+    FanOutResult() : index(0), affectedRows(-1) {}
+};
+
+class FanOut;
+
+/**
+ * 一次提交给FanOut的一组查询
+ *
+ * 释放之后还没有开始的查询不再执行
+ */
+class FanOutCall {
+public:
+    FanOutCall(const FanOutCall&) = delete;
+
+    FanOutCall& operator=(const FanOutCall&) = delete;
+
+    /**
+     * 按完成的顺序取下一个结果
+     *
+     * 到达deadline时取消还没有完成的查询，每个查询都会有一个结果。
+     * 没有调用next时，执行中的查询到达deadline由连接池的QueryWatchdog中断
+     * @param result
+     * @return          所有结果都已经取出时返回false
+     */
+    bool next(FanOutResult& result);
+
+    /**
+     * 取消还没有完成的查询
+     *
+     * 还没有开始的不再执行，正在执行的通过KILL QUERY中断，
+     * 它们的结果立即以错误返回
+     */
+    void cancel();
+
+    /**
+     * 查询的数量
+     * @return
+     */
+    size_t size() const { return tasks_.size(); }
+
+private:
+    friend class FanOut;
+
+    enum TaskState { PENDING, RUNNING, DONE };
+
+    /**
+     * 需要中断的查询：下标和所在连接的mysql_thread_id
+     */
+    using Kill = std::pair<size_t, unsigned long>;
+
+    FanOutCall(std::vector<FanOutTask> tasks,
+               std::chrono::steady_clock::time_point deadline);
+
+    /**
+     * 在FanOut的线程中执行第index个查询
+     * @param index
+     */
+    void run(size_t index);
+
+    /**
+     * 执行查询并保存结果
+     * @param task
+     * @param connection
+     * @param result
+     */
+    void execute(const FanOutTask& task, ConnectionPtr& connection,
+                 FanOutResult& result);
+
+    /**
+     * 第index个查询是否已经被取消
+     * @param index
+     * @return
+     */
+    bool cancelled(size_t index);
+
+    /**
+     * 查询完成，已经被取消的丢弃结果
+     * @param result
+     */
+    void finish(FanOutResult result);
+
+    /**
+     * 取消还没有完成的查询，它们的结果为reason
+     * @param reason
+     * @return          正在执行、需要中断的查询，释放mutex_之后调用kill
+     *
+     * @note 需要持有mutex_
+     */
+    std::vector<Kill> cancelLocked(const Status& reason);
+
+    /**
+     * 中断查询，查询线程在finish中等待，连接不会在中断之前被归还
+     * @param kills     cancelLocked的返回值
+     *
+     * @note 不能持有mutex_
+     */
+    void kill(const std::vector<Kill>& kills);
+
+private:
+    std::vector<FanOutTask> tasks_;
+
+    std::chrono::steady_clock::time_point deadline_;
+
+    std::mutex mutex_;
+
+    std::condition_variable cond_;
+
+    /**
+     * 中断结束时通知
+     */
+    std::condition_variable killedCond_;
+
+    std::vector<TaskState> states_;
+
+    /**
+     * 正在执行的查询所在连接的mysql_thread_id，用来中断查询
+     */
+    std::vector<unsigned long> threadIds_;
+
+    /**
+     * 是否正在中断第i个查询
+     */
+    std::vector<bool> killing_;
+
+    /**
+     * 已经完成还没有取出的结果
+     */
+    std::deque<FanOutResult> ready_;
+
+    /**
+     * 已经取出的结果数
+     */
+    size_t taken_;
+
+    bool cancelled_;
+};
+
+using FanOutCallPtr = std::shared_ptr<FanOutCall>;
+
+/**
+ * 在多个连接池上并发执行一组查询，按完成的顺序取回结果
+ *
+ * 查询在固定数量的线程中执行，同时执行的查询不会超过线程数
+ */
+class FanOut {
+public:
+    /**
+     * @param threadCount       执行查询的线程数
+     */
+    explicit FanOut(size_t threadCount);
+
+    FanOut(const FanOut&) = delete;
+
+    FanOut& operator=(const FanOut&) = delete;
+
+    /**
+     * 等待正在执行的查询完成，还没有开始的查询以错误结束
+     */
+    ~FanOut();
+
+    /**
+     * 提交一组查询
+     * @param tasks
+     * @param timeoutMs     所有查询的超时时间毫秒，小于0一直等待
+     * @return
+     */
+    FanOutCallPtr submit(std::vector<FanOutTask> tasks, int timeoutMs = -1);
+
+    /**
+     * 提交一组查询
+     * @param tasks
+     * @param deadline      到达时取消还没有完成的查询
+     * @return
+     */
+    FanOutCallPtr submit(std::vector<FanOutTask> tasks,
+                         std::chrono::steady_clock::time_point deadline);
+
+private:
+    /**
+     * 一个查询
+     */
+    struct Job {
+        std::weak_ptr<FanOutCall> call;
+
+        size_t index;
+    };
+
+    void workerLoop();
+
+private:
+    std::mutex mutex_;
+
+    std::condition_variable cond_;
+
+    std::deque<Job> jobs_;
+
+    bool stopping_;
+
+    std::vector<std::thread> workers_;
+};
+
+}  // namespace db
+
+#endif  // MYSQL_CONNECTOR_FANOUT_H
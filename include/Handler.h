@@ -35,6 +35,7 @@ public:
         ConnectionHandler tmp;
         this->swap(other);
         other.swap(tmp);
+        return *this;
     }
 
     ~ConnectionHandler() { close(); }
@@ -88,6 +89,7 @@ public:
         StatementHandler tmp;
         this->swap(other);
         other.swap(tmp);
+        return *this;
     }
 
     ~StatementHandler() { close(); }
@@ -104,6 +106,16 @@ public:
         swap(stmt_, other.stmt_);
     }
 
+    /**
+     * 放弃所有权，不会关闭stmt
+     * @return
+     */
+    MYSQL_STMT* release() {
+        MYSQL_STMT* stmt = stmt_;
+        stmt_ = nullptr;
+        return stmt;
+    }
+
     MYSQL_STMT* get() const { return stmt_; }
 
     bool valid() const { return stmt_ != nullptr; }
@@ -136,6 +148,7 @@ public:
         ResultSetHandler tmp;
         this->swap(other);
         other.swap(tmp);
+        return *this;
     }
 
     ~ResultSetHandler() { close(); }
@@ -152,7 +165,7 @@ public:
         swap(res_, other.res_);
     }
 
-    MYSQL_RES* get() { return res_; }
+    MYSQL_RES* get() const { return res_; }
 
     void assign(MYSQL_RES* res) {
         close();
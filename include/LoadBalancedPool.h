@@ -0,0 +1,315 @@
+//
+// Created by m8792 on 2021/1/6.
+//
+
+#ifndef MYSQL_CONNECTOR_LOADBALANCEDPOOL_H
+#define MYSQL_CONNECTOR_LOADBALANCEDPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ConnectionPool.h"
+
+namespace db {
+
+/**
+ * 服务器的地址
+ */
+struct Endpoint {
+    std::string host;
+
+    unsigned short port;
+
+    Endpoint(const std::string& host = "", unsigned short port = 0)
+        : host(host), port(port) {}
+};
+
+/**
+ * 负载均衡连接池的选项
+ */
+struct LoadBalancerOptions {
+    /**
+     * 每个服务器的连接数
+     */
+    size_t connectionsPerHost;
+
+    /**
+     * 每个服务器的连接池选项，onRelease、onQuery和onConnectionLost会被覆盖
+     */
+    PoolOptions poolOptions;
+
+    /**
+     * 第一次摘除服务器的时长，毫秒，之后每次连续失败翻倍
+     */
+    int ejectBaseMs;
+
+    /**
+     * 摘除服务器的最大时长，毫秒
+     */
+    int ejectMaxMs;
+
+    /**
+     * 后台检查服务器状态的间隔，毫秒
+     */
+    int checkIntervalMs;
+
+    LoadBalancerOptions()
+        : connectionsPerHost(8),
+          ejectBaseMs(1000),
+          ejectMaxMs(60000),
+          checkIntervalMs(500) {}
+};
+
+/**
+ * 多个等价服务器之间负载均衡的连接池
+ *
+ * 每个服务器一个ConnectionPool。取连接时随机选两个可用的服务器，
+ * 使用 (正在使用的连接数 + 1) * 查询延迟的EWMA 较小的一个。
+ * 建立连接失败、连接在使用中断开或者通过markFailure报告错误的服务器
+ * 会被摘除一段时间，连续失败时摘除时长指数增长；到期之后先试着建立一个
+ * 连接，成功了才恢复分配
+ */
+class LoadBalancedPool {
+public:
+    explicit LoadBalancedPool(
+        const std::vector<Endpoint>& endpoints,
+        const LoadBalancerOptions& options = LoadBalancerOptions());
+
+    LoadBalancedPool(const LoadBalancedPool&) = delete;
+
+    LoadBalancedPool& operator=(const LoadBalancedPool&) = delete;
+
+    ~LoadBalancedPool();
+
+    /**
+     * 连接所有服务器
+     *
+     * 连接失败的服务器会被摘除，由后台线程重试
+     * @param user
+     * @param password
+     * @param schema
+     * @param s         所有服务器都连接失败时报错
+     */
+    void connect(const std::string& user, const std::string& password,
+                 const std::string& schema, Status& s);
+
+    /**
+     * 获取一个连接
+     * @param timeoutMs     超时时间毫秒，小于0一直等待，等于0不等待
+     * @return              没有可用的服务器时返回空的ConnectionPtr
+     */
+    ConnectionPtr getConnection(int timeoutMs = -1);
+
+    /**
+     * 报告连接所在的服务器出错，比如执行sql时连接断开，下次检查时摘除
+     *
+     * 连接断开的错误在归还连接时会自动报告，不需要再调用
+     * @param ptr       从这个连接池取出的连接
+     */
+    void markFailure(const ConnectionPtr& ptr);
+
+    size_t getHostCount() const { return hosts_.size(); }
+
+    const Endpoint& getEndpoint(size_t index) const {
+        return hosts_.at(index)->endpoint;
+    }
+
+    /**
+     * 服务器是否被摘除
+     * @param index
+     * @return
+     */
+    bool isEjected(size_t index) const {
+        return hosts_.at(index)->ejected.load();
+    }
+
+    /**
+     * 从服务器取出还没有归还的连接数
+     * @param index
+     * @return
+     */
+    size_t getOutstanding(size_t index) const {
+        return hosts_.at(index)->load->outstanding.load();
+    }
+
+    /**
+     * 查询延迟的EWMA，微秒
+     * @param index
+     * @return
+     */
+    uint64_t getLatency(size_t index) const {
+        return hosts_.at(index)->load->latency.load();
+    }
+
+    /**
+     * 检查一次所有服务器，摘除新出现错误的服务器，重试到期的服务器
+     *
+     * 后台线程会定期调用
+     */
+    void checkHosts();
+
+private:
+    /**
+     * 服务器的负载
+     *
+     * 连接池的onRelease回调持有，连接在LoadBalancedPool析构之后归还也能访问
+     */
+    struct Load {
+        std::atomic<size_t> outstanding;
+
+        /**
+         * 发送sql到收到响应的时间的EWMA，微秒，不包括持有连接的空闲时间
+         */
+        std::atomic<uint64_t> latency;
+
+        /**
+         * 连接断开和markFailure报告的错误数
+         */
+        std::atomic<uint64_t> errors;
+
+        Load() : outstanding(0), latency(0), errors(0) {}
+
+        /**
+         * 每次执行sql之后更新延迟
+         * @param elapsed       发送sql到收到响应的微秒数
+         */
+        void record(uint64_t elapsed);
+    };
+
+    struct Host {
+        Endpoint endpoint;
+
+        /**
+         * 服务器的连接池，重新连接时会被替换，使用std::atomic_load读取
+         */
+        ConnectionPoolPtr pool;
+
+        std::shared_ptr<Load> load;
+
+        /**
+         * 是否有连接池，没有连接过或者连接失败时为false
+         */
+        std::atomic<bool> connected;
+
+        /**
+         * 被摘除时不再分配新的请求，没有连接池时也为true
+         */
+        std::atomic<bool> ejected;
+
+        /**
+         * 以下只在持有mutex_时访问
+         */
+
+        /**
+         * 摘除到这个时间
+         */
+        std::chrono::steady_clock::time_point ejectedUntil;
+
+        /**
+         * 下次摘除的时长
+         */
+        std::chrono::milliseconds backoff;
+
+        /**
+         * 上次检查时连接池建连失败的次数
+         */
+        uint64_t failures;
+
+        /**
+         * 上次检查时Load中的错误数
+         */
+        uint64_t errors;
+
+        explicit Host(const Endpoint& endpoint)
+            : endpoint(endpoint),
+              load(std::make_shared<Load>()),
+              connected(false),
+              ejected(true),
+              backoff(0),
+              failures(0),
+              errors(0) {}
+    };
+
+    /**
+     * 为服务器创建连接池并连接
+     * @param host
+     * @param s
+     * @return
+     */
+    ConnectionPoolPtr createPool(Host& host, Status& s);
+
+    /**
+     * 建立一个单独的连接，检查摘除的服务器是否恢复
+     * @param host
+     * @return
+     */
+    bool probe(const Host& host);
+
+    /**
+     * 恢复分配，记下当前的错误数
+     * @param host
+     * @param pool
+     *
+     * @note 需要持有mutex_
+     */
+    void admit(Host& host, const ConnectionPoolPtr& pool);
+
+    /**
+     * 摘除服务器
+     * @param host
+     * @param now
+     *
+     * @note 需要持有mutex_
+     */
+    void eject(Host& host, std::chrono::steady_clock::time_point now);
+
+    /**
+     * 选择服务器
+     * @return  没有可用的服务器时返回nullptr
+     */
+    Host* pickHost();
+
+    /**
+     * 服务器的负载，越小越优先
+     * @param host
+     * @return
+     */
+    static uint64_t cost(const Host& host);
+
+    void checkLoop();
+
+private:
+    std::vector<std::unique_ptr<Host>> hosts_;
+
+    LoadBalancerOptions options_;
+
+    std::string user_;
+
+    std::string password_;
+
+    std::string schema_;
+
+    bool connected_;
+
+    bool stopping_;
+
+    std::mutex mutex_;
+
+    std::condition_variable cond_;
+
+    /**
+     * 检查服务器状态的线程
+     */
+    std::thread checkThread_;
+};
+
+using LoadBalancedPoolPtr = std::shared_ptr<LoadBalancedPool>;
+
+}  // namespace db
+
+#endif  // MYSQL_CONNECTOR_LOADBALANCEDPOOL_H
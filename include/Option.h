@@ -98,6 +98,8 @@ private:
 
 using ConnectTimeout = IntegerOption<MYSQL_OPT_CONNECT_TIMEOUT>;
 using AutoReconnect = BoolOption<MYSQL_OPT_RECONNECT>;
+using InitCommand = StringOption<MYSQL_INIT_COMMAND>;
+using CharsetName = StringOption<MYSQL_SET_CHARSET_NAME>;
 
 }  // namespace option
 
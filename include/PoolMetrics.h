@@ -0,0 +1,265 @@
+//
+// Created by m8792 on 2021/1/3.
+//
+
+#ifndef MYSQL_CONNECTOR_POOLMETRICS_H
+#define MYSQL_CONNECTOR_POOLMETRICS_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace db {
+
+/**
+ * Histogram的快照
+ */
+struct HistogramSnapshot {
+    /**
+     * 每个桶中的数量，下标和Histogram中的桶一致
+     */
+    std::vector<uint64_t> counts;
+
+    /**
+     * 记录的总次数
+     */
+    uint64_t count;
+
+    /**
+     * 记录的值的总和
+     */
+    uint64_t sum;
+
+    HistogramSnapshot() : count(0), sum(0) {}
+
+    /**
+     * 合并另一个快照
+     * @param other
+     */
+    void merge(const HistogramSnapshot& other);
+
+    /**
+     * 获取分位数
+     * @param quantile      [0, 1]
+     * @return              所在桶的上界，误差在1/8以内
+     */
+    uint64_t percentile(double quantile) const;
+
+    /**
+     * 平均值
+     * @return
+     */
+    double mean() const { return count == 0 ? 0 : double(sum) / count; }
+};
+
+/**
+ * HDR风格的直方图
+ *
+ * 按2的幂分级，每一级再分成8个桶，相对误差不超过1/8。
+ * 记录只有几次relaxed的原子加，不加锁，可以在取连接的路径上使用
+ */
+class Histogram {
+public:
+    /**
+     * 每一级的子桶数为 2^kSubBucketBits
+     */
+    static const int kSubBucketBits = 3;
+
+    static const uint64_t kSubBucketCount = 1 << kSubBucketBits;
+
+    /**
+     * 能记录的最大值为 2^kMaxBits - 1，更大的值记在最后一个桶
+     */
+    static const int kMaxBits = 40;
+
+    static const size_t kBucketCount =
+        (kMaxBits - kSubBucketBits + 1) * kSubBucketCount;
+
+public:
+    Histogram() : count_(0), sum_(0) {
+        for (size_t i = 0; i < kBucketCount; ++i) {
+            counts_[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    Histogram(const Histogram&) = delete;
+
+    Histogram& operator=(const Histogram&) = delete;
+
+    /**
+     * 记录一个值
+     * @param value
+     */
+    void record(uint64_t value) {
+        counts_[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    /**
+     * 把当前的数据加到快照中
+     * @param snapshot
+     */
+    void collect(HistogramSnapshot& snapshot) const;
+
+    /**
+     * 值所在的桶
+     * @param value
+     * @return
+     */
+    static size_t bucketIndex(uint64_t value);
+
+    /**
+     * 第index个桶能记录的最大值
+     * @param index
+     * @return
+     */
+    static uint64_t bucketUpperBound(size_t index);
+
+private:
+    std::atomic<uint64_t> counts_[kBucketCount];
+
+    std::atomic<uint64_t> count_;
+
+    std::atomic<uint64_t> sum_;
+};
+
+/**
+ * 连接池在取用、归还路径上的计数
+ *
+ * 每个分片一份，避免多个线程写同一个cache line，读的时候再汇总
+ */
+struct PoolCounters {
+    /**
+     * 取出的连接数
+     */
+    std::atomic<uint64_t> checkouts;
+
+    /**
+     * 归还的连接数
+     */
+    std::atomic<uint64_t> returns;
+
+    /**
+     * 取连接时没有空闲连接的次数
+     */
+    std::atomic<uint64_t> exhausted;
+
+    /**
+     * 等待超时没有取到连接的次数，包括不等待的
+     */
+    std::atomic<uint64_t> timeouts;
+
+    /**
+     * 在getConnection中等待的时间，微秒
+     */
+    Histogram waitTime;
+
+    /**
+     * 连接从取出到归还的时间，微秒
+     */
+    Histogram holdTime;
+
+    PoolCounters() : checkouts(0), returns(0), exhausted(0), timeouts(0) {}
+};
+
+/**
+ * 连接池统计信息的快照
+ */
+struct PoolStats {
+    /**
+     * 连接总数，包括正在建立的连接
+     */
+    uint64_t total;
+
+    /**
+     * 空闲的连接数
+     */
+    uint64_t idle;
+
+    /**
+     * 正在被使用的连接数
+     */
+    uint64_t busy;
+
+    /**
+     * 正在等待连接的线程数
+     */
+    uint64_t waiters;
+
+    uint64_t checkouts;
+
+    uint64_t exhausted;
+
+    uint64_t timeouts;
+
+    /**
+     * 建立成功的连接数
+     */
+    uint64_t creations;
+
+    /**
+     * 建立失败的连接数
+     */
+    uint64_t creationFailures;
+
+    /**
+     * 等待连接的时间，微秒
+     */
+    HistogramSnapshot waitTime;
+
+    /**
+     * 持有连接的时间，微秒
+     */
+    HistogramSnapshot holdTime;
+
+    PoolStats()
+        : total(0),
+          idle(0),
+          busy(0),
+          waiters(0),
+          checkouts(0),
+          exhausted(0),
+          timeouts(0),
+          creations(0),
+          creationFailures(0) {}
+
+    /**
+     * 汇总一个分片的计数
+     * @param counters
+     */
+    void collect(const PoolCounters& counters);
+};
+
+/**
+ * 导出为Prometheus的文本格式
+ * @param stats     统计信息
+ * @param prefix    指标名的前缀
+ * @param labels    附加的标签，比如 pool="main"，可以为空
+ * @return
+ */
+std::string toPrometheusText(const PoolStats& stats,
+                             const std::string& prefix = "mysql_pool",
+                             const std::string& labels = "");
+
+/**
+ * 两个时间点之间的微秒数
+ * @param from
+ * @param to
+ * @return      to早于from时为0
+ */
+inline uint64_t elapsedMicros(std::chrono::steady_clock::time_point from,
+                              std::chrono::steady_clock::time_point to) {
+    if (to <= from) {
+        return 0;
+    }
+    return std::chrono::duration_cast<std::chrono::microseconds>(to - from)
+        .count();
+}
+
+}  // namespace db
+
+#endif  // MYSQL_CONNECTOR_POOLMETRICS_H
@@ -8,11 +8,15 @@
 #include <fmt/printf.h>
 #include <mysql/mysql.h>
 
+#include <functional>
 #include <memory>
 #include <stdexcept>
+#include <vector>
 
 #include "Bind.h"
+#include "QueryWatchdog.h"
 #include "ResultMetaData.h"
+#include "Status.h"
 #include "Util.h"
 
 namespace db {
@@ -24,9 +28,15 @@ namespace db {
  */
 class PreparedResultSet {
 public:
-    PreparedResultSet(MYSQL_STMT* stmt = nullptr)
-        : stmt_(stmt), currentRowPos_(-1) {
-        initMetaData();
+    /**
+     * @param stmt
+     * @param streaming     为true时不把结果集读到本地，next时从连接上逐行读取
+     * @param cached        stmt上次执行的元数据，不为空时复用并更新
+     */
+    PreparedResultSet(MYSQL_STMT* stmt = nullptr, bool streaming = false,
+                      StatementMetaData* cached = nullptr)
+        : stmt_(stmt), currentRowPos_(-1), streaming_(streaming) {
+        initMetaData(cached);
     }
 
     PreparedResultSet(const PreparedResultSet&) = delete;
@@ -34,18 +44,15 @@ public:
     PreparedResultSet& operator=(const PreparedResultSet&) = delete;
 
     PreparedResultSet(PreparedResultSet&& other)
-        : stmt_(other.stmt_),
-          currentRowPos_(other.currentRowPos_),
-          metaData_(other.metaData_),
-          resultBinds_(other.resultBinds_) {
-        PreparedResultSet tmp;
-        tmp.swap(other);
+        : stmt_(nullptr), currentRowPos_(-1), streaming_(false) {
+        swap(other);
     }
 
     PreparedResultSet& operator=(PreparedResultSet&& other) {
         PreparedResultSet tmp;
         swap(other);
         tmp.swap(other);
+        return *this;
     }
 
     /**
@@ -71,14 +78,60 @@ public:
             return false;
         }
 
+        // 流式读取时变长的列可能比缓冲区长，读取时再通过fetch_column获取
         int ret = mysql_stmt_fetch(stmt_);
-        if (ret != 0) {
+        if (ret == MYSQL_NO_DATA) {
+            // 已经读完，不再需要中断
+            watch_.reset();
+        }
+        if (ret != 0 && ret != MYSQL_DATA_TRUNCATED) {
             return false;
         }
         ++currentRowPos_;
         return true;
     }
 
+    /**
+     * 移动到下一行
+     * @param s     流式的结果集读取失败时为错误，比如连接断开
+     * @return      是否有数据
+     */
+    bool next(Status& s) {
+        s.clear();
+        if (next()) {
+            return true;
+        }
+
+        if (stmt_ != nullptr && mysql_stmt_errno(stmt_) != 0) {
+            s.assign(Status::RUNTIME_ERROR,
+                     fmt::sprintf("fetch row failed, %s", getLastError(stmt_)));
+            if (watch_) {
+                watch_->finish(mysql_stmt_errno(stmt_), s);
+            }
+        }
+        return false;
+    }
+
+    /**
+     * 流式读取时，读完之前到达deadline由watchdog中断查询
+     *
+     * 中断之后next(Status&)返回Status::TIMEOUT
+     * @param watchdog      为空时不监视
+     * @param mysql         stmt所在的连接
+     * @param deadline
+     */
+    void watchUntil(QueryWatchdog* watchdog, MYSQL* mysql,
+                    std::chrono::steady_clock::time_point deadline) {
+        watch_.reset(new QueryWatch());
+        watch_->start(watchdog, mysql, deadline);
+    }
+
+    /**
+     * 是否是流式的结果集
+     * @return
+     */
+    bool isStreaming() const { return streaming_; }
+
     /**
      * 获取当前行的行号
      * @return
@@ -93,6 +146,12 @@ public:
             throw std::runtime_error("result set is invalid");
         }
 
+        // 读过的行没有保存下来
+        if (streaming_) {
+            throw std::runtime_error(
+                "rewind not supported by streaming result");
+        }
+
         mysql_stmt_data_seek(stmt_, 0);
         currentRowPos_ = -1;
     }
@@ -105,7 +164,7 @@ public:
     std::string getString(size_t index) const {
         checkRequestValid(index);
 
-        return resultBinds_.getValue(index).getString();
+        return loadValue(index).getString();
     }
 
     /**
@@ -120,7 +179,7 @@ public:
     int32_t getInt32(size_t index) const {
         checkRequestValid(index);
 
-        return resultBinds_.getValue(index).getInt64();
+        return loadValue(index).getInt64();
     }
 
     int32_t getInt32(const std::string& name) const {
@@ -129,7 +188,7 @@ public:
 
     int64_t getInt64(size_t index) const {
         checkRequestValid(index);
-        return resultBinds_.getValue(index).getInt64();
+        return loadValue(index).getInt64();
     }
 
     int64_t getInt64(const std::string& name) const {
@@ -139,7 +198,7 @@ public:
     double getDouble(size_t index) const {
         checkRequestValid(index);
 
-        return resultBinds_.getValue(index).getDouble();
+        return loadValue(index).getDouble();
     }
 
     double getDouble(const std::string& name) const {
@@ -148,47 +207,165 @@ public:
 
     Value getValue(size_t index) const {
         checkRequestValid(index);
-        return resultBinds_.getValue(index);
+        return loadValue(index);
     }
 
     Value getValue(const std::string& name) const {
         return getValue(fieldNameToIndex(name));
     }
 
+    /**
+     * 分块读取第index列的数据，用于很大的BLOB/TEXT
+     *
+     * 每次最多读取chunkSize字节交给sink，不需要一次复制出整个值；
+     * 为NULL时不调用sink。只支持字符串和二进制类型的列
+     * @param index
+     * @param sink          依次收到的数据块
+     * @param s
+     * @param chunkSize
+     */
+    void readColumn(size_t index,
+                    const std::function<void(const char*, size_t)>& sink,
+                    Status& s, size_t chunkSize = 64 * 1024) const {
+        s.clear();
+
+        if (index >= resultBinds_.getBindCount()) {
+            s.assign(Status::ERROR,
+                     fmt::sprintf("index %d out of range [0, %d)", index,
+                                  resultBinds_.getBindCount()));
+            return;
+        }
+        if (currentRowPos_ == -1) {
+            s.assign(Status::ERROR, "not data, or forget to invoke next()?");
+            return;
+        }
+
+        MYSQL_BIND* bind = resultBinds_.getBind(index);
+        switch (bind->buffer_type) {
+        case MYSQL_TYPE_TINY:
+        case MYSQL_TYPE_SHORT:
+        case MYSQL_TYPE_LONG:
+        case MYSQL_TYPE_INT24:
+        case MYSQL_TYPE_LONGLONG:
+        case MYSQL_TYPE_FLOAT:
+        case MYSQL_TYPE_DOUBLE:
+        case MYSQL_TYPE_YEAR:
+        case MYSQL_TYPE_TIMESTAMP:
+        case MYSQL_TYPE_DATE:
+        case MYSQL_TYPE_TIME:
+        case MYSQL_TYPE_DATETIME:
+            s.assign(Status::ERROR,
+                     fmt::sprintf("column %d is not a string", index));
+            return;
+
+        default:
+            break;
+        }
+
+        if (*bind->is_null) {
+            return;
+        }
+
+        unsigned long total = *bind->length;
+        if (!resultBinds_.truncated(index)) {
+            sink(reinterpret_cast<const char*>(bind->buffer), total);
+            return;
+        }
+
+        std::vector<char> chunk(std::min<unsigned long>(
+            total, std::max<size_t>(chunkSize, 1)));
+        unsigned long length = 0;
+        my_bool isNull = false;
+        my_bool error = false;
+
+        MYSQL_BIND column;
+        memset(&column, 0, sizeof(column));
+        column.buffer_type = bind->buffer_type;
+        column.buffer = chunk.data();
+        column.buffer_length = chunk.size();
+        column.length = &length;
+        column.is_null = &isNull;
+        column.error = &error;
+
+        unsigned long offset = 0;
+        while (offset < total) {
+            if (mysql_stmt_fetch_column(stmt_, &column, index, offset) != 0) {
+                s.assign(Status::RUNTIME_ERROR,
+                         fmt::sprintf("fetch column %d failed, %s", index,
+                                      getLastError(stmt_)));
+                return;
+            }
+
+            unsigned long size =
+                std::min<unsigned long>(chunk.size(), total - offset);
+            sink(chunk.data(), size);
+            offset += size;
+        }
+    }
+
     void swap(PreparedResultSet& other) {
         using std::swap;
         swap(stmt_, other.stmt_);
         swap(currentRowPos_, other.currentRowPos_);
+        swap(streaming_, other.streaming_);
+        swap(watch_, other.watch_);
         swap(metaData_, other.metaData_);
+        swap(resultSetHandler_, other.resultSetHandler_);
         swap(resultBinds_, other.resultBinds_);
     }
 
 private:
-    void initMetaData() {
+    void initMetaData(StatementMetaData* cached) {
         if (stmt_ == nullptr) {
             return;
         }
 
-        if (mysql_stmt_store_result(stmt_) != 0) {
-            throw std::runtime_error(fmt::sprintf(
-                "store result set to local failed, %s", getLastError(stmt_)));
+        if (!streaming_) {
+            // 读到本地时按max_length分配缓冲区，流式读取不需要
+            my_bool on = true;
+            if (mysql_stmt_attr_set(stmt_, STMT_ATTR_UPDATE_MAX_LENGTH, &on) !=
+                0) {
+                throw std::runtime_error(fmt::sprintf(
+                    "update stmt option failed, %s", getLastError(stmt_)));
+            }
+            if (mysql_stmt_store_result(stmt_) != 0) {
+                throw std::runtime_error(
+                    fmt::sprintf("store result set to local failed, %s",
+                                 getLastError(stmt_)));
+            }
         }
 
-        resultSetHandler_.assign(mysql_stmt_result_metadata(stmt_));
-        if (!resultSetHandler_.valid()) {
-            throw std::runtime_error(
-                fmt::sprintf("can't get result set, %s", getLastError(stmt_)));
+        // 同一个stmt的元数据在执行之间不变，列数变化时重新获取
+        MYSQL_RES* result = cached != nullptr ? cached->result.get() : nullptr;
+        if (result == nullptr ||
+            mysql_num_fields(result) != mysql_stmt_field_count(stmt_)) {
+            resultSetHandler_.assign(mysql_stmt_result_metadata(stmt_));
+            if (!resultSetHandler_.valid()) {
+                throw std::runtime_error(fmt::sprintf(
+                    "can't get result set, %s", getLastError(stmt_)));
+            }
+            result = resultSetHandler_.get();
+            if (cached != nullptr) {
+                cached->result = std::move(resultSetHandler_);
+                cached->shape.reset();
+            }
         }
 
-        MYSQL_FIELD* fields = mysql_fetch_fields(resultSetHandler_.get());
+        MYSQL_FIELD* fields = mysql_fetch_fields(result);
         if (fields == nullptr) {
             throw std::runtime_error(fmt::sprintf(
                 "can't get result field info, %s", getLastError(stmt_)));
         }
-        size_t fieldCount = mysql_num_fields(resultSetHandler_.get());
-        metaData_.assign(fields, fieldCount);
+        size_t fieldCount = mysql_num_fields(result);
+        if (cached != nullptr) {
+            // 列的名字、类型被修改时shape不再匹配，会重新查找
+            metaData_.assign(fields, fieldCount, cached->shape);
+            cached->shape = metaData_.getShape();
+        } else {
+            metaData_.assign(fields, fieldCount);
+        }
 
-        resultBinds_.assign(metaData_);
+        resultBinds_.assign(metaData_, streaming_);
 
         if (mysql_stmt_bind_result(stmt_, resultBinds_.getBinds()) != 0) {
             throw std::runtime_error(
@@ -196,6 +373,29 @@ private:
         }
     }
 
+    /**
+     * 获取第index列的数据，被截断的列重新读取完整的值
+     * @param index
+     * @return
+     */
+    Value loadValue(size_t index) const {
+        if (!resultBinds_.truncated(index)) {
+            return resultBinds_.getValue(index);
+        }
+
+        std::string val;
+        Status s;
+        readColumn(
+            index, [&val](const char* data, size_t size) {
+                val.append(data, size);
+            },
+            s, *resultBinds_.getBind(index)->length);
+        if (!s) {
+            throw std::runtime_error(s.message());
+        }
+        return Value(val);
+    }
+
     size_t fieldNameToIndex(const std::string& name) const {
         return metaData_.fieldNameToIndex(name);
     }
@@ -221,11 +421,24 @@ private:
      */
     int64_t currentRowPos_;
 
+    /**
+     * 是否是流式的结果集，没有调用store_result
+     */
+    bool streaming_;
+
+    /**
+     * 流式读取时监视查询的deadline，读完时结束
+     */
+    std::unique_ptr<QueryWatch> watch_;
+
     /**
      * 元数据
      */
     ResultMetaData metaData_;
 
+    /**
+     * 没有使用stmt缓存的元数据时，结果集自己持有的元数据
+     */
     ResultSetHandler resultSetHandler_;
 
     Bind resultBinds_;
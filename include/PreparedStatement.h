@@ -7,35 +7,62 @@
 
 #include <mysql/mysql.h>
 
+#include <chrono>
+#include <memory>
 #include <utility>
 
 #include "Bind.h"
 #include "Handler.h"
 #include "PreparedResultSet.h"
+#include "StatementCache.h"
 #include "Status.h"
 
 namespace db {
 
+class Connection;
+
 /**
  * PreparedStatement类
  *
+ * 从Connection的StatementCache中取出时，close之后stmt回到缓存，而不是被关闭
+ *
  * @warning 使用时需要保证Connection存活
  */
 class PreparedStatement {
 public:
-    explicit PreparedStatement(MYSQL_STMT* stmt = nullptr) : stmt_(stmt) {}
+    /**
+     * @param stmt
+     * @param cache
+     * @param conn
+     * @param metaData      stmt之前执行时缓存的结果集元数据
+     */
+    explicit PreparedStatement(
+        MYSQL_STMT* stmt = nullptr, StatementCache* cache = nullptr,
+        Connection* conn = nullptr,
+        std::unique_ptr<StatementMetaData> metaData = nullptr)
+        : stmt_(stmt),
+          cache_(cache),
+          conn_(conn),
+          metaData_(std::move(metaData)) {}
 
     PreparedStatement(const PreparedStatement&) = delete;
 
     PreparedStatement& operator=(const PreparedStatement&) = delete;
 
     PreparedStatement(PreparedStatement&& other)
-        : stmt_(std::move(other.stmt_)) {}
+        : stmt_(std::move(other.stmt_)),
+          cache_(other.cache_),
+          conn_(other.conn_),
+          metaData_(std::move(other.metaData_)) {
+        other.cache_ = nullptr;
+        other.conn_ = nullptr;
+    }
 
     PreparedStatement& operator=(PreparedStatement&& other) {
         PreparedStatement tmp;
         swap(other);
         other.swap(tmp);
+        return *this;
     }
 
     ~PreparedStatement() { close(); }
@@ -43,6 +70,9 @@ public:
     void swap(PreparedStatement& other) {
         using std::swap;
         swap(stmt_, other.stmt_);
+        swap(cache_, other.cache_);
+        swap(conn_, other.conn_);
+        swap(metaData_, other.metaData_);
     }
 
     /**
@@ -62,31 +92,31 @@ public:
         bindParams(0, std::forward<Args>(args)...);
     }
 
+    /**
+     * 使用服务器端的只读游标，execute之前设置
+     *
+     * 结果集保存在服务器上，getStreamingResultSet返回的结果集每次向服务器
+     * 取prefetchRows行，两次读取之间这个连接可以执行其他sql
+     * @param prefetchRows      每次读取的行数，为0时不使用游标
+     * @param s
+     */
+    void setCursor(unsigned long prefetchRows, Status& s);
+
     /**
      * 执行sql
      * @param s
      */
     void execute(Status& s) {
-        s.clear();
-
-        checkValid(s);
-        if (!s) {
-            return;
-        }
-
-        size_t expectedParamCount = mysql_stmt_param_count(stmt_.get());
-        if (expectedParamCount != params_.getBindCount()) {
-            s.assign(Status::ERROR, "params not bind");
-            return;
-        }
-
-        if (mysql_stmt_execute(stmt_.get()) != 0) {
-            s.assign(Status::ERROR, fmt::sprintf("statement execute failed, ",
-                                                 getLastError(stmt_.get())));
-            return;
-        }
+        execute(std::chrono::steady_clock::time_point::max(), s);
     }
 
+    /**
+     * 执行sql，到达deadline时由Connection的QueryWatchdog中断
+     * @param deadline      和Connection的deadline取较早的一个
+     * @param s             超时时为Status::TIMEOUT
+     */
+    void execute(std::chrono::steady_clock::time_point deadline, Status& s);
+
     /**
      * 获取execute执行后，影响到的行数
      * @return
@@ -96,21 +126,57 @@ public:
         return mysql_stmt_affected_rows(stmt_.get());
     }
 
+    /**
+     * 结果集的列数，不返回结果集的语句为0
+     * @return
+     */
+    size_t getFieldCount() const {
+        return stmt_.valid() ? mysql_stmt_field_count(stmt_.get()) : 0;
+    }
+
     /**
      * 获取执行select语句后的ResultSet
      * @return
      */
     PreparedResultSet getResultSet(Status& s) {
-        s.clear();
+        return getResultSet(std::chrono::steady_clock::time_point::max(), s);
+    }
 
-        checkValid(s);
-        if (!s) {
-            return PreparedResultSet();
-        }
+    /**
+     * 获取执行select语句后的ResultSet，读取结果到达deadline时中断查询
+     *
+     * 服务器在发送结果的同时执行查询，慢查询的大部分时间在这里
+     * @param deadline      和Connection的deadline取较早的一个
+     * @param s             超时时为Status::TIMEOUT
+     * @return
+     */
+    PreparedResultSet getResultSet(
+        std::chrono::steady_clock::time_point deadline, Status& s);
 
-        return PreparedResultSet(stmt_.get());
+    /**
+     * 获取执行select语句后流式的ResultSet
+     *
+     * 结果集不会读到本地，next时逐行从连接上读取，列的缓冲区大小固定，
+     * 较长的值在读取时通过mysql_stmt_fetch_column获取。
+     * 读完或者释放PreparedStatement之前，这个连接上不能执行其他sql，
+     * 使用游标（setCursor）时除外；不支持rewind
+     * @param s
+     * @return
+     */
+    PreparedResultSet getStreamingResultSet(Status& s) {
+        return getStreamingResultSet(
+            std::chrono::steady_clock::time_point::max(), s);
     }
 
+    /**
+     * 获取流式的ResultSet，读完之前到达deadline时中断查询
+     * @param deadline      和Connection的deadline取较早的一个
+     * @param s             超时时为Status::TIMEOUT，读取时超时由next(Status&)返回
+     * @return
+     */
+    PreparedResultSet getStreamingResultSet(
+        std::chrono::steady_clock::time_point deadline, Status& s);
+
     /**
      * 是否是有效的
      * @return
@@ -119,12 +185,39 @@ public:
 
     /**
      * 释放资源，并不会关闭Connection
+     *
+     * 从缓存中取出的stmt会被reset后放回缓存
+     */
+    void close() {
+        if (cache_ != nullptr && stmt_.valid()) {
+            cache_->release(stmt_.release(), std::move(metaData_));
+        }
+        cache_ = nullptr;
+        // 元数据指向stmt内部，先于stmt释放
+        metaData_.reset();
+        stmt_.close();
+    }
+
+    /**
+     * 是否是从StatementCache中取出的
+     * @return
      */
-    void close() { stmt_.close(); }
+    bool cached() const { return cache_ != nullptr; }
 
     MYSQL_STMT* get() const { return stmt_.get(); }
 
 private:
+    /**
+     * 获取stmt缓存的结果集元数据，没有时创建
+     * @return
+     */
+    StatementMetaData* getMetaData() {
+        if (!metaData_) {
+            metaData_.reset(new StatementMetaData());
+        }
+        return metaData_.get();
+    }
+
     void checkValid() const {
         if (!valid()) {
             throw std::runtime_error("statement is invalid");
@@ -181,6 +274,21 @@ private:
     StatementHandler stmt_;
 
     Bind params_;
+
+    /**
+     * stmt所属的缓存，不是从缓存中取出时为nullptr
+     */
+    StatementCache* cache_;
+
+    /**
+     * 创建这个stmt的连接
+     */
+    Connection* conn_;
+
+    /**
+     * 结果集的元数据，重复执行时不再重新获取
+     */
+    std::unique_ptr<StatementMetaData> metaData_;
 };
 
 }  // namespace db
@@ -0,0 +1,191 @@
+//
+// Created by m8792 on 2021/1/12.
+//
+
+#ifndef MYSQL_CONNECTOR_QUERYWATCHDOG_H
+#define MYSQL_CONNECTOR_QUERYWATCHDOG_H
+
+#include <mysql/mysql.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
+#include "Status.h"
+
+namespace db {
+
+class Connection;
+
+/**
+ * 在deadline到达时中断还没有完成的查询
+ *
+ * 通过一个单独的连接发送KILL QUERY，这个连接第一次使用时才建立。
+ * 到达deadline之前被unwatch的查询不会被中断。
+ * 发送KILL QUERY时不持有mutex_，不会阻塞其他查询的watch/unwatch
+ */
+class QueryWatchdog {
+public:
+    QueryWatchdog();
+
+    QueryWatchdog(const QueryWatchdog&) = delete;
+
+    QueryWatchdog& operator=(const QueryWatchdog&) = delete;
+
+    ~QueryWatchdog();
+
+    /**
+     * 设置发送KILL QUERY的连接要连接的服务器
+     * @param host
+     * @param port
+     * @param user
+     * @param password
+     */
+    void setServer(const std::string& host, unsigned short port,
+                   const std::string& user, const std::string& password);
+
+    /**
+     * 开始监视一个查询
+     * @param threadId      执行查询的连接的mysql_thread_id
+     * @param deadline
+     * @return              用于unwatch的id
+     */
+    uint64_t watch(unsigned long threadId,
+                   std::chrono::steady_clock::time_point deadline);
+
+    /**
+     * 查询已经结束，不再监视
+     *
+     * 正在对这个查询发送KILL QUERY时等待发送完成，
+     * 返回之后不会再对这个查询发送KILL QUERY
+     * @param id
+     * @return      查询是否已经被中断
+     */
+    bool unwatch(uint64_t id);
+
+    /**
+     * 立即中断一个连接上正在执行的查询
+     * @param threadId
+     * @param s
+     */
+    void kill(unsigned long threadId, Status& s);
+
+private:
+    enum State { WATCHING, KILLING, KILLED };
+
+    struct Entry {
+        unsigned long threadId;
+
+        std::chrono::steady_clock::time_point deadline;
+
+        State state;
+    };
+
+    /**
+     * 通过sideChannel_发送KILL QUERY，连接断开时重新连接一次
+     * @param threadId
+     * @param s
+     *
+     * @note 需要持有killMutex_
+     */
+    void killLocked(unsigned long threadId, Status& s);
+
+    void loop();
+
+private:
+    /**
+     * 保护entries_、deadlines_和线程的状态
+     */
+    std::mutex mutex_;
+
+    std::condition_variable cond_;
+
+    /**
+     * KILL QUERY发送完成时通知等待的unwatch
+     */
+    std::condition_variable killedCond_;
+
+    /**
+     * 保护服务器的配置和sideChannel_，发送KILL QUERY时持有
+     */
+    std::mutex killMutex_;
+
+    std::string host_;
+
+    unsigned short port_;
+
+    std::string user_;
+
+    std::string password_;
+
+    /**
+     * 发送KILL QUERY的连接
+     */
+    std::unique_ptr<Connection> sideChannel_;
+
+    std::unordered_map<uint64_t, Entry> entries_;
+
+    /**
+     * 按deadline排序的还没有中断的查询
+     */
+    std::set<std::pair<std::chrono::steady_clock::time_point, uint64_t>>
+        deadlines_;
+
+    uint64_t nextId_;
+
+    bool stopping_;
+
+    /**
+     * 第一次watch时启动
+     */
+    std::thread thread_;
+};
+
+/**
+ * 在作用域内监视一个查询
+ */
+class QueryWatch {
+public:
+    QueryWatch() : watchdog_(nullptr), id_(0) {}
+
+    QueryWatch(const QueryWatch&) = delete;
+
+    QueryWatch& operator=(const QueryWatch&) = delete;
+
+    ~QueryWatch() {
+        if (id_ != 0) {
+            watchdog_->unwatch(id_);
+        }
+    }
+
+    /**
+     * 开始监视mysql上的查询，watchdog为空时不监视
+     * @param watchdog
+     * @param mysql
+     * @param deadline
+     */
+    void start(QueryWatchdog* watchdog, MYSQL* mysql,
+               std::chrono::steady_clock::time_point deadline);
+
+    /**
+     * 结束监视，查询因为超时失败时把s改为Status::TIMEOUT
+     * @param error     失败时mysql返回的错误码
+     * @param s
+     */
+    void finish(unsigned int error, Status& s);
+
+private:
+    QueryWatchdog* watchdog_;
+
+    uint64_t id_;
+};
+
+}  // namespace db
+
+#endif  // MYSQL_CONNECTOR_QUERYWATCHDOG_H
@@ -0,0 +1,269 @@
+//
+// Created by m8792 on 2021/1/9.
+//
+
+#ifndef MYSQL_CONNECTOR_REACTOR_H
+#define MYSQL_CONNECTOR_REACTOR_H
+
+#include "Connection.h"
+
+#ifdef MYSQL_CONNECTOR_HAS_NONBLOCKING
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "ResultSet.h"
+#include "Status.h"
+
+namespace db {
+
+/**
+ * 在一个线程上用epoll驱动多个连接的非阻塞请求
+ *
+ * 基于libmysqlclient的*_nonblocking接口，socket可读写时推进每个请求，
+ * 几百个连接上的请求只需要一个线程。回调在Reactor的线程中执行，不能阻塞。
+ * 请求到达deadline时以Status::TIMEOUT回调，连接会被关闭
+ *
+ * @note 请求完成之前Connection不能被使用或者析构，
+ * 同一个Connection同时只能有一个请求
+ */
+class Reactor {
+public:
+    /**
+     * 建立连接完成时的回调
+     */
+    using ConnectCallback = std::function<void(const Status&)>;
+
+    /**
+     * 查询完成时的回调，没有结果集的sql得到无效的ResultSet
+     */
+    using QueryCallback = std::function<void(ResultSet, const Status&)>;
+
+    Reactor();
+
+    Reactor(const Reactor&) = delete;
+
+    Reactor& operator=(const Reactor&) = delete;
+
+    ~Reactor();
+
+    /**
+     * 创建epoll并启动线程
+     * @param s
+     */
+    void start(Status& s);
+
+    /**
+     * 停止线程，没有完成的请求以错误回调
+     */
+    void stop();
+
+    /**
+     * 非阻塞地建立连接
+     * @param connection    还没有连接的Connection，可以先设置选项
+     * @param host          mysql服务器ip地址
+     * @param port          mysql服务端口号，0的话为默认值
+     * @param user          用户名
+     * @param password      密码
+     * @param schema        schema
+     * @param callback      连接完成或者失败时调用
+     */
+    void connect(Connection& connection, const std::string& host,
+                 unsigned short port, const std::string& user,
+                 const std::string& password, const std::string& schema,
+                 ConnectCallback callback);
+
+    /**
+     * 非阻塞地建立连接，到达deadline时放弃
+     * @param connection
+     * @param host
+     * @param port
+     * @param user
+     * @param password
+     * @param schema
+     * @param deadline      截止时间
+     * @param callback      超时时为Status::TIMEOUT
+     */
+    void connect(Connection& connection, const std::string& host,
+                 unsigned short port, const std::string& user,
+                 const std::string& password, const std::string& schema,
+                 std::chrono::steady_clock::time_point deadline,
+                 ConnectCallback callback);
+
+    /**
+     * 非阻塞地执行sql并读取全部结果
+     *
+     * 结果集在回调之前已经全部读到内存中，遍历时不会阻塞
+     * @param connection    已经连接的Connection，需要通过Reactor::connect建立
+     * @param sql
+     * @param callback      完成或者失败时调用
+     */
+    void executeQuery(Connection& connection, const std::string& sql,
+                      QueryCallback callback);
+
+    /**
+     * 非阻塞地执行sql，到达deadline时关闭连接，服务器上的查询随之中断
+     * @param connection
+     * @param sql
+     * @param deadline      和Connection的deadline取较早的一个
+     * @param callback      超时时为Status::TIMEOUT
+     */
+    void executeQuery(Connection& connection, const std::string& sql,
+                      std::chrono::steady_clock::time_point deadline,
+                      QueryCallback callback);
+
+    /**
+     * 还没有完成的请求数
+     * @return
+     */
+    size_t getPendingCount() const { return pendingCount_.load(); }
+
+private:
+    struct Operation;
+
+    using TimerMap =
+        std::multimap<std::chrono::steady_clock::time_point, Operation*>;
+
+    /**
+     * 一个正在进行的请求
+     */
+    struct Operation {
+        enum Stage { CONNECT, QUERY, STORE };
+
+        Stage stage;
+
+        Connection* connection;
+
+        std::string host;
+
+        unsigned short port;
+
+        std::string user;
+
+        std::string password;
+
+        std::string schema;
+
+        std::string sql;
+
+        ConnectCallback onConnect;
+
+        QueryCallback onQuery;
+
+        std::chrono::steady_clock::time_point deadline;
+
+        /**
+         * socket是否已经加入epoll
+         */
+        bool registered;
+
+        /**
+         * 是否在inflight_中
+         */
+        bool inflight;
+
+        /**
+         * 是否在timers_中，在的话timer指向它
+         */
+        bool timed;
+
+        TimerMap::iterator timer;
+
+        Operation(Stage stage, Connection* connection)
+            : stage(stage),
+              connection(connection),
+              port(0),
+              deadline(std::chrono::steady_clock::time_point::max()),
+              registered(false),
+              inflight(false),
+              timed(false) {}
+    };
+
+    /**
+     * 把请求交给Reactor的线程
+     * @param op
+     */
+    void submit(Operation* op);
+
+    /**
+     * 推进请求，直到需要等待socket或者完成
+     * @param op
+     */
+    void advance(Operation* op);
+
+    /**
+     * 请求完成，移出epoll并回调
+     * @param op
+     * @param result
+     * @param s
+     */
+    void complete(Operation* op, ResultSet result, const Status& s);
+
+    /**
+     * 以Status::TIMEOUT结束到达deadline的请求
+     *
+     * 请求进行到一半，连接上的数据已经无法对应，关闭连接
+     * @param now
+     */
+    void expire(std::chrono::steady_clock::time_point now);
+
+    /**
+     * epoll_wait的超时时间
+     * @return  毫秒，没有deadline时为-1
+     */
+    int waitTimeoutMs() const;
+
+    /**
+     * 唤醒Reactor的线程
+     */
+    void wakeUp();
+
+    void loop();
+
+private:
+    int epollFd_;
+
+    /**
+     * 用来唤醒epoll_wait的eventfd
+     */
+    int eventFd_;
+
+    std::thread thread_;
+
+    /**
+     * 保护submitted_和stopping_
+     */
+    std::mutex mutex_;
+
+    /**
+     * 其他线程提交的还没有开始的请求
+     */
+    std::vector<Operation*> submitted_;
+
+    bool stopping_;
+
+    /**
+     * 正在进行的请求，只在Reactor的线程中访问
+     */
+    std::unordered_set<Operation*> inflight_;
+
+    /**
+     * 有deadline的请求，按deadline排序，只在Reactor的线程中访问
+     */
+    TimerMap timers_;
+
+    std::atomic<size_t> pendingCount_;
+};
+
+}  // namespace db
+
+#endif  // MYSQL_CONNECTOR_HAS_NONBLOCKING
+
+#endif  // MYSQL_CONNECTOR_REACTOR_H
@@ -10,10 +10,16 @@
 #include <mysql/mysql.h>
 #include <mysql/mysql_com.h>
 #include <stdint.h>
+#include <stdlib.h>
 
-#include <map>
+#include <memory>
 #include <stdexcept>
 #include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Handler.h"
+#include "StringView.h"
 
 namespace db {
 
@@ -235,6 +241,91 @@ private:
     std::string s_;
 };
 
+/**
+ * 借用结果集中的数据的Value，不复制字符串
+ *
+ * 只在数据所在的行有效，数值在获取时才从文本解析，数据需要以'\0'结尾
+ */
+class ValueView {
+public:
+    ValueView() : valueType_(DataType::SQLNULL) {}
+
+    ValueView(int valueType, StringView data)
+        : valueType_(data.data() ? valueType : DataType::SQLNULL),
+          data_(data) {}
+
+    /**
+     * 获取 值的类型
+     * @return 值的类型
+     * @see db::DataType
+     */
+    int getType() const { return valueType_; }
+
+    bool isNull() const { return valueType_ == DataType::SQLNULL; }
+
+    int32_t getInt32() const { return static_cast<int32_t>(getInt64()); }
+
+    uint32_t getUInt32() const { return static_cast<uint32_t>(getUInt64()); }
+
+    int64_t getInt64() const {
+        if (isNull()) {
+            return 0;
+        }
+        if (valueType_ == DataType::DOUBLE) {
+            return static_cast<int64_t>(getDouble());
+        }
+        return atoll(data_.data());
+    }
+
+    uint64_t getUInt64() const {
+        if (isNull()) {
+            return 0;
+        }
+        if (valueType_ == DataType::DOUBLE) {
+            return static_cast<uint64_t>(getDouble());
+        }
+        return strtoull(data_.data(), nullptr, 10);
+    }
+
+    double getDouble() const { return isNull() ? 0 : atof(data_.data()); }
+
+    /**
+     * 复制出字符串
+     * @return
+     */
+    std::string getString() const { return data_.toString(); }
+
+    StringView getStringView() const { return data_; }
+
+    /**
+     * 复制成Value，离开当前行之后仍然有效
+     * @return
+     */
+    Value toValue() const {
+        switch (valueType_) {
+        case DataType::SQLNULL:
+            return Value();
+
+        case DataType::SIGNED_INTEGER:
+            return Value(getInt64());
+
+        case DataType::UNSIGNED_INTEGER:
+            return Value(getUInt64());
+
+        case DataType::DOUBLE:
+            return Value(getDouble());
+
+        default:
+            return Value(getString());
+        }
+    }
+
+private:
+    int valueType_;
+
+    StringView data_;
+};
+
 /**
  * 将mysql的类型转成 DataType
  * @param mysqlFieldType
@@ -310,9 +401,110 @@ inline enum_field_types dataTypeToMysqlType(int dataType) {
     }
 }
 
+class ResultShape;
+
+using ResultShapePtr = std::shared_ptr<const ResultShape>;
+
+/**
+ * 结果集中和具体某次执行无关的元数据：列名、类型、名字到下标的索引
+ *
+ * 创建之后不会修改，可以在多个线程、多个连接的结果集之间共享。
+ * 通过intern获取，列的名字、类型、标志都相同的结果集共用同一个对象，
+ * 不需要每次执行都重新建立名字索引
+ */
+class ResultShape {
+public:
+    /**
+     * 获取和fields一致的ResultShape，进程内按列的签名缓存，LRU淘汰
+     * @param fields
+     * @param fieldCount
+     * @return
+     */
+    static ResultShapePtr intern(const MYSQL_FIELD* fields, size_t fieldCount);
+
+    ResultShape(const MYSQL_FIELD* fields, size_t fieldCount);
+
+    ResultShape(const ResultShape&) = delete;
+
+    ResultShape& operator=(const ResultShape&) = delete;
+
+    size_t getFieldCount() const { return columns_.size(); }
+
+    const std::string& getFieldName(size_t index) const {
+        return column(index).name;
+    }
+
+    /**
+     * @param index
+     * @return      @see db::DataType
+     */
+    int getFieldType(size_t index) const { return column(index).dataType; }
+
+    /**
+     * @param index
+     * @return      mysql的enum_field_types
+     */
+    int getOrgFieldType(size_t index) const { return column(index).type; }
+
+    /**
+     * @param name
+     * @return
+     * @throws invalid_argument     没有这一列
+     */
+    size_t fieldNameToIndex(const std::string& name) const {
+        auto it = nameToIndex_.find(name);
+        if (it == nameToIndex_.end()) {
+            throw std::invalid_argument(
+                fmt::sprintf("field name %s not found", name));
+        }
+        return it->second;
+    }
+
+    /**
+     * 是否和fields的列一致
+     * @param fields
+     * @param fieldCount
+     * @return
+     */
+    bool matches(const MYSQL_FIELD* fields, size_t fieldCount) const;
+
+private:
+    struct Column {
+        std::string name;
+
+        /**
+         * mysql的enum_field_types
+         */
+        int type;
+
+        /**
+         * 解码时使用的DataType
+         */
+        int dataType;
+
+        unsigned int flags;
+    };
+
+    const Column& column(size_t index) const {
+        if (index >= columns_.size()) {
+            throw std::out_of_range(fmt::sprintf(
+                "index %d out of range [0, %d)", index, columns_.size()));
+        }
+        return columns_[index];
+    }
+
+private:
+    std::vector<Column> columns_;
+
+    std::unordered_map<std::string, size_t> nameToIndex_;
+};
+
 /**
  * ResultSet的元数据信息
  *
+ * 列名、类型和名字索引来自共享的ResultShape，拷贝只增加引用计数；
+ * 长度等每次执行不同的信息仍然从MYSQL_FIELD读取
+ *
  * @warning 生命周期与ResultSet相同，使用时要保证ResultSet存活
  */
 class ResultMetaData {
@@ -321,7 +513,7 @@ public:
 
     ResultMetaData(MYSQL_FIELD* fields, size_t fieldCount)
         : fields_(fields), fieldCount_(fieldCount) {
-        initNameIndex();
+        initShape();
     }
 
     ResultMetaData(const ResultMetaData&) = default;
@@ -335,7 +527,25 @@ public:
     void assign(MYSQL_FIELD* fields, int fieldCount) {
         fields_ = fields;
         fieldCount_ = fieldCount;
-        initNameIndex();
+        initShape();
+    }
+
+    /**
+     * 和assign相同，shape和fields一致时直接使用，不再查找缓存
+     * @param fields
+     * @param fieldCount
+     * @param shape         上次执行的shape，可以为空
+     */
+    void assign(MYSQL_FIELD* fields, int fieldCount,
+                const ResultShapePtr& shape) {
+        if (fields == nullptr || !shape ||
+            !shape->matches(fields, fieldCount)) {
+            assign(fields, fieldCount);
+            return;
+        }
+        fields_ = fields;
+        fieldCount_ = fieldCount;
+        shape_ = shape;
     }
 
     /**
@@ -356,7 +566,7 @@ public:
                 "index %d out of range [0, %d)", index, fieldCount_));
         }
 
-        return fields_[index].name;
+        return shape_->getFieldName(index);
     }
 
     /**
@@ -371,7 +581,7 @@ public:
                 "index %d out of range [0, %d)", index, fieldCount_));
         }
 
-        return mysqlTypeToDataType(fields_[index].type);
+        return shape_->getFieldType(index);
     }
 
     /**
@@ -421,28 +631,39 @@ public:
      */
     bool isValid() const { return fields_ != nullptr; }
 
+    /**
+     * @param name
+     * @return
+     * @throws invalid_argument     没有这一列
+     */
     size_t fieldNameToIndex(const std::string& name) const {
-        auto it = nameToIndex_.find(name);
-        if (it == nameToIndex_.end()) {
+        if (!shape_) {
             throw std::invalid_argument(
                 fmt::sprintf("field name %s not found", name));
         }
-        return it->second;
+        return shape_->fieldNameToIndex(name);
     }
 
+    /**
+     * 获取共享的元数据
+     * @return  无效时为空
+     */
+    const ResultShapePtr& getShape() const { return shape_; }
+
     void swap(ResultMetaData& other) {
         using std::swap;
         swap(fields_, other.fields_);
         swap(fieldCount_, other.fieldCount_);
-        swap(nameToIndex_, other.nameToIndex_);
+        swap(shape_, other.shape_);
     }
 
 private:
-    void initNameIndex() {
-        nameToIndex_.clear();
-        for (int i = 0; i < fieldCount_; ++i) {
-            nameToIndex_[fields_[i].name] = i;
+    void initShape() {
+        if (fields_ == nullptr) {
+            shape_.reset();
+            return;
         }
+        shape_ = ResultShape::intern(fields_, fieldCount_);
     }
 
 private:
@@ -457,11 +678,31 @@ private:
      */
     size_t fieldCount_;
 
-    std::map<std::string, size_t> nameToIndex_;
+    /**
+     * 和其他结果集共享的元数据
+     */
+    ResultShapePtr shape_;
 };
 
 inline void swap(ResultMetaData& lhs, ResultMetaData& rhs) { lhs.swap(rhs); }
 
+/**
+ * 一个stmt的结果集元数据，同一个stmt多次执行时复用
+ *
+ * 由PreparedStatement或者StatementCache持有，要在stmt关闭之前释放
+ */
+struct StatementMetaData {
+    /**
+     * mysql_stmt_result_metadata的结果，fields指向stmt内部
+     */
+    ResultSetHandler result;
+
+    /**
+     * 上次执行的结果集的shape
+     */
+    ResultShapePtr shape;
+};
+
 }  // namespace db
 
 #endif  // MYSQL_CONNECTOR_RESULTMETADATA_H
@@ -13,20 +13,29 @@
 #include "Handler.h"
 #include "ResultMetaData.h"
 #include "Status.h"
+#include "StringView.h"
+#include "Util.h"
 
 namespace db {
 
 /**
  * Statement执行select语句获取的结果集
+ *
+ * 默认全部读到内存中；executeStreamingQuery得到的是流式的结果集，
+ * 每次next从连接上读取一行，内存占用不随结果集的大小增长
  */
 class ResultSet {
 public:
     /**
      * 构造结果集
      * Connection的生命周期要长于ResultSet
-     * @param res 如果为空表示是无效的
+     * @param res       如果为空表示是无效的
+     * @param stream    不为空时res是mysql_use_result返回的，从stream逐行读取
      */
-    explicit ResultSet(MYSQL_RES* res = nullptr) { assign(res); }
+    explicit ResultSet(MYSQL_RES* res = nullptr, MYSQL* stream = nullptr)
+        : currentRow_(nullptr), lengths_(nullptr), stream_(stream) {
+        assign(res);
+    }
 
     ResultSet(const ResultSet&) = delete;
 
@@ -35,23 +44,30 @@ public:
     ResultSet(ResultSet&& other)
         : res_(std::move(other.res_)),
           currentRow_(other.currentRow_),
-          metaData_(other.metaData_) {
+          lengths_(other.lengths_),
+          metaData_(other.metaData_),
+          stream_(other.stream_) {
         other.res_.assign(nullptr);
-        currentRow_ = nullptr;
-        metaData_.assign(nullptr, 0);
+        other.currentRow_ = nullptr;
+        other.lengths_ = nullptr;
+        other.stream_ = nullptr;
+        other.metaData_.assign(nullptr, 0);
     }
 
     ResultSet& operator=(ResultSet&& other) {
         ResultSet tmp;
         this->swap(other);
         other.swap(tmp);
+        return *this;
     }
 
     void swap(ResultSet& other) {
         using std::swap;
         swap(res_, other.res_);
         swap(currentRow_, other.currentRow_);
+        swap(lengths_, other.lengths_);
         swap(metaData_, other.metaData_);
+        swap(stream_, other.stream_);
     }
 
     ~ResultSet() { clear(); }
@@ -60,6 +76,8 @@ public:
         clear();
 
         res_.assign(res);
+        currentRow_ = nullptr;
+        lengths_ = nullptr;
 
         if (res_.valid()) {
             // 初始化元数据信息
@@ -73,6 +91,8 @@ public:
 
     /**
      * 释放资源
+     *
+     * 流式的结果集没有读完时，mysql_free_result会读取并丢弃剩下的行
      */
     void clear() {
         if (res_.valid()) {
@@ -99,9 +119,29 @@ public:
         }
 
         currentRow_ = mysql_fetch_row(res_.get());
+        lengths_ = nullptr;
         return currentRow_ != nullptr;
     }
 
+    /**
+     * 移动到下一行
+     * @param s     流式的结果集读取失败时为错误，比如连接断开
+     * @return      是否有数据
+     */
+    bool next(Status& s) {
+        s.clear();
+        if (next()) {
+            return true;
+        }
+
+        if (stream_ != nullptr && mysql_errno(stream_) != 0) {
+            s.assign(
+                Status::RUNTIME_ERROR,
+                fmt::sprintf("fetch row failed, %s", getLastError(stream_)));
+        }
+        return false;
+    }
+
     /**
      * 回绕到最初的行
      */
@@ -113,6 +153,12 @@ public:
             return;
         }
 
+        // 读过的行没有保存下来
+        if (isStreaming()) {
+            s.assign(Status::ERROR, "rewind not supported by streaming result");
+            return;
+        }
+
         mysql_data_seek(res_.get(), 0);
     }
 
@@ -122,15 +168,19 @@ public:
      */
     bool valid() const { return res_.valid(); }
 
+    /**
+     * 是否是流式的结果集
+     * @return
+     */
+    bool isStreaming() const { return stream_ != nullptr; }
+
     /**
      * 获取第index列的数据
      * @param index
      * @return
      */
     std::string getString(size_t index) const {
-        checkIndexValid(index);
-
-        return currentRow_[index] ? currentRow_[index] : "";
+        return getStringView(index).toString();
     }
 
     /**
@@ -142,6 +192,38 @@ public:
         return getString(fieldNameToIndex(name));
     }
 
+    /**
+     * 获取第index列的数据，不复制
+     *
+     * 指向当前行的数据，长度来自mysql_fetch_lengths，可以包含'\0'；
+     * 下一次next之前有效。NULL时data()为nullptr
+     * @param index
+     * @return
+     */
+    StringView getStringView(size_t index) const {
+        checkIndexValid(index);
+
+        if (currentRow_[index] == nullptr) {
+            return StringView();
+        }
+        return StringView(currentRow_[index], getLengths()[index]);
+    }
+
+    StringView getStringView(const std::string& name) const {
+        return getStringView(fieldNameToIndex(name));
+    }
+
+    /**
+     * 获取第index列的二进制数据，不复制，和getStringView相同
+     * @param index
+     * @return
+     */
+    StringView getBytes(size_t index) const { return getStringView(index); }
+
+    StringView getBytes(const std::string& name) const {
+        return getStringView(fieldNameToIndex(name));
+    }
+
     int32_t getInt32(size_t index) const {
         checkIndexValid(index);
 
@@ -199,9 +281,22 @@ public:
         return getValue(fieldNameToIndex(name));
     }
 
+    /**
+     * 获取第index列的数据，字符串不复制，下一次next之前有效
+     * @param index
+     * @return
+     */
+    ValueView getValueView(size_t index) const {
+        return ValueView(metaData_.getFieldType(index), getStringView(index));
+    }
+
+    ValueView getValueView(const std::string& name) const {
+        return getValueView(fieldNameToIndex(name));
+    }
+
 protected:
     void checkIndexValid(size_t index) const {
-        if (index > metaData_.getFieldCount()) {
+        if (index >= metaData_.getFieldCount()) {
             throw std::out_of_range("out of range");
         }
     }
@@ -216,6 +311,17 @@ protected:
         return metaData_.fieldNameToIndex(name);
     }
 
+    /**
+     * 当前行每一列的长度，第一次使用时获取
+     * @return
+     */
+    const unsigned long* getLengths() const {
+        if (lengths_ == nullptr) {
+            lengths_ = mysql_fetch_lengths(res_.get());
+        }
+        return lengths_;
+    }
+
 private:
     /**
      * ResultSet所属的Connection
@@ -228,10 +334,20 @@ private:
      */
     MYSQL_ROW currentRow_;
 
+    /**
+     * 当前行每一列的长度，mysql_fetch_lengths的结果
+     */
+    mutable unsigned long* lengths_;
+
     /**
      * 元数据信息
      */
     ResultMetaData metaData_;
+
+    /**
+     * 流式的结果集所在的连接，全部读到内存中的为nullptr
+     */
+    MYSQL* stream_;
 };
 
 }  // namespace db
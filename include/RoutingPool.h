@@ -0,0 +1,211 @@
+//
+// Created by m8792 on 2021/1/5.
+//
+
+#ifndef MYSQL_CONNECTOR_ROUTINGPOOL_H
+#define MYSQL_CONNECTOR_ROUTINGPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ConnectionPool.h"
+
+namespace db {
+
+/**
+ * 读写分离连接池的选项
+ */
+struct RoutingOptions {
+    /**
+     * 允许的最大复制延迟，毫秒
+     *
+     * 0 - 不检查延迟，所有从库都可以读（默认）
+     * n - 延迟超过n毫秒或者无法获取延迟的从库不再分配读请求
+     */
+    int maxLagMs;
+
+    /**
+     * 检查复制延迟的间隔，毫秒
+     */
+    int lagCheckIntervalMs;
+
+    /**
+     * 获取复制延迟的sql，第一行第一列为延迟的毫秒数，比如查询心跳表
+     *
+     * 为空时使用SHOW REPLICA STATUS的Seconds_Behind_Source，
+     * 服务器不支持时使用SHOW SLAVE STATUS
+     */
+    std::string lagQuery;
+
+    /**
+     * 没有可用的从库时，读请求是否使用主库
+     */
+    bool readFromPrimary;
+
+    RoutingOptions()
+        : maxLagMs(0), lagCheckIntervalMs(1000), readFromPrimary(true) {}
+};
+
+/**
+ * 读写分离的连接池
+ *
+ * 由一个主库的连接池和多个从库的连接池组成，写请求使用主库，
+ * 读请求在复制延迟没有超过阈值的从库之间轮流分配
+ */
+class RoutingPool {
+public:
+    /**
+     * @param primary       主库的连接池
+     * @param replicas      从库的连接池
+     * @param options
+     */
+    RoutingPool(ConnectionPoolPtr primary,
+                std::vector<ConnectionPoolPtr> replicas,
+                const RoutingOptions& options = RoutingOptions());
+
+    RoutingPool(const RoutingPool&) = delete;
+
+    RoutingPool& operator=(const RoutingPool&) = delete;
+
+    ~RoutingPool();
+
+    /**
+     * 获取主库的连接，用于写请求
+     * @param timeoutMs     超时时间毫秒，小于0一直等待，等于0不等待
+     * @return
+     */
+    ConnectionPtr getConnection(int timeoutMs = -1) {
+        return primary_->getConnection(timeoutMs);
+    }
+
+    /**
+     * 获取只读的连接
+     *
+     * 从下一个可用的从库开始，优先选有空闲连接的从库；
+     * 都没有空闲连接时在第一个可用的从库上等待
+     * @param timeoutMs     超时时间毫秒，小于0一直等待，等于0不等待
+     * @return
+     */
+    ConnectionPtr getReadConnection(int timeoutMs = -1);
+
+    const ConnectionPoolPtr& getPrimary() const { return primary_; }
+
+    size_t getReplicaCount() const { return replicas_.size(); }
+
+    const ConnectionPoolPtr& getReplica(size_t index) const {
+        return replicas_.at(index)->pool;
+    }
+
+    /**
+     * 最近一次检查到的复制延迟，毫秒
+     * @param index
+     * @return      -1表示无法获取延迟
+     */
+    int64_t getReplicaLag(size_t index) const {
+        return replicas_.at(index)->lagMs.load();
+    }
+
+    /**
+     * 从库是否可以分配读请求
+     * @param index
+     * @return
+     */
+    bool isReplicaAvailable(size_t index) const {
+        return replicas_.at(index)->available.load();
+    }
+
+    /**
+     * 检查一次所有从库的复制延迟
+     *
+     * 设置了maxLagMs时后台线程会定期调用，和后台线程的检查互斥
+     */
+    void checkReplicaLag();
+
+private:
+    struct Replica {
+        ConnectionPoolPtr pool;
+
+        /**
+         * 复制延迟，毫秒，-1表示无法获取
+         */
+        std::atomic<int64_t> lagMs;
+
+        std::atomic<bool> available;
+
+        /**
+         * 服务器不支持SHOW REPLICA STATUS，使用旧的语法
+         */
+        bool legacyStatus;
+
+        /**
+         * 查询复制延迟的连接，不占用pool中的连接，只在检查线程中使用
+         *
+         * 从库繁忙、连接池取不到连接时，不会被当成延迟过高
+         */
+        std::unique_ptr<Connection> monitor;
+
+        explicit Replica(ConnectionPoolPtr pool)
+            : pool(std::move(pool)),
+              lagMs(0),
+              available(true),
+              legacyStatus(false) {}
+    };
+
+    /**
+     * 获取一个从库的复制延迟
+     * @param replica
+     * @param s
+     * @return      毫秒，-1表示复制已经停止
+     */
+    int64_t queryLag(Replica& replica, Status& s);
+
+    /**
+     * 在conn上查询复制延迟
+     * @param replica
+     * @param conn
+     * @param s
+     * @return
+     */
+    int64_t queryLag(Replica& replica, Connection& conn, Status& s);
+
+    void lagCheckLoop();
+
+private:
+    ConnectionPoolPtr primary_;
+
+    std::vector<std::unique_ptr<Replica>> replicas_;
+
+    RoutingOptions options_;
+
+    /**
+     * 轮流分配读请求的计数
+     */
+    std::atomic<size_t> nextReplica_;
+
+    bool stopping_;
+
+    std::mutex mutex_;
+
+    std::condition_variable cond_;
+
+    /**
+     * 保护Replica的monitor和legacyStatus，同一时间只有一个检查
+     */
+    std::mutex checkMutex_;
+
+    /**
+     * 检查复制延迟的线程
+     */
+    std::thread lagThread_;
+};
+
+using RoutingPoolPtr = std::shared_ptr<RoutingPool>;
+
+}  // namespace db
+
+#endif  // MYSQL_CONNECTOR_ROUTINGPOOL_H
@@ -7,6 +7,10 @@
 
 #include <fmt/printf.h>
 
+#include <chrono>
+#include <vector>
+
+#include "QueryWatchdog.h"
 #include "ResultSet.h"
 #include "Status.h"
 #include "Util.h"
@@ -15,6 +19,33 @@ namespace db {
 
 class Connection;
 
+/**
+ * executeBatch中一条语句的执行结果
+ */
+struct BatchResult {
+    /**
+     * 这条语句是否执行成功，前面的语句出错时后面的语句不会执行
+     */
+    Status status;
+
+    /**
+     * 受影响的行数，select语句为-1
+     */
+    int64_t affectedRows;
+
+    /**
+     * insert语句生成的自增ID
+     */
+    int64_t insertId;
+
+    /**
+     * select语句的结果集，其他语句为无效的ResultSet
+     */
+    ResultSet resultSet;
+
+    BatchResult() : affectedRows(-1), insertId(0) {}
+};
+
 /**
  * 普通的Statement，能用来执行SQL请求
  */
@@ -44,6 +75,32 @@ public:
      */
     ResultSet executeQuery(const std::string& sql, Status& s);
 
+    /**
+     * 执行select sql，到达deadline时中断
+     *
+     * select语句加上MAX_EXECUTION_TIME由服务器限制执行时间，
+     * 其他语句由Connection的QueryWatchdog发送KILL QUERY中断
+     * @param sql
+     * @param deadline      和Connection的deadline取较早的一个
+     * @param s             超时时为Status::TIMEOUT
+     * @return
+     */
+    ResultSet executeQuery(const std::string& sql,
+                           std::chrono::steady_clock::time_point deadline,
+                           Status& s);
+
+    /**
+     * 执行select sql，返回流式的结果集
+     *
+     * 结果集不会全部读到内存中，收到一行就可以读取一行，适合很大的结果集。
+     * 结果集读完或者释放之前，这个连接上不能执行其他sql，
+     * 提前释放会读取并丢弃剩下的行；不支持rewind
+     * @param sql       select语句
+     * @param s
+     * @return
+     */
+    ResultSet executeStreamingQuery(const std::string& sql, Status& s);
+
     /**
      * 执行update/delete语句，返回受到影响的行数
      * @param sql
@@ -52,6 +109,17 @@ public:
      */
     int executeUpdate(const std::string& sql, Status& s);
 
+    /**
+     * 执行update/delete语句，到达deadline时中断
+     * @param sql
+     * @param deadline      和Connection的deadline取较早的一个
+     * @param s             超时时为Status::TIMEOUT
+     * @return
+     */
+    int executeUpdate(const std::string& sql,
+                      std::chrono::steady_clock::time_point deadline,
+                      Status& s);
+
     /**
      * 执行sql语句
      * @param sql
@@ -59,6 +127,39 @@ public:
      */
     void execute(const std::string& sql, Status& s);
 
+    /**
+     * 执行sql语句，到达deadline时中断
+     * @param sql
+     * @param deadline      和Connection的deadline取较早的一个
+     * @param s             超时时为Status::TIMEOUT
+     */
+    void execute(const std::string& sql,
+                 std::chrono::steady_clock::time_point deadline, Status& s);
+
+    /**
+     * 把多条sql拼接成一个请求发送，一次往返执行完
+     *
+     * 拼接后超过服务器max_allowed_packet的会拆成多个请求。
+     * 某条语句出错后服务器不再执行剩下的语句，它们的status为错误。
+     * 执行之后连接上保持开启多语句，下次执行单条sql之前再关闭
+     * @param sqls      每条一个语句，不能是会返回多个结果的CALL
+     * @param s         第一个出错的语句的错误
+     * @return          和sqls一一对应的结果
+     */
+    std::vector<BatchResult> executeBatch(const std::vector<std::string>& sqls,
+                                          Status& s);
+
+    /**
+     * 批量执行sql，到达deadline时由QueryWatchdog中断
+     * @param sqls
+     * @param deadline      和Connection的deadline取较早的一个
+     * @param s             超时时为Status::TIMEOUT
+     * @return
+     */
+    std::vector<BatchResult> executeBatch(
+        const std::vector<std::string>& sqls,
+        std::chrono::steady_clock::time_point deadline, Status& s);
+
     /**
      * 获取上一个insert语句，生成的自增ID
      * @return
@@ -94,9 +195,43 @@ public:
      */
     bool valid() const;
 
+    /**
+     * 创建这个Statement的连接
+     * @return
+     */
+    Connection& getConnection() const { return conn_; }
+
 private:
     void checkValid(Status& s) const;
 
+    /**
+     * 发送sql，按deadline加上MAX_EXECUTION_TIME或者开始监视
+     * @param sql
+     * @param deadline
+     * @param watch
+     * @param s
+     * @return      是否发送成功
+     */
+    bool send(const std::string& sql,
+              std::chrono::steady_clock::time_point deadline,
+              QueryWatch& watch, Status& s);
+
+    /**
+     * 执行拼接好的sql，依次读取results[begin, end)的结果
+     * @param sql
+     * @param results
+     * @param begin
+     * @param end
+     * @param deadline
+     * @param s
+     * @return  出错的语句的下标，都成功时为end
+     */
+    size_t executePacked(const std::string& sql,
+                         std::vector<BatchResult>& results, size_t begin,
+                         size_t end,
+                         std::chrono::steady_clock::time_point deadline,
+                         Status& s);
+
 private:
     /**
      * mysql链接
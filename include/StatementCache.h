@@ -0,0 +1,142 @@
+//
+// Created by m8792 on 2021/1/7.
+//
+
+#ifndef MYSQL_CONNECTOR_STATEMENTCACHE_H
+#define MYSQL_CONNECTOR_STATEMENTCACHE_H
+
+#include <mysql/mysql.h>
+
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "ResultMetaData.h"
+
+namespace db {
+
+/**
+ * 一个连接上已经prepare过的MYSQL_STMT，按sql缓存，LRU淘汰
+ *
+ * 由Connection持有，和Connection一样不是线程安全的。
+ * 取出的stmt在使用期间不会被淘汰，归还时mysql_stmt_reset之后放回缓存。
+ * stmt的结果集元数据和stmt一起缓存，重复执行时不需要重新获取
+ *
+ * @note 服务器上所有连接prepare的语句总数受max_prepared_stmt_count限制，
+ * 容量乘以连接数不要超过这个值
+ */
+class StatementCache {
+public:
+    /**
+     * @param capacity      最多缓存的stmt数量
+     */
+    explicit StatementCache(size_t capacity)
+        : capacity_(capacity), hits_(0), misses_(0) {}
+
+    StatementCache(const StatementCache&) = delete;
+
+    StatementCache& operator=(const StatementCache&) = delete;
+
+    ~StatementCache() { clear(); }
+
+    /**
+     * 取出sql对应的空闲stmt
+     * @param sql
+     * @param metaData      不为空时取出stmt缓存的结果集元数据
+     * @return      没有缓存或者正在被使用时返回nullptr
+     */
+    MYSQL_STMT* acquire(
+        const std::string& sql,
+        std::unique_ptr<StatementMetaData>* metaData = nullptr);
+
+    /**
+     * 缓存一个新prepare的stmt，状态为正在使用
+     * @param sql
+     * @param stmt
+     * @return      缓存已满且都在使用，或者sql已经缓存时返回false，
+     *              stmt仍然由调用者关闭
+     */
+    bool add(const std::string& sql, MYSQL_STMT* stmt);
+
+    /**
+     * 归还取出的stmt
+     *
+     * reset失败或者不在缓存中的stmt会被关闭
+     * @param stmt
+     * @param metaData      和stmt一起缓存的结果集元数据
+     */
+    void release(MYSQL_STMT* stmt,
+                 std::unique_ptr<StatementMetaData> metaData = nullptr);
+
+    /**
+     * 关闭所有空闲的stmt，正在使用的在归还时关闭
+     */
+    void clear();
+
+    /**
+     * 是否有被取出还没有归还的stmt
+     * @return
+     */
+    bool inUse() const;
+
+    size_t size() const { return entries_.size(); }
+
+    size_t capacity() const { return capacity_; }
+
+    /**
+     * 命中缓存的次数
+     * @return
+     */
+    uint64_t getHitCount() const { return hits_; }
+
+    /**
+     * 没有命中缓存的次数
+     * @return
+     */
+    uint64_t getMissCount() const { return misses_; }
+
+private:
+    struct Entry {
+        std::string sql;
+
+        MYSQL_STMT* stmt;
+
+        bool leased;
+
+        /**
+         * 空闲时缓存的结果集元数据
+         */
+        std::unique_ptr<StatementMetaData> metaData;
+    };
+
+    using EntryList = std::list<Entry>;
+
+    /**
+     * 淘汰最久没有使用的空闲stmt
+     * @return  都在使用时返回false
+     */
+    bool evict();
+
+    void erase(EntryList::iterator it);
+
+private:
+    size_t capacity_;
+
+    /**
+     * 最近使用的在前面
+     */
+    EntryList entries_;
+
+    std::unordered_map<std::string, EntryList::iterator> bySql_;
+
+    std::unordered_map<MYSQL_STMT*, EntryList::iterator> byStmt_;
+
+    uint64_t hits_;
+
+    uint64_t misses_;
+};
+
+}  // namespace db
+
+#endif  // MYSQL_CONNECTOR_STATEMENTCACHE_H
@@ -14,7 +14,7 @@ namespace db {
  */
 class Status {
 public:
-    enum StatusCode { OK = 0, ERROR, RUNTIME_ERROR, UNKNOWN_ERROR };
+    enum StatusCode { OK = 0, ERROR, RUNTIME_ERROR, UNKNOWN_ERROR, TIMEOUT };
 
 public:
     Status();
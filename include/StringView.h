@@ -0,0 +1,118 @@
+//
+// Created by m8792 on 2021/1/12.
+//
+
+#ifndef MYSQL_CONNECTOR_STRINGVIEW_H
+#define MYSQL_CONNECTOR_STRINGVIEW_H
+
+#include <string.h>
+
+#include <algorithm>
+#include <functional>
+#include <ostream>
+#include <string>
+
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+
+namespace db {
+
+/**
+ * 指向一段不属于自己的数据，不复制数据
+ *
+ * 数据可以包含'\0'，长度由size给出。C++11中没有std::string_view，
+ * C++17下可以隐式转换为std::string_view
+ */
+class StringView {
+public:
+    StringView() : data_(nullptr), size_(0) {}
+
+    StringView(const char* data, size_t size) : data_(data), size_(size) {}
+
+    StringView(const char* str) : data_(str), size_(str ? strlen(str) : 0) {}
+
+    StringView(const std::string& str) : data_(str.data()), size_(str.size()) {}
+
+    const char* data() const { return data_; }
+
+    size_t size() const { return size_; }
+
+    bool empty() const { return size_ == 0; }
+
+    const char* begin() const { return data_; }
+
+    const char* end() const { return data_ + size_; }
+
+    char operator[](size_t index) const { return data_[index]; }
+
+    /**
+     * 复制出一个std::string
+     * @return
+     */
+    std::string toString() const {
+        return data_ ? std::string(data_, size_) : std::string();
+    }
+
+    /**
+     * 按字节比较
+     * @param other
+     * @return      小于0、等于0、大于0分别表示小于、等于、大于other
+     */
+    int compare(StringView other) const {
+        size_t len = std::min(size_, other.size_);
+        int ret = len == 0 ? 0 : memcmp(data_, other.data_, len);
+        if (ret != 0) {
+            return ret;
+        }
+        return size_ < other.size_ ? -1 : (size_ > other.size_ ? 1 : 0);
+    }
+
+#if __cplusplus >= 201703L
+    operator std::string_view() const {
+        return std::string_view(data_, size_);
+    }
+#endif
+
+private:
+    const char* data_;
+
+    size_t size_;
+};
+
+inline bool operator==(StringView lhs, StringView rhs) {
+    return lhs.size() == rhs.size() && lhs.compare(rhs) == 0;
+}
+
+inline bool operator!=(StringView lhs, StringView rhs) { return !(lhs == rhs); }
+
+inline bool operator<(StringView lhs, StringView rhs) {
+    return lhs.compare(rhs) < 0;
+}
+
+inline std::ostream& operator<<(std::ostream& os, StringView view) {
+    return os.write(view.data(), view.size());
+}
+
+}  // namespace db
+
+namespace std {
+
+/**
+ * FNV-1a，可以直接作为unordered_map的key，不用先复制成std::string
+ */
+template <>
+struct hash<db::StringView> {
+    size_t operator()(db::StringView view) const {
+        uint64_t h = 14695981039346656037ULL;
+        for (char c : view) {
+            h ^= static_cast<unsigned char>(c);
+            h *= 1099511628211ULL;
+        }
+        return static_cast<size_t>(h);
+    }
+};
+
+}  // namespace std
+
+#endif  // MYSQL_CONNECTOR_STRINGVIEW_H
@@ -4,23 +4,344 @@
 
 #include "Connection.h"
 
+#include <ctype.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "Option.h"
 #include "Statement.h"
 #include "Status.h"
 #include "Util.h"
 
 namespace db {
 
-Connection::Connection() : connected_(false) { initializeHandler(); }
+namespace {
+
+/**
+ * sql中的一个词，字符串和注释已经跳过
+ */
+struct SqlToken {
+    enum Type {
+        WORD,      // 关键字、标识符、数字，已经转成大写
+        VARIABLE,  // 用户变量 @name
+        SYSTEM,    // 系统变量 @@name、@@global.name，已经转成大写
+        ASSIGN,    // :=
+        OTHER      // 其他符号
+    };
+
+    Type type;
+
+    std::string text;
+};
+
+bool isWordChar(char c) {
+    return isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '$';
+}
+
+std::string toUpper(const std::string& sql, size_t begin, size_t end) {
+    std::string upper;
+    upper.reserve(end - begin);
+    for (size_t i = begin; i < end; ++i) {
+        upper += static_cast<char>(toupper(static_cast<unsigned char>(sql[i])));
+    }
+    return upper;
+}
+
+/**
+ * 把sql分成词，跳过字符串、带引号的标识符和注释
+ * @param sql
+ * @return
+ */
+std::vector<SqlToken> tokenize(const std::string& sql) {
+    std::vector<SqlToken> tokens;
+    size_t i = 0;
+    while (i < sql.size()) {
+        char c = sql[i];
+        if (isspace(static_cast<unsigned char>(c))) {
+            ++i;
+        } else if (c == '\'' || c == '"' || c == '`') {
+            // 字符串和带引号的标识符，反斜杠转义时跳过下一个字符
+            ++i;
+            while (i < sql.size() && sql[i] != c) {
+                i += (sql[i] == '\\' && c != '`') ? 2 : 1;
+            }
+            ++i;
+            tokens.push_back(SqlToken{SqlToken::OTHER, ""});
+        } else if (c == '#' ||
+                   (sql.compare(i, 2, "--") == 0 &&
+                    (i + 2 == sql.size() ||
+                     isspace(static_cast<unsigned char>(sql[i + 2]))))) {
+            i = sql.find('\n', i);
+            i = i == std::string::npos ? sql.size() : i;
+        } else if (c == '/' && sql.compare(i, 3, "/*!") == 0) {
+            // 有版本号的注释中的内容会被执行
+            i += 3;
+            while (i < sql.size() &&
+                   isdigit(static_cast<unsigned char>(sql[i]))) {
+                ++i;
+            }
+        } else if (c == '/' && sql.compare(i, 2, "/*") == 0) {
+            i = sql.find("*/", i + 2);
+            i = i == std::string::npos ? sql.size() : i + 2;
+        } else if (c == '@') {
+            bool system = sql.compare(i, 2, "@@") == 0;
+            size_t end = i + (system ? 2 : 1);
+            while (end < sql.size() && (isWordChar(sql[end]) ||
+                                        (system && sql[end] == '.'))) {
+                ++end;
+            }
+            tokens.push_back(
+                SqlToken{system ? SqlToken::SYSTEM : SqlToken::VARIABLE,
+                         toUpper(sql, i, end)});
+            i = end;
+        } else if (isWordChar(c)) {
+            size_t end = i;
+            while (end < sql.size() && isWordChar(sql[end])) {
+                ++end;
+            }
+            tokens.push_back(SqlToken{SqlToken::WORD, toUpper(sql, i, end)});
+            i = end;
+        } else if (c == ':' && sql.compare(i, 2, ":=") == 0) {
+            tokens.push_back(SqlToken{SqlToken::ASSIGN, ":="});
+            i += 2;
+        } else {
+            tokens.push_back(SqlToken{SqlToken::OTHER, std::string(1, c)});
+            ++i;
+        }
+    }
+    return tokens;
+}
+
+/**
+ * SET语句是否只修改全局变量，比如SET GLOBAL、SET @@global.x
+ * @param tokens
+ * @param set       SET所在的下标
+ * @return
+ */
+bool setsGlobalOnly(const std::vector<SqlToken>& tokens, size_t set) {
+    if (set + 1 >= tokens.size()) {
+        return false;
+    }
+
+    const SqlToken& scope = tokens[set + 1];
+    if (!(scope.type == SqlToken::WORD &&
+          (scope.text == "GLOBAL" || scope.text == "PERSIST" ||
+           scope.text == "PERSIST_ONLY")) &&
+        !(scope.type == SqlToken::SYSTEM &&
+          (scope.text.compare(0, 9, "@@GLOBAL.") == 0 ||
+           scope.text.compare(0, 10, "@@PERSIST.") == 0))) {
+        return false;
+    }
+
+    // 后面的赋值中出现会话级的变量
+    for (size_t i = set + 2; i < tokens.size(); ++i) {
+        const SqlToken& token = tokens[i];
+        if (token.type == SqlToken::VARIABLE ||
+            (token.type == SqlToken::WORD &&
+             (token.text == "SESSION" || token.text == "LOCAL")) ||
+            (token.type == SqlToken::SYSTEM &&
+             token.text.compare(0, 9, "@@GLOBAL.") != 0 &&
+             token.text.compare(0, 10, "@@PERSIST.") != 0)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * sql是否可能修改会话状态
+ *
+ * 按开头的关键字判断，事务由服务器返回的状态判断。
+ * 查询和DML中只有给用户变量赋值（@x := 、INTO @x）和GET_LOCK会修改，
+ * SET语句中只修改全局变量的不算，其他语句都认为会修改
+ * @param sql
+ * @return
+ */
+bool changesSession(const std::string& sql) {
+    static const char* const safeKeywords[] = {
+        "SELECT", "INSERT", "UPDATE",  "DELETE",   "REPLACE", "WITH",
+        "SHOW",   "EXPLAIN", "DESC",   "DESCRIBE", "BEGIN",   "START",
+        "COMMIT", "ROLLBACK"};
+
+    std::vector<SqlToken> tokens = tokenize(sql);
+    size_t first = 0;
+    while (first < tokens.size() && tokens[first].type == SqlToken::OTHER &&
+           tokens[first].text == "(") {
+        ++first;
+    }
+    if (first == tokens.size() || tokens[first].type != SqlToken::WORD) {
+        return true;
+    }
+
+    const std::string& keyword = tokens[first].text;
+    if (keyword == "SET") {
+        return !setsGlobalOnly(tokens, first);
+    }
+
+    bool safe = false;
+    for (const char* candidate : safeKeywords) {
+        if (keyword == candidate) {
+            safe = true;
+            break;
+        }
+    }
+    if (!safe) {
+        return true;
+    }
+
+    for (size_t i = first + 1; i + 1 < tokens.size(); ++i) {
+        const SqlToken& token = tokens[i];
+        const SqlToken& next = tokens[i + 1];
+        if ((token.type == SqlToken::VARIABLE &&
+             next.type == SqlToken::ASSIGN) ||
+            (token.type == SqlToken::WORD && token.text == "INTO" &&
+             next.type == SqlToken::VARIABLE) ||
+            (token.type == SqlToken::WORD && token.text == "GET_LOCK" &&
+             next.type == SqlToken::OTHER && next.text == "(")) {
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* isolationLevelName(Connection::IsolationLevel level) {
+    switch (level) {
+    case Connection::READ_UNCOMMITTED:
+        return "READ UNCOMMITTED";
+    case Connection::READ_COMMITTED:
+        return "READ COMMITTED";
+    case Connection::REPEATABLE_READ:
+        return "REPEATABLE READ";
+    case Connection::SERIALIZABLE:
+        return "SERIALIZABLE";
+    }
+    return "";
+}
+
+/**
+ * 加上单引号，引号写成两个引号
+ *
+ * 反斜杠是否转义取决于sql_mode（NO_BACKSLASH_ESCAPES），
+ * 含有反斜杠的值写成十六进制的字面量，和sql_mode无关
+ * @param value
+ * @return
+ */
+std::string quote(const std::string& value) {
+    if (value.find('\\') != std::string::npos) {
+        std::string hex = "X'";
+        for (char c : value) {
+            hex += fmt::sprintf("%02X", static_cast<unsigned char>(c));
+        }
+        hex += '\'';
+        return hex;
+    }
+
+    std::string quoted = "'";
+    for (char c : value) {
+        if (c == '\'') {
+            quoted += '\'';
+        }
+        quoted += c;
+    }
+    quoted += '\'';
+    return quoted;
+}
+
+/**
+ * 把SessionOptions合并成一条SET语句
+ * @param options
+ * @return      不需要设置时返回空串
+ */
+std::string buildInitCommand(const SessionOptions& options) {
+    std::vector<std::string> assignments;
+    if (!options.autoCommit) {
+        assignments.push_back("autocommit=0");
+    }
+    if (options.isolationLevel != 0) {
+        std::string level = isolationLevelName(
+            static_cast<Connection::IsolationLevel>(options.isolationLevel));
+        std::replace(level.begin(), level.end(), ' ', '-');
+        assignments.push_back("transaction_isolation=" + quote(level));
+    }
+    if (!options.timeZone.empty()) {
+        assignments.push_back("time_zone=" + quote(options.timeZone));
+    }
+    if (!options.sqlMode.empty()) {
+        assignments.push_back("sql_mode=" + quote(options.sqlMode));
+    }
+    for (auto& variable : options.variables) {
+        assignments.push_back(variable.first + "=" + variable.second);
+    }
+
+    std::string command;
+    for (auto& assignment : assignments) {
+        command += command.empty() ? "SET " : ", ";
+        command += assignment;
+    }
+    return command;
+}
+
+}  // namespace
+
+Connection::Connection()
+    : connected_(false),
+      connecting_(false),
+      autoCommit_(true),
+      isolationLevel_(0),
+      sessionDirty_(false),
+      multiStatements_(false),
+      maxAllowedPacket_(0),
+      deadline_(std::chrono::steady_clock::time_point::max()) {
+    initializeHandler();
+}
 
 Connection::Connection(Connection&& other)
-    : conn_(std::move(other.conn_)), connected_(other.connected_) {
+    : conn_(std::move(other.conn_)),
+      connected_(other.connected_),
+      connecting_(other.connecting_),
+      autoCommit_(other.autoCommit_),
+      defaultSchema_(std::move(other.defaultSchema_)),
+      schema_(std::move(other.schema_)),
+      isolationLevel_(other.isolationLevel_),
+      session_(std::move(other.session_)),
+      initCommand_(std::move(other.initCommand_)),
+      sessionDirty_(other.sessionDirty_),
+      multiStatements_(other.multiStatements_),
+      maxAllowedPacket_(other.maxAllowedPacket_),
+      watchdog_(std::move(other.watchdog_)),
+      deadline_(other.deadline_),
+      queryObserver_(std::move(other.queryObserver_)),
+      stmtCache_(std::move(other.stmtCache_)) {
     other.connected_ = false;
 }
 
 Connection& Connection::operator=(Connection&& other) {
+    if (this == &other) {
+        return *this;
+    }
+
+    // 缓存的stmt需要在原来的连接关闭之前关闭
+    close();
     conn_ = std::move(other.conn_);
     connected_ = other.connected_;
+    connecting_ = other.connecting_;
+    autoCommit_ = other.autoCommit_;
+    defaultSchema_ = std::move(other.defaultSchema_);
+    schema_ = std::move(other.schema_);
+    isolationLevel_ = other.isolationLevel_;
+    session_ = std::move(other.session_);
+    initCommand_ = std::move(other.initCommand_);
+    sessionDirty_ = other.sessionDirty_;
+    multiStatements_ = other.multiStatements_;
+    maxAllowedPacket_ = other.maxAllowedPacket_;
+    watchdog_ = std::move(other.watchdog_);
+    deadline_ = other.deadline_;
+    queryObserver_ = std::move(other.queryObserver_);
+    stmtCache_ = std::move(other.stmtCache_);
     other.connected_ = false;
+    return *this;
 }
 
 Connection::~Connection() { close(); }
@@ -34,6 +355,65 @@ void Connection::connect(const std::string& host, unsigned short port,
 void Connection::connect(const std::string& host, unsigned short port,
                          const std::string& user, const std::string& password,
                          const std::string& schema, Status& s) {
+    beginConnect(s);
+    if (!s) {
+        return;
+    }
+
+    if (nullptr == mysql_real_connect(conn_.get(), host.c_str(), user.c_str(),
+                                      password.c_str(),
+                                      schema.empty() ? nullptr : schema.c_str(),
+                                      port, nullptr, 0)) {
+        s.assign(Status::RUNTIME_ERROR,
+                 fmt::sprintf("failed to connect to %s@%s due to %s", user,
+                              host, getLastError(conn_.get())));
+        return;
+    }
+
+    finishConnect(schema);
+    syncAutoCommit(s);
+}
+
+#ifdef MYSQL_CONNECTOR_HAS_NONBLOCKING
+net_async_status Connection::connectNonblocking(const std::string& host,
+                                                unsigned short port,
+                                                const std::string& user,
+                                                const std::string& password,
+                                                const std::string& schema,
+                                                Status& s) {
+    s.clear();
+
+    if (!connecting_) {
+        beginConnect(s);
+        if (!s) {
+            return NET_ASYNC_ERROR;
+        }
+        connecting_ = true;
+    }
+
+    net_async_status status = mysql_real_connect_nonblocking(
+        conn_.get(), host.c_str(), user.c_str(), password.c_str(),
+        schema.empty() ? nullptr : schema.c_str(), port, nullptr, 0);
+    if (status == NET_ASYNC_NOT_READY) {
+        return status;
+    }
+
+    connecting_ = false;
+    if (status == NET_ASYNC_ERROR) {
+        s.assign(Status::RUNTIME_ERROR,
+                 fmt::sprintf("failed to connect to %s@%s due to %s", user,
+                              host, getLastError(conn_.get())));
+        return status;
+    }
+
+    // 不发送阻塞的mysql_autocommit，和SessionOptions不一致时由restoreSession恢复
+    finishConnect(schema);
+    autoCommit_ = conn_.get()->server_status & SERVER_STATUS_AUTOCOMMIT;
+    return status;
+}
+#endif
+
+void Connection::beginConnect(Status& s) {
     s.clear();
 
     if (connected()) {
@@ -46,23 +426,43 @@ void Connection::connect(const std::string& host, unsigned short port,
         return;
     }
 
-    if (nullptr == mysql_real_connect(conn_.get(), host.c_str(), user.c_str(),
-                                      password.c_str(),
-                                      schema.empty() ? nullptr : schema.c_str(),
-                                      port, nullptr, 0)) {
-        s.assign(Status::RUNTIME_ERROR,
-                 fmt::sprintf("failed to connect to %s@%s due to %s", user,
-                              host, getLastError(conn_.get())));
-        return;
+    if (!session_.charset.empty()) {
+        setOption(option::CharsetName(session_.charset), s);
+        if (!s) {
+            return;
+        }
+    }
+
+    // 失败后在同一个句柄上重试时不重复添加
+    if (initCommand_.empty()) {
+        initCommand_ = buildInitCommand(session_);
+        if (!initCommand_.empty()) {
+            setOption(option::InitCommand(initCommand_), s);
+            if (!s) {
+                initCommand_.clear();
+                return;
+            }
+        }
     }
+}
 
+void Connection::finishConnect(const std::string& schema) {
     connected_ = true;
-    setAutoCommit(true, s);
+    defaultSchema_ = schema;
+    schema_ = schema;
+    isolationLevel_ = session_.isolationLevel;
+    sessionDirty_ = false;
+    multiStatements_ = false;
+    maxAllowedPacket_ = 0;
 }
 
 void Connection::close() {
+    if (stmtCache_) {
+        stmtCache_->clear();
+    }
     conn_.close();
     connected_ = false;
+    connecting_ = false;
 }
 
 bool Connection::connected() const { return connected_; }
@@ -91,28 +491,60 @@ PreparedStatement Connection::prepareStatement(const std::string& sql,
         return PreparedStatement();
     }
 
-    PreparedStatement stmt(mysql_stmt_init(conn_.get()));
+    if (streaming()) {
+        s.assign(Status::ERROR, "streaming result set not finished");
+        return PreparedStatement();
+    }
+
+    if (stmtCache_) {
+        std::unique_ptr<StatementMetaData> metaData;
+        MYSQL_STMT* cached = stmtCache_->acquire(sql, &metaData);
+        if (cached != nullptr) {
+            s.clear();
+            return PreparedStatement(cached, stmtCache_.get(), this,
+                                     std::move(metaData));
+        }
+    }
+
+    MYSQL_STMT* stmt = prepare(sql, s);
+    if (stmt == nullptr) {
+        return PreparedStatement();
+    }
+
+    if (stmtCache_ && stmtCache_->add(sql, stmt)) {
+        return PreparedStatement(stmt, stmtCache_.get(), this);
+    }
+    return PreparedStatement(stmt, nullptr, this);
+}
+
+void Connection::setStatementCacheSize(size_t capacity, Status& s) {
+    s.clear();
+
+    // 取出的PreparedStatement还持有原来的缓存
+    if (stmtCache_ && stmtCache_->inUse()) {
+        s.assign(Status::ERROR, "statement cache is in use");
+        return;
+    }
+    stmtCache_.reset(capacity > 0 ? new StatementCache(capacity) : nullptr);
+}
+
+MYSQL_STMT* Connection::prepare(const std::string& sql, Status& s) {
+    s.clear();
+
+    StatementHandler stmt(mysql_stmt_init(conn_.get()));
     if (!stmt.valid()) {
         s.assign(Status::ERROR, fmt::sprintf("create stmt failed, %s",
                                              getLastError(conn_.get())));
-        return stmt;
+        return nullptr;
     }
 
     if (mysql_stmt_prepare(stmt.get(), sql.c_str(), sql.size()) != 0) {
         s.assign(Status::ERROR, fmt::sprintf("prepare stmt failed, %s",
                                              getLastError(stmt.get())));
-        return PreparedStatement();
-    }
-
-    my_bool on = true;
-    if (mysql_stmt_attr_set(stmt.get(), STMT_ATTR_UPDATE_MAX_LENGTH, &on) !=
-        0) {
-        s.assign(Status::ERROR, fmt::sprintf("update stmt option failed, %s",
-                                             getLastError(stmt.get())));
-        return PreparedStatement();
+        return nullptr;
     }
 
-    return stmt;
+    return stmt.release();
 }
 
 void Connection::selectSchema(const std::string& schema, Status& s) {
@@ -123,11 +555,16 @@ void Connection::selectSchema(const std::string& schema, Status& s) {
         return;
     }
 
+    if (schema == schema_ && !sessionDirty_) {
+        return;
+    }
+
     if (mysql_select_db(conn_.get(), schema.c_str()) != 0) {
         s.assign(Status::ERROR,
                  fmt::sprintf("select db failed, %s", getLastError(conn_)));
         return;
     }
+    schema_ = schema;
 }
 
 void Connection::setAutoCommit(bool autoCommit, Status& s) {
@@ -138,6 +575,13 @@ void Connection::setAutoCommit(bool autoCommit, Status& s) {
         return;
     }
 
+    // 服务器在每个响应中都会返回autocommit的状态
+    bool current = conn_.get()->server_status & SERVER_STATUS_AUTOCOMMIT;
+    if (current == autoCommit) {
+        autoCommit_ = autoCommit;
+        return;
+    }
+
     if (mysql_autocommit(conn_.get(), autoCommit) != 0) {
         s.assign(
             Status::RUNTIME_ERROR,
@@ -150,6 +594,216 @@ void Connection::setAutoCommit(bool autoCommit, Status& s) {
 
 bool Connection::getAutoCommit(Status& s) { return autoCommit_; }
 
+void Connection::syncAutoCommit(Status& s) {
+    autoCommit_ = conn_.get()->server_status & SERVER_STATUS_AUTOCOMMIT;
+    if (autoCommit_ != session_.autoCommit) {
+        // 服务器的全局默认值和期望的不同
+        setAutoCommit(session_.autoCommit, s);
+    }
+}
+
+void Connection::setIsolationLevel(IsolationLevel level, Status& s) {
+    s.clear();
+
+    if (!connected()) {
+        s.assign(Status::ERROR, "not connected");
+        return;
+    }
+
+    if (level == isolationLevel_ && !sessionDirty_) {
+        return;
+    }
+
+    std::string sql = fmt::sprintf("SET SESSION TRANSACTION ISOLATION LEVEL %s",
+                                   isolationLevelName(level));
+    if (mysql_real_query(conn_.get(), sql.c_str(), sql.size()) != 0) {
+        s.assign(Status::RUNTIME_ERROR,
+                 fmt::sprintf("set isolation level failed, %s",
+                              getLastError(conn_)));
+        return;
+    }
+    isolationLevel_ = level;
+}
+
+void Connection::setMultiStatements(bool enable, Status& s) {
+    s.clear();
+
+    if (!connected()) {
+        s.assign(Status::ERROR, "not connected");
+        return;
+    }
+
+    if (enable == multiStatements_) {
+        return;
+    }
+
+    enum_mysql_set_option option = enable ? MYSQL_OPTION_MULTI_STATEMENTS_ON
+                                          : MYSQL_OPTION_MULTI_STATEMENTS_OFF;
+    if (mysql_set_server_option(conn_.get(), option) == 0) {
+        multiStatements_ = enable;
+        return;
+    }
+
+    s.assign(Status::RUNTIME_ERROR,
+             fmt::sprintf("%s multi statements failed, %s",
+                          enable ? "enable" : "disable", getLastError(conn_)));
+    if (!enable) {
+        // 不能确定是否还允许多语句，不能再执行其他sql
+        close();
+    }
+}
+
+bool Connection::inTransaction() const {
+    return connected() && (conn_.get()->server_status & SERVER_STATUS_IN_TRANS);
+}
+
+bool Connection::sessionClean() const {
+    return !sessionDirty_ && !multiStatements_ &&
+           isolationLevel_ == session_.isolationLevel &&
+           autoCommit_ == session_.autoCommit && !inTransaction() &&
+           schema_ == defaultSchema_;
+}
+
+void Connection::restoreSession(Status& s) {
+    s.clear();
+
+    if (!connected()) {
+        s.assign(Status::ERROR, "not connected");
+        return;
+    }
+
+    // 没有schema时不能用selectSchema切换回去，只能重置会话；
+    // 服务器默认的隔离级别没有名字，也只能重置
+    if (sessionDirty_ ||
+        (defaultSchema_.empty() && schema_ != defaultSchema_) ||
+        (session_.isolationLevel == 0 && isolationLevel_ != 0)) {
+        resetConnection(s);
+        return;
+    }
+
+    if (inTransaction() && mysql_rollback(conn_.get()) != 0) {
+        s.assign(Status::RUNTIME_ERROR,
+                 fmt::sprintf("rollback failed, %s", getLastError(conn_)));
+        return;
+    }
+    if (isolationLevel_ != session_.isolationLevel) {
+        setIsolationLevel(
+            static_cast<IsolationLevel>(session_.isolationLevel), s);
+    }
+    if (s && autoCommit_ != session_.autoCommit) {
+        setAutoCommit(session_.autoCommit, s);
+    }
+    if (s && schema_ != defaultSchema_) {
+        selectSchema(defaultSchema_, s);
+    }
+    if (s) {
+        setMultiStatements(false, s);
+    }
+}
+
+void Connection::resetConnection(Status& s) {
+    s.clear();
+
+    if (!connected()) {
+        s.assign(Status::ERROR, "not connected");
+        return;
+    }
+
+    // 服务器上的stmt会被释放
+    if (stmtCache_) {
+        stmtCache_->clear();
+    }
+
+    // 连接建立时没有schema的，reset之后不能取消当前的schema，
+    // 用原来的用户重新登录，会话同样会被重置
+    if (defaultSchema_.empty() && (sessionDirty_ || !schema_.empty())) {
+        // mysql_change_user会释放原来的user和passwd，先复制一份
+        MYSQL* mysql = conn_.get();
+        std::string user = mysql->user == nullptr ? "" : mysql->user;
+        std::string password = mysql->passwd == nullptr ? "" : mysql->passwd;
+        if (mysql_change_user(mysql, user.c_str(), password.c_str(),
+                              nullptr) != 0) {
+            s.assign(Status::RUNTIME_ERROR,
+                     fmt::sprintf("change user failed, %s",
+                                  getLastError(conn_)));
+            return;
+        }
+        schema_.clear();
+    } else if (mysql_reset_connection(conn_.get()) != 0) {
+        s.assign(Status::RUNTIME_ERROR,
+                 fmt::sprintf("reset connection failed, %s",
+                              getLastError(conn_)));
+        return;
+    } else if (sessionDirty_) {
+        // 执行过的sql可能切换了schema，reset不会恢复schema
+        schema_.clear();
+    }
+
+    // 会话变量恢复为全局值，重新执行连接建立时的设置
+    isolationLevel_ = 0;
+    sessionDirty_ = false;
+    if (!initCommand_.empty() &&
+        mysql_real_query(conn_.get(), initCommand_.c_str(),
+                         initCommand_.size()) != 0) {
+        s.assign(Status::RUNTIME_ERROR,
+                 fmt::sprintf("restore session options failed, %s",
+                              getLastError(conn_)));
+        return;
+    }
+    isolationLevel_ = session_.isolationLevel;
+    syncAutoCommit(s);
+
+    if (s && schema_ != defaultSchema_) {
+        selectSchema(defaultSchema_, s);
+    }
+    // reset不会关闭多语句
+    if (s) {
+        setMultiStatements(false, s);
+    }
+}
+
+size_t Connection::getMaxAllowedPacket(Status& s) {
+    s.clear();
+
+    if (!connected()) {
+        s.assign(Status::ERROR, "not connected");
+        return 0;
+    }
+
+    // 会话的max_allowed_packet是只读的，连接期间不会变化
+    if (maxAllowedPacket_ != 0) {
+        return maxAllowedPacket_;
+    }
+
+    const std::string sql = "SELECT @@max_allowed_packet";
+    if (mysql_real_query(conn_.get(), sql.c_str(), sql.size()) != 0) {
+        s.assign(Status::RUNTIME_ERROR,
+                 fmt::sprintf("query max_allowed_packet failed, %s",
+                              getLastError(conn_)));
+        return 0;
+    }
+
+    MYSQL_RES* res = mysql_store_result(conn_.get());
+    MYSQL_ROW row = res == nullptr ? nullptr : mysql_fetch_row(res);
+    if (row == nullptr || row[0] == nullptr) {
+        s.assign(Status::RUNTIME_ERROR,
+                 fmt::sprintf("query max_allowed_packet failed, %s",
+                              getLastError(conn_)));
+    } else {
+        maxAllowedPacket_ = strtoull(row[0], nullptr, 10);
+    }
+    if (res != nullptr) {
+        mysql_free_result(res);
+    }
+    return maxAllowedPacket_;
+}
+
+void Connection::trackSql(const std::string& sql) {
+    if (!sessionDirty_ && changesSession(sql)) {
+        sessionDirty_ = true;
+    }
+}
+
 void Connection::initializeHandler() {
     static MysqlLibraryInitializer initializer;
     conn_.assign(mysql_init(nullptr));
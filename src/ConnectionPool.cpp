@@ -0,0 +1,1442 @@
+//
+// Created by m8792 on 2021/1/1.
+//
+
+#include "ConnectionPool.h"
+
+#include <mysql/errmsg.h>
+
+#include <algorithm>
+#include <thread>
+
+namespace db {
+
+namespace {
+
+/**
+ * 当前线程的序号，用来把线程分散到不同的分片
+ * @return
+ */
+size_t currentThreadSeq() {
+    static std::atomic<size_t> nextSeq(0);
+    thread_local size_t seq = nextSeq.fetch_add(1);
+    return seq;
+}
+
+/**
+ * 当前线程是否是连接池内部的线程（维护线程、建立连接的线程）
+ *
+ * 这些线程不持有连接池，不能执行回调，回调里释放的可能是连接池的最后一个引用
+ */
+thread_local bool inPoolThread = false;
+
+/**
+ * 最近一次出错是否是因为连接断开
+ * @param mysql
+ * @return
+ */
+bool connectionLost(MYSQL* mysql) {
+    if (mysql == nullptr) {
+        return false;
+    }
+
+    switch (mysql_errno(mysql)) {
+    case CR_CONNECTION_ERROR:
+    case CR_CONN_HOST_ERROR:
+    case CR_SERVER_GONE_ERROR:
+    case CR_SERVER_LOST:
+    case CR_SERVER_LOST_EXTENDED:
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+}  // namespace
+
+bool Tenant::acquire() {
+    if (maxShare_ == 0) {
+        activeCount_.fetch_add(1);
+        return true;
+    }
+
+    size_t active = activeCount_.load();
+    do {
+        if (active >= maxShare_) {
+            rejectedCount_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+    } while (!activeCount_.compare_exchange_weak(active, active + 1));
+    return true;
+}
+
+ConnectionPool::ConnectionPool(size_t connectionCount,
+                               const PoolOptions& options)
+    : parkCellCount_(0),
+      unusedSlots_(nullptr),
+      idleCount_(0),
+      waiterCount_(0),
+      virtualTime_(0),
+      creations_(0),
+      creationFailures_(0),
+      excessCount_(0),
+      connectionCount_(connectionCount),
+      minIdle_(options.minIdle),
+      maxTotal_(options.maxTotal),
+      idleTimeout_(options.idleTimeoutMs),
+      lastReapTime_(0),
+      healthCheckInterval_(options.healthCheckIntervalMs),
+      pingIdle_(options.pingIdleMs > 0 ? options.pingIdleMs
+                                       : options.healthCheckIntervalMs),
+      autoReconnect_(options.autoReconnect),
+      onRelease_(options.onRelease),
+      onQuery_(options.onQuery),
+      onConnectionLost_(options.onConnectionLost),
+      statementCacheSize_(options.statementCacheSize),
+      preparedStatements_(options.preparedStatements),
+      resetPolicy_(options.resetPolicy),
+      session_(options.session),
+      brokenSlots_(nullptr),
+      warmUpConcurrency_(std::max<size_t>(options.warmUpConcurrency, 1)),
+      readyCount_(0),
+      pendingCount_(0),
+      activeWorkers_(0),
+      stopping_(false),
+      executor_(options.executor),
+      asyncWaiterCount_(0),
+      completed_(nullptr),
+      hasCompleted_(false),
+      asyncRunning_(false),
+      watchdog_(std::make_shared<QueryWatchdog>()) {
+    size_t shardCount = options.shardCount;
+    if (shardCount == 0) {
+        shardCount = std::thread::hardware_concurrency();
+    }
+    if (shardCount == 0) {
+        shardCount = 1;
+    }
+
+    for (size_t i = 0; i < shardCount; ++i) {
+        shards_.emplace_back(new Shard());
+    }
+
+    if (options.stickyCache) {
+        // 线程多于缓存格时，映射到同一格的线程互相替换
+        parkCellCount_ =
+            std::max<size_t>(std::thread::hardware_concurrency(), shardCount) *
+            2;
+        parkCells_.reset(new ParkCell[parkCellCount_]);
+    }
+
+    // 默认租户
+    tenantQueues_.emplace_back(1);
+
+    if (healthCheckInterval_.count() > 0) {
+        maintenanceThread_ =
+            std::thread(&ConnectionPool::maintenanceLoop, this);
+    }
+}
+
+ConnectionPool::~ConnectionPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    maintenanceCond_.notify_all();
+    if (maintenanceThread_.joinable()) {
+        maintenanceThread_.join();
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    workerCond_.wait(lock, [this] { return activeWorkers_ == 0; });
+}
+
+void ConnectionPool::resize(size_t connectionCount) {
+    ConnectionSlot* removed = nullptr;
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    if (connectionCount_ == connectionCount) {
+        return;
+    }
+
+    if (!connectInvoked()) {
+        // 没有配置过，就是没有创建过连接
+        connectionCount_ = connectionCount;
+        return;
+    }
+
+    if (connectionCount < connectionCount_) {
+        size_t count = connectionCount_ - connectionCount;
+        size_t taken = removeIdle(count, removed);
+
+        // 剩下的连接正在被使用，归还的时候再关闭
+        excessCount_.fetch_add(count - taken);
+    } else {
+        size_t count = connectionCount - connectionCount_;
+
+        // 还没有归还的多余连接可以直接留下来
+        size_t excess = excessCount_.load();
+        while (excess > 0) {
+            size_t keep = std::min(excess, count);
+            if (excessCount_.compare_exchange_weak(excess, excess - keep)) {
+                count -= keep;
+                break;
+            }
+        }
+
+        // 补上缺少的连接
+        if (warmUpConcurrency_ > 1) {
+            startWarmUp(count);
+        } else {
+            Status s;
+            readyCount_ += addConnections(count, false, s);
+
+            // 可能有人在等连接，异步等待者的回调交给异步线程
+            dispatchIdle();
+            asyncCond_.notify_one();
+        }
+    }
+    connectionCount_ = connectionCount;
+
+    // 关闭连接要和服务器通信，在锁外进行
+    lock.unlock();
+    closeSlots(removed);
+}
+
+void ConnectionPool::connect(const std::string& host, unsigned short port,
+                             const std::string& user,
+                             const std::string& password,
+                             const std::string& schema, Status& s) {
+    s.clear();
+
+    if (warmUpConcurrency_ > 1) {
+        connectAsync(host, port, user, password, schema, s);
+        if (!s) {
+            return;
+        }
+
+        size_t count = getConnectionCount();
+        s = whenReady(count).get();
+        if (!s) {
+            // 和依次建立连接一样，有失败就全部关闭
+            ConnectionSlot* removed = nullptr;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                size_t taken = removeIdle(readyCount_, removed);
+                excessCount_.fetch_add(readyCount_ - taken);
+                readyCount_ = 0;
+                connectionCount_ = count;
+                config_ = Config();
+            }
+            closeSlots(removed);
+        }
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (connectInvoked()) {
+        s.assign(Status::RUNTIME_ERROR, "connect already invoked");
+        return;
+    }
+
+    config_.host = host;
+    config_.port = port;
+    config_.user = user;
+    config_.password = password;
+    config_.schema = schema;
+    watchdog_->setServer(host, port, user, password);
+
+    readyCount_ = addConnections(connectionCount_, true, s);
+    if (!s) {
+        config_ = Config();
+        return;
+    }
+}
+
+void ConnectionPool::connectAsync(const std::string& host, unsigned short port,
+                                  const std::string& user,
+                                  const std::string& password,
+                                  const std::string& schema, Status& s) {
+    s.clear();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (connectInvoked()) {
+        s.assign(Status::RUNTIME_ERROR, "connect already invoked");
+        return;
+    }
+
+    config_.host = host;
+    config_.port = port;
+    config_.user = user;
+    config_.password = password;
+    config_.schema = schema;
+    watchdog_->setServer(host, port, user, password);
+
+    startWarmUp(connectionCount_);
+}
+
+std::shared_future<Status> ConnectionPool::whenReady(size_t count) {
+    auto promise = std::make_shared<std::promise<Status>>();
+    std::shared_future<Status> future = promise->get_future().share();
+    onReady(count, [promise](const Status& s) { promise->set_value(s); });
+    return future;
+}
+
+void ConnectionPool::onReady(size_t count,
+                             std::function<void(const Status&)> callback) {
+    std::vector<std::function<void()>> fired;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ReadyListener listener;
+        listener.count = count;
+        listener.callback = std::move(callback);
+        readyListeners_.push_back(std::move(listener));
+        collectReadyListeners(fired);
+    }
+
+    for (auto& callback : fired) {
+        callback();
+    }
+}
+
+ConnectionPtr ConnectionPool::getConnection(int timeoutMs, Priority priority) {
+    if (timeoutMs < 0) {
+        return getConnection(std::chrono::steady_clock::time_point::max(),
+                             priority);
+    }
+    return getConnection(std::chrono::steady_clock::now() +
+                             std::chrono::milliseconds(timeoutMs),
+                         priority);
+}
+
+ConnectionPtr ConnectionPool::getConnection(
+    std::chrono::steady_clock::time_point deadline, Priority priority) {
+    return checkout(nullptr, deadline, priority);
+}
+
+ConnectionPtr ConnectionPool::getConnectionUntil(
+    std::chrono::steady_clock::time_point deadline, Priority priority) {
+    ConnectionPtr ptr = checkout(nullptr, deadline, priority);
+    if (ptr.slot_) {
+        ptr->setDeadline(deadline);
+    }
+    return ptr;
+}
+
+ConnectionPtr ConnectionPool::getConnection(const TenantPtr& tenant,
+                                            int timeoutMs, Priority priority) {
+    if (timeoutMs < 0) {
+        return getConnection(
+            tenant, std::chrono::steady_clock::time_point::max(), priority);
+    }
+    return getConnection(tenant,
+                         std::chrono::steady_clock::now() +
+                             std::chrono::milliseconds(timeoutMs),
+                         priority);
+}
+
+ConnectionPtr ConnectionPool::getConnection(
+    const TenantPtr& tenant, std::chrono::steady_clock::time_point deadline,
+    Priority priority) {
+    if (!tenant->acquire()) {
+        return ConnectionPtr();
+    }
+
+    ConnectionPtr ptr = checkout(tenant.get(), deadline, priority);
+    if (!ptr.slot_) {
+        tenant->release();
+    }
+    return ptr;
+}
+
+TenantPtr ConnectionPool::addTenant(const std::string& name,
+                                    const TenantOptions& options) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    TenantPtr tenant(new Tenant(name, options, tenantQueues_.size()));
+    tenantQueues_.emplace_back(tenant->getWeight());
+    tenants_.push_back(tenant);
+    return tenant;
+}
+
+void ConnectionPool::getConnectionAsync(
+    int timeoutMs, std::function<void(ConnectionPtr)> callback,
+    Priority priority) {
+    if (timeoutMs < 0) {
+        getConnectionAsync(std::chrono::steady_clock::time_point::max(),
+                           std::move(callback), priority);
+        return;
+    }
+    getConnectionAsync(std::chrono::steady_clock::now() +
+                           std::chrono::milliseconds(timeoutMs),
+                       std::move(callback), priority);
+}
+
+void ConnectionPool::getConnectionAsync(
+    std::chrono::steady_clock::time_point deadline,
+    std::function<void(ConnectionPtr)> callback, Priority priority) {
+    PoolCounters& counters = localCounters();
+    ConnectionSlot* slot = takeAvailable(counters);
+    auto now = std::chrono::steady_clock::now();
+
+    if (slot == nullptr && deadline > now) {
+        Waiter* waiter = new Waiter(priority, 0);
+        waiter->callback = std::move(callback);
+        waiter->start = now;
+        waiter->deadline = deadline;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            pushWaiter(waiter);
+            ++asyncWaiterCount_;
+            dispatchIdle();
+            growIfNeeded();
+
+            // 超时和内部线程完成的回调由异步线程处理
+            if (!asyncRunning_) {
+                asyncRunning_ = true;
+                std::thread(&ConnectionPool::asyncLoop, this,
+                            shared_from_this())
+                    .detach();
+            } else if (deadline !=
+                       std::chrono::steady_clock::time_point::max()) {
+                asyncCond_.notify_one();
+            }
+        }
+
+        // 可能已经交给了这个等待者
+        runCompleted();
+        return;
+    }
+
+    ConnectionPtr ptr;
+    if (slot != nullptr) {
+        ptr = lease(slot, nullptr, now);
+    } else {
+        counters.timeouts.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (executor_) {
+        auto holder = std::make_shared<ConnectionPtr>(std::move(ptr));
+        executor_([callback, holder] { callback(std::move(*holder)); });
+    } else {
+        callback(std::move(ptr));
+    }
+}
+
+std::future<ConnectionPtr> ConnectionPool::getConnectionAsync(
+    int timeoutMs, Priority priority) {
+    auto promise = std::make_shared<std::promise<ConnectionPtr>>();
+    std::future<ConnectionPtr> future = promise->get_future();
+    getConnectionAsync(
+        timeoutMs,
+        [promise](ConnectionPtr ptr) { promise->set_value(std::move(ptr)); },
+        priority);
+    return future;
+}
+
+void ConnectionPool::killQuery(unsigned long threadId, Status& s) {
+    watchdog_->kill(threadId, s);
+}
+
+void ConnectionPool::connectDedicated(Connection& connection, Status& s) {
+    s.clear();
+
+    Config config;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        config = config_;
+    }
+    if (config.host.empty()) {
+        s.assign(Status::ERROR, "connect not invoked");
+        return;
+    }
+
+    connection.setOption(option::ConnectTimeout(3), s);
+    if (s) {
+        connection.connect(config.host, config.port, config.user,
+                           config.password, config.schema, s);
+    }
+}
+
+ConnectionSlot* ConnectionPool::takeAvailable(PoolCounters& counters) {
+    ConnectionSlot* slot = takeParked();
+    if (slot == nullptr) {
+        slot = takeIdle();
+    }
+
+    if (slot == nullptr) {
+        counters.exhausted.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    counters.waitTime.record(0);
+    if (idleCount_.load() < minIdle_ && connectionCount_.load() < maxTotal_) {
+        // 空闲连接不够了，提前在后台补充
+        std::lock_guard<std::mutex> lock(mutex_);
+        growIfNeeded();
+    }
+    return slot;
+}
+
+ConnectionPtr ConnectionPool::lease(ConnectionSlot* slot, Tenant* tenant,
+                                    std::chrono::steady_clock::time_point now) {
+    localCounters().checkouts.fetch_add(1, std::memory_order_relaxed);
+    slot->checkoutTime = now;
+    slot->tenant = tenant;
+    return ConnectionPtr(shared_from_this(), slot);
+}
+
+void ConnectionPool::runCompleted() {
+    if (!hasCompleted_.load()) {
+        return;
+    }
+    if (inPoolThread) {
+        asyncCond_.notify_one();
+        return;
+    }
+
+    Waiter* waiters;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        waiters = completed_;
+        completed_ = nullptr;
+        hasCompleted_ = false;
+    }
+
+    // 按完成的顺序回调
+    Waiter* ordered = nullptr;
+    while (waiters != nullptr) {
+        Waiter* waiter = waiters;
+        waiters = waiter->next;
+        waiter->next = ordered;
+        ordered = waiter;
+    }
+    while (ordered != nullptr) {
+        Waiter* waiter = ordered;
+        ordered = waiter->next;
+        finishAsync(waiter);
+    }
+}
+
+void ConnectionPool::finishAsync(Waiter* waiter) {
+    auto now = std::chrono::steady_clock::now();
+    PoolCounters& counters = localCounters();
+    counters.waitTime.record(elapsedMicros(waiter->start, now));
+
+    auto holder = std::make_shared<ConnectionPtr>();
+    if (waiter->slot != nullptr) {
+        *holder = lease(waiter->slot, nullptr, now);
+    } else {
+        counters.timeouts.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    std::function<void(ConnectionPtr)> callback = std::move(waiter->callback);
+    delete waiter;
+
+    if (executor_) {
+        executor_([callback, holder] { callback(std::move(*holder)); });
+    } else {
+        callback(std::move(*holder));
+    }
+}
+
+std::chrono::steady_clock::time_point ConnectionPool::expireAsyncWaiters(
+    std::chrono::steady_clock::time_point now) {
+    auto next = std::chrono::steady_clock::time_point::max();
+    if (asyncWaiterCount_ == 0) {
+        return next;
+    }
+
+    for (auto& tenant : tenantQueues_) {
+        for (auto& queue : tenant.queues) {
+            Waiter* waiter = queue.head;
+            while (waiter != nullptr) {
+                Waiter* following = waiter->next;
+                if (waiter->callback) {
+                    if (waiter->deadline <= now) {
+                        removeWaiter(waiter);
+                        --asyncWaiterCount_;
+                        waiter->next = completed_;
+                        completed_ = waiter;
+                        hasCompleted_ = true;
+                    } else {
+                        next = std::min(next, waiter->deadline);
+                    }
+                }
+                waiter = following;
+            }
+        }
+    }
+    return next;
+}
+
+void ConnectionPool::asyncLoop(std::shared_ptr<ConnectionPool> /*self*/) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        auto next = expireAsyncWaiters(std::chrono::steady_clock::now());
+        if (completed_ != nullptr) {
+            lock.unlock();
+            runCompleted();
+            lock.lock();
+            continue;
+        }
+        if (asyncWaiterCount_ == 0) {
+            break;
+        }
+
+        if (next == std::chrono::steady_clock::time_point::max()) {
+            asyncCond_.wait(lock);
+        } else {
+            asyncCond_.wait_until(lock, next);
+        }
+    }
+    asyncRunning_ = false;
+}
+
+ConnectionPtr ConnectionPool::checkout(
+    Tenant* tenant, std::chrono::steady_clock::time_point deadline,
+    Priority priority) {
+    PoolCounters& counters = localCounters();
+    ConnectionSlot* slot = takeAvailable(counters);
+    auto now = std::chrono::steady_clock::now();
+
+    if (slot == nullptr) {
+        if (deadline <= now) {
+            // 不等待也算超时，和等待之后超时一样计数
+            counters.timeouts.fetch_add(1, std::memory_order_relaxed);
+            return ConnectionPtr();
+        }
+
+        auto start = now;
+        Waiter waiter(priority, tenant ? tenant->index_ : 0);
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        // 先排队再检查一次，避免和归还连接的线程错过
+        pushWaiter(&waiter);
+        dispatchIdle();
+        if (waiter.slot == nullptr) {
+            // 新建的连接握手完成后会交给等待者，先归还的连接也一样
+            growIfNeeded();
+        }
+
+        auto ready = [&waiter] { return waiter.slot != nullptr; };
+        if (deadline == std::chrono::steady_clock::time_point::max()) {
+            waiter.cond.wait(lock, ready);
+        } else if (!waiter.cond.wait_until(lock, deadline, ready)) {
+            removeWaiter(&waiter);
+        }
+        slot = waiter.slot;
+        lock.unlock();
+
+        // 排在前面的异步等待者可能拿到了连接
+        runCompleted();
+
+        now = std::chrono::steady_clock::now();
+        counters.waitTime.record(elapsedMicros(start, now));
+        if (slot == nullptr) {
+            counters.timeouts.fetch_add(1, std::memory_order_relaxed);
+            return ConnectionPtr();
+        }
+    }
+
+    return lease(slot, tenant, now);
+}
+
+PoolStats ConnectionPool::getStats() const {
+    PoolStats stats;
+    for (auto& shard : shards_) {
+        stats.collect(shard->counters);
+    }
+    // 各个计数分别读取，可能短暂不一致
+    if (static_cast<int64_t>(stats.busy) < 0) {
+        stats.busy = 0;
+    }
+
+    stats.total = connectionCount_.load();
+    stats.idle = idleCount_.load();
+    stats.waiters = waiterCount_.load();
+    stats.creations = creations_.load(std::memory_order_relaxed);
+    stats.creationFailures = creationFailures_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void ConnectionPool::revokeConnection(ConnectionPtr& ptr) {
+    ConnectionSlot* slot = ptr.slot_;
+    ptr.slot_ = nullptr;
+    if (slot == nullptr) {
+        return;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    PoolCounters& counters = localCounters();
+    counters.returns.fetch_add(1, std::memory_order_relaxed);
+    uint64_t holdTime = elapsedMicros(slot->checkoutTime, now);
+    counters.holdTime.record(holdTime);
+
+    if (slot->tenant != nullptr) {
+        slot->tenant->release();
+        slot->tenant = nullptr;
+    }
+    if (onConnectionLost_ && connectionLost(slot->connection.get())) {
+        onConnectionLost_();
+    }
+    slot->connection.setDeadline(std::chrono::steady_clock::time_point::max());
+
+    if (restoreSession(slot) && !parkSlot(slot, now)) {
+        returnIdle(slot, now);
+    }
+
+    if (onRelease_) {
+        onRelease_(holdTime);
+    }
+}
+
+void ConnectionPool::returnIdle(ConnectionSlot* slot,
+                                std::chrono::steady_clock::time_point now) {
+    slot->idleSince = now;
+
+    if (claimExcess()) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        freeSlot(slot);
+        return;
+    }
+
+    // 只有整个连接池为空时才会有等待者，这时才需要去拿全局的锁
+    if (waiterCount_.load() > 0) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        Waiter* waiter = popWaiter();
+        if (waiter != nullptr) {
+            handOff(waiter, slot);
+            lock.unlock();
+            runCompleted();
+            return;
+        }
+    }
+
+    putIdle(localShardIndex(), slot);
+
+    // 放入分片时可能刚好有人开始排队，再检查一次
+    if (waiterCount_.load() > 0) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            dispatchIdle();
+        }
+        runCompleted();
+    }
+
+    reapIfDue();
+}
+
+void ConnectionPool::pushWaiter(Waiter* waiter) {
+    TenantQueue& tenant = tenantQueues_[waiter->tenant];
+    if (tenant.waiting++ == 0) {
+        // 空闲过的租户不能攒下虚拟时间，从当前时间开始
+        tenant.pass = std::max(tenant.pass, virtualTime_);
+    }
+
+    WaiterQueue& queue = tenant.queues[waiter->priority];
+    waiter->prev = queue.tail;
+    waiter->next = nullptr;
+    if (queue.tail != nullptr) {
+        queue.tail->next = waiter;
+    } else {
+        queue.head = waiter;
+    }
+    queue.tail = waiter;
+    waiterCount_.fetch_add(1);
+}
+
+void ConnectionPool::removeWaiter(Waiter* waiter) {
+    TenantQueue& tenant = tenantQueues_[waiter->tenant];
+    --tenant.waiting;
+
+    WaiterQueue& queue = tenant.queues[waiter->priority];
+    if (waiter->prev != nullptr) {
+        waiter->prev->next = waiter->next;
+    } else {
+        queue.head = waiter->next;
+    }
+    if (waiter->next != nullptr) {
+        waiter->next->prev = waiter->prev;
+    } else {
+        queue.tail = waiter->prev;
+    }
+    waiter->prev = nullptr;
+    waiter->next = nullptr;
+    waiterCount_.fetch_sub(1);
+}
+
+ConnectionPool::Waiter* ConnectionPool::popWaiter() {
+    for (int priority = 0; priority < kPriorityCount; ++priority) {
+        TenantQueue* next = nullptr;
+        for (auto& tenant : tenantQueues_) {
+            if (tenant.queues[priority].head != nullptr &&
+                (next == nullptr || tenant.pass < next->pass)) {
+                next = &tenant;
+            }
+        }
+        if (next == nullptr) {
+            continue;
+        }
+
+        virtualTime_ = next->pass;
+        next->pass += kStride / next->weight;
+
+        Waiter* waiter = next->queues[priority].head;
+        removeWaiter(waiter);
+        return waiter;
+    }
+    return nullptr;
+}
+
+void ConnectionPool::handOff(Waiter* waiter, ConnectionSlot* slot) {
+    waiter->slot = slot;
+    if (waiter->callback) {
+        // 回调在锁外执行
+        --asyncWaiterCount_;
+        waiter->next = completed_;
+        completed_ = waiter;
+        hasCompleted_ = true;
+        return;
+    }
+    waiter->cond.notify_one();
+}
+
+void ConnectionPool::dispatchIdle() {
+    while (waiterCount_.load() > 0) {
+        ConnectionSlot* slot = takeIdle();
+        if (slot == nullptr) {
+            return;
+        }
+        handOff(popWaiter(), slot);
+    }
+}
+
+void ConnectionPool::growIfNeeded() {
+    if (!connectInvoked() || stopping_) {
+        return;
+    }
+
+    size_t total = connectionCount_.load();
+    if (total >= maxTotal_) {
+        return;
+    }
+
+    // 正在建立的连接已经够分给等待者和补足minIdle了
+    size_t wanted = waiterCount_.load();
+    size_t idle = idleCount_.load();
+    if (idle < minIdle_) {
+        wanted += minIdle_ - idle;
+    }
+    if (pendingCount_ >= wanted) {
+        return;
+    }
+
+    connectionCount_ = total + 1;
+    startWarmUp(1);
+}
+
+void ConnectionPool::reapIfDue() {
+    // 有维护线程时由维护线程回收
+    if (idleTimeout_.count() <= 0 || maintenanceThread_.joinable()) {
+        return;
+    }
+
+    // 每半个超时时间最多回收一次，只有一个线程去回收
+    int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::steady_clock::now().time_since_epoch())
+                      .count();
+    int64_t last = lastReapTime_.load();
+    int64_t interval =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(idleTimeout_)
+            .count() /
+        2;
+    if (now - last < interval ||
+        !lastReapTime_.compare_exchange_strong(last, now)) {
+        return;
+    }
+
+    reapIdle();
+}
+
+size_t ConnectionPool::reapIdle() {
+    // 连接数固定时回收的连接不会再补充，连接池会被回收空
+    if (maxTotal_ == 0) {
+        return 0;
+    }
+
+    // 重新连接失败的槽位不可用，关闭之后需要时再新建
+    size_t broken = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        broken = freeBroken();
+        connectionCount_ -= broken;
+    }
+
+    // 缓存格里的连接也要参与回收
+    unparkAll();
+
+    size_t idle = idleCount_.load();
+    if (idle <= minIdle_) {
+        return broken;
+    }
+    size_t budget = idle - minIdle_;
+
+    auto expire = std::chrono::steady_clock::now() - idleTimeout_;
+
+    // 先从分片中摘下来，关闭连接在锁外进行
+    ConnectionSlot* reaped = nullptr;
+    size_t count = 0;
+    for (auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        ConnectionSlot** link = &shard->head;
+        while (*link != nullptr && count < budget) {
+            ConnectionSlot* slot = *link;
+            if (slot->idleSince < expire) {
+                *link = slot->next;
+                slot->next = reaped;
+                reaped = slot;
+                idleCount_.fetch_sub(1);
+                ++count;
+            } else {
+                link = &slot->next;
+            }
+        }
+    }
+
+    if (count == 0) {
+        return broken;
+    }
+
+    for (ConnectionSlot* slot = reaped; slot != nullptr; slot = slot->next) {
+        slot->connection.close();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    while (reaped != nullptr) {
+        ConnectionSlot* slot = reaped;
+        reaped = slot->next;
+        freeSlot(slot);
+    }
+    connectionCount_ -= count;
+    return broken + count;
+}
+
+void ConnectionPool::maintenanceLoop() {
+    inPoolThread = true;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopping_) {
+        maintenanceCond_.wait_for(lock, healthCheckInterval_);
+        if (stopping_) {
+            break;
+        }
+        if (!connectInvoked()) {
+            continue;
+        }
+
+        // 检查连接时不持有mutex_，不影响取用和归还连接
+        lock.unlock();
+        if (idleTimeout_.count() > 0) {
+            reapIdle();
+        }
+        checkIdleConnections();
+        lock.lock();
+
+        growIfNeeded();
+    }
+}
+
+void ConnectionPool::checkIdleConnections() {
+    auto expire = std::chrono::steady_clock::now() - pingIdle_;
+
+    // 缓存格里的连接放回分片，和其他空闲连接一起检查
+    unparkAll();
+
+    // 一次只摘下一个连接检查，其他空闲连接仍然可以被取用
+    ConnectionSlot* broken = nullptr;
+    ConnectionSlot* slot;
+    while ((slot = takeUnchecked(expire)) != nullptr) {
+        if (slot->connection.checkConnected()) {
+            // ping不算使用，保留空闲的时间
+            slot->lastCheck = std::chrono::steady_clock::now();
+            returnIdle(slot, slot->idleSince);
+        } else {
+            slot->next = broken;
+            broken = slot;
+        }
+    }
+
+    {
+        // 上次没有连上的也再试一次
+        std::lock_guard<std::mutex> lock(mutex_);
+        while (brokenSlots_ != nullptr) {
+            slot = brokenSlots_;
+            brokenSlots_ = slot->next;
+            slot->next = broken;
+            broken = slot;
+        }
+    }
+
+    while (broken != nullptr) {
+        slot = broken;
+        broken = slot->next;
+
+        // 正在缩容时直接关闭，不用再重新连接
+        if (claimExcess()) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            freeSlot(slot);
+            continue;
+        }
+
+        slot->connection.close();
+        Status s;
+        createConnection(slot->connection, s);
+        if (s) {
+            returnIdle(slot);
+        } else {
+            std::lock_guard<std::mutex> lock(mutex_);
+            slot->next = brokenSlots_;
+            brokenSlots_ = slot;
+        }
+    }
+}
+
+ConnectionSlot* ConnectionPool::takeUnchecked(
+    std::chrono::steady_clock::time_point expire) {
+    for (auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        ConnectionSlot** link = &shard->head;
+        while (*link != nullptr) {
+            ConnectionSlot* slot = *link;
+            if (slot->idleSince < expire && slot->lastCheck < expire) {
+                *link = slot->next;
+                slot->next = nullptr;
+                idleCount_.fetch_sub(1);
+                return slot;
+            }
+            link = &slot->next;
+        }
+    }
+    return nullptr;
+}
+
+size_t ConnectionPool::freeBroken() {
+    size_t count = 0;
+    while (brokenSlots_ != nullptr) {
+        ConnectionSlot* slot = brokenSlots_;
+        brokenSlots_ = slot->next;
+        freeSlot(slot);
+        ++count;
+    }
+    return count;
+}
+
+void ConnectionPool::startWarmUp(size_t count) {
+    if (count == 0) {
+        return;
+    }
+
+    pendingCount_ += count;
+
+    auto remaining = std::make_shared<std::atomic<size_t>>(count);
+    size_t workerCount = std::min(warmUpConcurrency_, count);
+    for (size_t i = 0; i < workerCount; ++i) {
+        ++activeWorkers_;
+        std::thread(&ConnectionPool::warmUpWorker, this, remaining).detach();
+    }
+}
+
+void ConnectionPool::warmUpWorker(
+    std::shared_ptr<std::atomic<size_t>> remaining) {
+    inPoolThread = true;
+    std::unique_lock<std::mutex> lock(mutex_, std::defer_lock);
+
+    while (true) {
+        size_t left = remaining->load();
+        while (left > 0 &&
+               !remaining->compare_exchange_weak(left, left - 1)) {
+        }
+        if (left == 0) {
+            break;
+        }
+
+        lock.lock();
+        if (stopping_) {
+            // 连接池正在析构，剩下的连接不再建立
+            pendingCount_ -= 1 + remaining->exchange(0);
+            lock.unlock();
+            break;
+        }
+        ConnectionSlot* slot = allocateSlot(left);
+        lock.unlock();
+
+        // 握手在锁外进行，完成后马上可以被取用
+        Status s;
+        createConnection(slot->connection, s);
+        if (s) {
+            returnIdle(slot);
+        }
+
+        std::vector<std::function<void()>> fired;
+        lock.lock();
+        if (s) {
+            ++readyCount_;
+        } else {
+            freeSlot(slot);
+            lastError_ = s;
+            --connectionCount_;
+        }
+        --pendingCount_;
+        collectReadyListeners(fired);
+        lock.unlock();
+
+        for (auto& callback : fired) {
+            callback();
+        }
+    }
+
+    lock.lock();
+    --activeWorkers_;
+    workerCond_.notify_all();
+}
+
+void ConnectionPool::collectReadyListeners(
+    std::vector<std::function<void()>>& fired) {
+    auto it = readyListeners_.begin();
+    while (it != readyListeners_.end()) {
+        if (readyCount_ >= it->count) {
+            fired.push_back(std::bind(it->callback, Status()));
+        } else if (pendingCount_ == 0) {
+            // 没有正在建立的连接了，不可能再就绪
+            Status s(Status::RUNTIME_ERROR,
+                     fmt::sprintf("only %d connections ready, %s",
+                                  readyCount_, lastError_.message()));
+            fired.push_back(std::bind(it->callback, s));
+        } else {
+            ++it;
+            continue;
+        }
+        it = readyListeners_.erase(it);
+    }
+}
+
+void ConnectionPool::createConnection(Connection& connection, Status& s) {
+    s.clear();
+
+    if (connection.get() == nullptr) {
+        // 槽位中的连接被关闭过，需要重新初始化
+        connection = Connection();
+    }
+
+    connection.setOption(option::AutoReconnect(autoReconnect_), s);
+    if (s) {
+        connection.setOption(option::ConnectTimeout(3), s);
+    }
+    if (s) {
+        connection.setSessionOptions(session_);
+        connection.setWatchdog(watchdog_);
+        connection.setQueryObserver(onQuery_);
+        connection.connect(config_.host, config_.port, config_.user,
+                           config_.password, config_.schema, s);
+    }
+
+    if (s) {
+        creations_.fetch_add(1, std::memory_order_relaxed);
+        prepareStatements(connection);
+    } else {
+        creationFailures_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void ConnectionPool::prepareStatements(Connection& connection) {
+    if (statementCacheSize_ == 0) {
+        return;
+    }
+
+    // 新建立的连接上没有取出的stmt，不会失败
+    Status s;
+    connection.setStatementCacheSize(statementCacheSize_, s);
+    for (auto& sql : preparedStatements_) {
+        // 关闭之后留在缓存里
+        connection.prepareStatement(sql, s);
+    }
+}
+
+bool ConnectionPool::restoreSession(ConnectionSlot* slot) {
+    Connection& connection = slot->connection;
+    Status s;
+    if (connection.streaming()) {
+        // 没有读完的结果集还在连接上，下一个使用者执行sql会出错
+        s.assign(Status::ERROR, "streaming result set not finished");
+    } else if (resetPolicy_ == PoolOptions::RESET_NONE ||
+               (resetPolicy_ == PoolOptions::RESET_RESTORE &&
+                connection.sessionClean())) {
+        return true;
+    } else if (resetPolicy_ == PoolOptions::RESET_ALWAYS) {
+        connection.resetConnection(s);
+    } else {
+        connection.restoreSession(s);
+    }
+    if (s) {
+        return true;
+    }
+
+    // 会话状态不确定，不能再给别人用
+    connection.close();
+    createConnection(connection, s);
+    if (s) {
+        return true;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    freeSlot(slot);
+    --connectionCount_;
+    growIfNeeded();
+    return false;
+}
+
+size_t ConnectionPool::localShardIndex() const {
+    if (shards_.size() == 1) {
+        return 0;
+    }
+    return currentThreadSeq() % shards_.size();
+}
+
+ConnectionSlot* ConnectionPool::takeParked() {
+    if (parkCellCount_ == 0) {
+        return nullptr;
+    }
+
+    ParkCell& cell = parkCells_[currentThreadSeq() % parkCellCount_];
+    if (cell.slot.load(std::memory_order_relaxed) == nullptr) {
+        return nullptr;
+    }
+    ConnectionSlot* slot = cell.slot.exchange(nullptr);
+    if (slot != nullptr) {
+        idleCount_.fetch_sub(1);
+    }
+    return slot;
+}
+
+bool ConnectionPool::parkSlot(ConnectionSlot* slot,
+                              std::chrono::steady_clock::time_point now) {
+    // 有人在等连接或者正在缩容时，走正常的归还流程
+    if (parkCellCount_ == 0 || waiterCount_.load() > 0 ||
+        excessCount_.load() > 0) {
+        return false;
+    }
+
+    // 缓存的连接也算空闲连接，先计数再放入，取走时计数不会减到负数
+    slot->idleSince = now;
+    idleCount_.fetch_add(1);
+    ParkCell& cell = parkCells_[currentThreadSeq() % parkCellCount_];
+    ConnectionSlot* previous = cell.slot.exchange(slot);
+    if (previous != nullptr) {
+        // 被同一格的其他线程替换下来的连接
+        idleCount_.fetch_sub(1);
+        returnIdle(previous, previous->idleSince);
+    }
+
+    // 缓存之后可能刚好有人开始排队，再检查一次
+    if (waiterCount_.load() > 0) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            dispatchIdle();
+        }
+        runCompleted();
+    }
+    return true;
+}
+
+ConnectionSlot* ConnectionPool::reclaimParked() {
+    for (size_t i = 0; i < parkCellCount_; ++i) {
+        ParkCell& cell = parkCells_[i];
+        if (cell.slot.load(std::memory_order_relaxed) == nullptr) {
+            continue;
+        }
+        ConnectionSlot* slot = cell.slot.exchange(nullptr);
+        if (slot != nullptr) {
+            idleCount_.fetch_sub(1);
+            return slot;
+        }
+    }
+    return nullptr;
+}
+
+void ConnectionPool::unparkAll() {
+    for (size_t i = 0; i < parkCellCount_; ++i) {
+        ParkCell& cell = parkCells_[i];
+        if (cell.slot.load(std::memory_order_relaxed) == nullptr) {
+            continue;
+        }
+        ConnectionSlot* slot = cell.slot.exchange(nullptr);
+        if (slot != nullptr) {
+            // 保留idleSince，放回分片之后按空闲时间回收和检查
+            idleCount_.fetch_sub(1);
+            putIdle(i % shards_.size(), slot);
+        }
+    }
+}
+
+ConnectionSlot* ConnectionPool::takeIdle() {
+    if (idleCount_.load() == 0) {
+        return reclaimParked();
+    }
+
+    size_t shardCount = shards_.size();
+    size_t local = localShardIndex();
+    for (size_t i = 0; i < shardCount; ++i) {
+        Shard& shard = *shards_[(local + i) % shardCount];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        ConnectionSlot* slot = shard.head;
+        if (slot != nullptr) {
+            shard.head = slot->next;
+            slot->next = nullptr;
+            idleCount_.fetch_sub(1);
+            return slot;
+        }
+    }
+    return reclaimParked();
+}
+
+void ConnectionPool::putIdle(size_t index, ConnectionSlot* slot) {
+    Shard& shard = *shards_[index];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    slot->next = shard.head;
+    shard.head = slot;
+    idleCount_.fetch_add(1);
+}
+
+size_t ConnectionPool::removeIdle(size_t count, ConnectionSlot*& removed) {
+    size_t taken = 0;
+    while (taken < count && brokenSlots_ != nullptr) {
+        ConnectionSlot* slot = brokenSlots_;
+        brokenSlots_ = slot->next;
+        slot->next = removed;
+        removed = slot;
+        ++taken;
+    }
+
+    while (taken < count) {
+        ConnectionSlot* slot = reclaimParked();
+        if (slot == nullptr) {
+            break;
+        }
+        slot->next = removed;
+        removed = slot;
+        ++taken;
+    }
+
+    for (auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        while (taken < count && shard->head != nullptr) {
+            ConnectionSlot* slot = shard->head;
+            shard->head = slot->next;
+            idleCount_.fetch_sub(1);
+            slot->next = removed;
+            removed = slot;
+            ++taken;
+        }
+    }
+    return taken;
+}
+
+void ConnectionPool::closeSlots(ConnectionSlot* slots) {
+    if (slots == nullptr) {
+        return;
+    }
+
+    for (ConnectionSlot* slot = slots; slot != nullptr; slot = slot->next) {
+        slot->connection.close();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    while (slots != nullptr) {
+        ConnectionSlot* slot = slots;
+        slots = slot->next;
+        freeSlot(slot);
+    }
+}
+
+size_t ConnectionPool::addConnections(size_t count, bool allOrNothing,
+                                      Status& s) {
+    s.clear();
+
+    // 先全部创建好，再放入分片
+    ConnectionSlot* created = nullptr;
+    size_t succeed = 0;
+    for (size_t i = 0; i < count; ++i) {
+        ConnectionSlot* slot = allocateSlot(count - i);
+
+        Status status;
+        createConnection(slot->connection, status);
+        if (status) {
+            ++succeed;
+        } else if (s) {
+            s = status;
+        }
+
+        slot->next = created;
+        created = slot;
+
+        if (!status && allOrNothing) {
+            break;
+        }
+    }
+
+    if (!s && allOrNothing) {
+        while (created != nullptr) {
+            ConnectionSlot* slot = created;
+            created = slot->next;
+            freeSlot(slot);
+        }
+        return 0;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    size_t index = 0;
+    while (created != nullptr) {
+        ConnectionSlot* slot = created;
+        created = slot->next;
+        slot->idleSince = now;
+        putIdle(index++ % shards_.size(), slot);
+    }
+    return succeed;
+}
+
+ConnectionSlot* ConnectionPool::allocateSlot(size_t reserve) {
+    if (unusedSlots_ == nullptr) {
+        size_t count = std::max<size_t>(reserve, 1);
+        std::unique_ptr<ConnectionSlot[]> chunk(new ConnectionSlot[count]);
+        for (size_t i = 0; i < count; ++i) {
+            chunk[i].next = unusedSlots_;
+            unusedSlots_ = &chunk[i];
+        }
+        chunks_.emplace_back(std::move(chunk));
+    }
+
+    ConnectionSlot* slot = unusedSlots_;
+    unusedSlots_ = slot->next;
+    slot->next = nullptr;
+    return slot;
+}
+
+void ConnectionPool::freeSlot(ConnectionSlot* slot) {
+    slot->connection.close();
+    slot->next = unusedSlots_;
+    unusedSlots_ = slot;
+}
+
+bool ConnectionPool::claimExcess() {
+    size_t excess = excessCount_.load();
+    while (excess > 0) {
+        if (excessCount_.compare_exchange_weak(excess, excess - 1)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+}  // namespace db
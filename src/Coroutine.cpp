@@ -0,0 +1,50 @@
+//
+// Created by m8792 on 2021/1/10.
+//
+
+#include "Coroutine.h"
+
+#if defined(MYSQL_CONNECTOR_WITH_COROUTINE) && __cplusplus >= 202002L
+
+namespace db {
+
+namespace coro {
+
+void Scheduler::post(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tasks_.push_back(std::move(task));
+    }
+    cond_.notify_one();
+}
+
+void Scheduler::run() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+            if (tasks_.empty()) {
+                stopping_ = false;
+                return;
+            }
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+        task();
+    }
+}
+
+void Scheduler::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cond_.notify_all();
+}
+
+}  // namespace coro
+
+}  // namespace db
+
+#endif
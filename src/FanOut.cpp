@@ -0,0 +1,290 @@
+//
+// Created by m8792 on 2021/1/11.
+//
+
+#include "FanOut.h"
+
+namespace db {
+
+FanOutCall::FanOutCall(std::vector<FanOutTask> tasks,
+                       std::chrono::steady_clock::time_point deadline)
+    : tasks_(std::move(tasks)),
+      deadline_(deadline),
+      states_(tasks_.size(), PENDING),
+      threadIds_(tasks_.size(), 0),
+      killing_(tasks_.size(), false),
+      taken_(0),
+      cancelled_(false) {}
+
+bool FanOutCall::next(FanOutResult& result) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (ready_.empty()) {
+        if (taken_ == tasks_.size()) {
+            return false;
+        }
+
+        if (deadline_ == std::chrono::steady_clock::time_point::max()) {
+            cond_.wait(lock);
+        } else if (cond_.wait_until(lock, deadline_) ==
+                       std::cv_status::timeout &&
+                   ready_.empty()) {
+            std::vector<Kill> kills =
+                cancelLocked(Status(Status::ERROR, "deadline exceeded"));
+            lock.unlock();
+            kill(kills);
+            lock.lock();
+        }
+    }
+
+    result = std::move(ready_.front());
+    ready_.pop_front();
+    ++taken_;
+    return true;
+}
+
+void FanOutCall::cancel() {
+    std::vector<Kill> kills;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        kills = cancelLocked(Status(Status::ERROR, "cancelled"));
+    }
+    kill(kills);
+}
+
+void FanOutCall::run(size_t index) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (states_[index] != PENDING) {
+            return;
+        }
+        states_[index] = RUNNING;
+    }
+
+    FanOutResult result;
+    result.index = index;
+
+    const FanOutTask& task = tasks_[index];
+    // 连接上执行的sql也使用deadline_，超时由连接池的QueryWatchdog中断
+    ConnectionPtr connection = task.pool->getConnectionUntil(deadline_);
+    if (!connection) {
+        result.status.assign(Status::RUNTIME_ERROR, "get connection timeout");
+        finish(std::move(result));
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (states_[index] != RUNNING) {
+            return;
+        }
+        threadIds_[index] = mysql_thread_id(connection->get());
+    }
+
+    execute(task, connection, result);
+    finish(std::move(result));
+}
+
+void FanOutCall::execute(const FanOutTask& task, ConnectionPtr& connection,
+                         FanOutResult& result) {
+    Status& s = result.status;
+    if (!task.bind) {
+        Statement statement(*connection);
+        result.resultSet = statement.executeQuery(task.sql, deadline_, s);
+
+        // 没有结果集的sql执行成功时，executeQuery因为取不到结果集报错
+        MYSQL* mysql = connection->get();
+        if (s.code() == Status::RUNTIME_ERROR && mysql_errno(mysql) == 0 &&
+            mysql_field_count(mysql) == 0) {
+            s.clear();
+            result.affectedRows = statement.getAffectedRowCount(s);
+        }
+        return;
+    }
+
+    PreparedStatement statement = connection->prepareStatement(task.sql, s);
+    if (s) {
+        task.bind(statement, s);
+    }
+    // prepare期间被取消时，KILL QUERY不会中断之后的查询
+    if (s && cancelled(result.index)) {
+        s.assign(Status::ERROR, "cancelled");
+    }
+    if (s) {
+        statement.execute(deadline_, s);
+    }
+    if (!s) {
+        return;
+    }
+
+    if (statement.getFieldCount() == 0) {
+        result.affectedRows = statement.getAffectedRowCount();
+        return;
+    }
+
+    PreparedResultSet resultSet = statement.getResultSet(deadline_, s);
+    if (!s) {
+        return;
+    }
+
+    // 复制出来，结果不依赖stmt和连接
+    result.shape = resultSet.getMetaData().getShape();
+    size_t fieldCount = resultSet.getFieldCount();
+    while (resultSet.next()) {
+        std::vector<Value> row;
+        row.reserve(fieldCount);
+        for (size_t i = 0; i < fieldCount; ++i) {
+            row.push_back(resultSet.getValue(i));
+        }
+        result.rows.push_back(std::move(row));
+    }
+}
+
+bool FanOutCall::cancelled(size_t index) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return states_[index] != RUNNING;
+}
+
+void FanOutCall::finish(FanOutResult result) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    // 中断结束之前不归还连接，KILL QUERY不会中断其他人的查询
+    killedCond_.wait(lock, [&] { return !killing_[result.index]; });
+    threadIds_[result.index] = 0;
+    if (states_[result.index] == DONE) {
+        return;
+    }
+
+    states_[result.index] = DONE;
+    ready_.push_back(std::move(result));
+    cond_.notify_all();
+}
+
+std::vector<FanOutCall::Kill> FanOutCall::cancelLocked(const Status& reason) {
+    std::vector<Kill> kills;
+    if (cancelled_) {
+        return kills;
+    }
+    cancelled_ = true;
+
+    for (size_t i = 0; i < tasks_.size(); ++i) {
+        if (states_[i] == DONE) {
+            continue;
+        }
+
+        if (threadIds_[i] != 0) {
+            killing_[i] = true;
+            kills.push_back(Kill(i, threadIds_[i]));
+        }
+
+        states_[i] = DONE;
+        FanOutResult result;
+        result.index = i;
+        result.status = reason;
+        ready_.push_back(std::move(result));
+    }
+    cond_.notify_all();
+    return kills;
+}
+
+void FanOutCall::kill(const std::vector<Kill>& kills) {
+    if (kills.empty()) {
+        return;
+    }
+
+    for (const Kill& kill : kills) {
+        // 中断失败时，查询结束之前占用着FanOut的线程
+        Status s;
+        tasks_[kill.first].pool->killQuery(kill.second, s);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const Kill& kill : kills) {
+            killing_[kill.first] = false;
+        }
+    }
+    killedCond_.notify_all();
+}
+
+FanOut::FanOut(size_t threadCount) : stopping_(false) {
+    for (size_t i = 0; i < threadCount; ++i) {
+        workers_.emplace_back(&FanOut::workerLoop, this);
+    }
+}
+
+FanOut::~FanOut() {
+    std::deque<Job> jobs;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+        jobs.swap(jobs_);
+    }
+    cond_.notify_all();
+
+    for (auto& job : jobs) {
+        FanOutCallPtr call = job.call.lock();
+        if (!call) {
+            continue;
+        }
+        std::vector<FanOutCall::Kill> kills;
+        {
+            std::lock_guard<std::mutex> lock(call->mutex_);
+            kills =
+                call->cancelLocked(Status(Status::ERROR, "fan out stopped"));
+        }
+        call->kill(kills);
+    }
+
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+FanOutCallPtr FanOut::submit(std::vector<FanOutTask> tasks, int timeoutMs) {
+    if (timeoutMs < 0) {
+        return submit(std::move(tasks),
+                      std::chrono::steady_clock::time_point::max());
+    }
+    return submit(std::move(tasks), std::chrono::steady_clock::now() +
+                                        std::chrono::milliseconds(timeoutMs));
+}
+
+FanOutCallPtr FanOut::submit(std::vector<FanOutTask> tasks,
+                             std::chrono::steady_clock::time_point deadline) {
+    FanOutCallPtr call(new FanOutCall(std::move(tasks), deadline));
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_) {
+            // 还没有开始执行，不需要中断
+            std::lock_guard<std::mutex> callLock(call->mutex_);
+            call->cancelLocked(Status(Status::ERROR, "fan out stopped"));
+            return call;
+        }
+        for (size_t i = 0; i < call->size(); ++i) {
+            jobs_.push_back(Job{call, i});
+        }
+    }
+    cond_.notify_all();
+    return call;
+}
+
+void FanOut::workerLoop() {
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait(lock, [this] { return stopping_ || !jobs_.empty(); });
+            if (jobs_.empty()) {
+                return;
+            }
+            job = std::move(jobs_.front());
+            jobs_.pop_front();
+        }
+        // 已经被放弃的查询不再执行
+        FanOutCallPtr call = job.call.lock();
+        if (call) {
+            call->run(job.index);
+        }
+    }
+}
+
+}  // namespace db
@@ -0,0 +1,291 @@
+//
+// Created by m8792 on 2021/1/6.
+//
+
+#include "LoadBalancedPool.h"
+
+#include <algorithm>
+#include <random>
+
+namespace db {
+
+namespace {
+
+/**
+ * EWMA中新样本的权重为 1/kEwmaWeight
+ */
+const uint64_t kEwmaWeight = 8;
+
+std::minstd_rand& localRandom() {
+    thread_local std::minstd_rand random(std::random_device{}());
+    return random;
+}
+
+}  // namespace
+
+void LoadBalancedPool::Load::record(uint64_t elapsed) {
+    uint64_t old = latency.load(std::memory_order_relaxed);
+    uint64_t next;
+    do {
+        next = old == 0 ? elapsed
+                        : old - old / kEwmaWeight + elapsed / kEwmaWeight;
+    } while (!latency.compare_exchange_weak(old, next,
+                                            std::memory_order_relaxed));
+}
+
+LoadBalancedPool::LoadBalancedPool(const std::vector<Endpoint>& endpoints,
+                                   const LoadBalancerOptions& options)
+    : options_(options), connected_(false), stopping_(false) {
+    for (auto& endpoint : endpoints) {
+        hosts_.emplace_back(new Host(endpoint));
+    }
+}
+
+LoadBalancedPool::~LoadBalancedPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cond_.notify_all();
+    if (checkThread_.joinable()) {
+        checkThread_.join();
+    }
+}
+
+void LoadBalancedPool::connect(const std::string& user,
+                               const std::string& password,
+                               const std::string& schema, Status& s) {
+    s.clear();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (connected_) {
+            s.assign(Status::RUNTIME_ERROR, "connect already invoked");
+            return;
+        }
+        connected_ = true;
+        user_ = user;
+        password_ = password;
+        schema_ = schema;
+    }
+
+    size_t connectedCount = 0;
+    std::string lastError;
+    for (auto& host : hosts_) {
+        Status status;
+        ConnectionPoolPtr pool = createPool(*host, status);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto now = std::chrono::steady_clock::now();
+        if (status) {
+            std::atomic_store(&host->pool, pool);
+            admit(*host, pool);
+            ++connectedCount;
+        } else {
+            eject(*host, now);
+            lastError = status.message();
+        }
+    }
+
+    if (options_.checkIntervalMs > 0) {
+        checkThread_ = std::thread(&LoadBalancedPool::checkLoop, this);
+    }
+
+    if (connectedCount == 0 && !hosts_.empty()) {
+        s.assign(Status::RUNTIME_ERROR,
+                 fmt::sprintf("failed to connect to all hosts, %s", lastError));
+    }
+}
+
+ConnectionPtr LoadBalancedPool::getConnection(int timeoutMs) {
+    Host* host = pickHost();
+    if (host == nullptr) {
+        return ConnectionPtr();
+    }
+
+    ConnectionPoolPtr pool = std::atomic_load(&host->pool);
+    host->load->outstanding.fetch_add(1);
+    ConnectionPtr ptr = pool->getConnection(timeoutMs);
+    if (ptr.get() == nullptr) {
+        // 没有取到连接，不会触发onRelease
+        host->load->outstanding.fetch_sub(1);
+    } else if (!ptr) {
+        // 取到的连接已经断开
+        host->load->errors.fetch_add(1);
+    }
+    return ptr;
+}
+
+void LoadBalancedPool::markFailure(const ConnectionPtr& ptr) {
+    for (auto& host : hosts_) {
+        ConnectionPoolPtr pool = std::atomic_load(&host->pool);
+        if (pool && pool.get() == ptr.getPool()) {
+            host->load->errors.fetch_add(1);
+            return;
+        }
+    }
+}
+
+void LoadBalancedPool::checkHosts() {
+    for (auto& host : hosts_) {
+        auto now = std::chrono::steady_clock::now();
+        ConnectionPoolPtr pool;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!connected_ || stopping_) {
+                return;
+            }
+
+            pool = std::atomic_load(&host->pool);
+            if (!host->ejected) {
+                uint64_t failures = pool->getCreationFailureCount();
+                uint64_t errors = host->load->errors.load();
+                if (failures > host->failures || errors > host->errors) {
+                    host->failures = failures;
+                    host->errors = errors;
+                    eject(*host, now);
+                } else if (host->backoff.count() > 0 &&
+                           now >= host->ejectedUntil + host->backoff) {
+                    // 恢复之后稳定运行了一段时间，重新从最短的时长开始摘除
+                    host->backoff = std::chrono::milliseconds(0);
+                }
+                continue;
+            }
+
+            if (now < host->ejectedUntil) {
+                continue;
+            }
+        }
+
+        // 连接池还在时先试着建立一个连接，成功了才恢复分配；
+        // 从来没有连接成功过的重新建立连接池
+        Status s;
+        bool recovered = false;
+        if (pool) {
+            recovered = probe(*host);
+        } else {
+            pool = createPool(*host, s);
+            recovered = bool(s);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        now = std::chrono::steady_clock::now();
+        if (recovered) {
+            std::atomic_store(&host->pool, pool);
+            host->ejectedUntil = now;
+            admit(*host, pool);
+        } else {
+            eject(*host, now);
+        }
+    }
+}
+
+bool LoadBalancedPool::probe(const Host& host) {
+    Connection connection;
+    Status s;
+    connection.setOption(option::ConnectTimeout(3), s);
+    if (s) {
+        connection.connect(host.endpoint.host, host.endpoint.port, user_,
+                           password_, schema_, s);
+    }
+    return bool(s);
+}
+
+void LoadBalancedPool::admit(Host& host, const ConnectionPoolPtr& pool) {
+    host.failures = pool->getCreationFailureCount();
+    host.errors = host.load->errors.load();
+    host.connected = true;
+    host.ejected = false;
+}
+
+ConnectionPoolPtr LoadBalancedPool::createPool(Host& host, Status& s) {
+    PoolOptions options = options_.poolOptions;
+    std::shared_ptr<Load> load = host.load;
+    options.onRelease = [load](uint64_t) { load->outstanding.fetch_sub(1); };
+    options.onQuery = [load](uint64_t elapsed) { load->record(elapsed); };
+    options.onConnectionLost = [load] { load->errors.fetch_add(1); };
+
+    ConnectionPoolPtr pool =
+        std::make_shared<ConnectionPool>(options_.connectionsPerHost, options);
+    pool->connect(host.endpoint.host, host.endpoint.port, user_, password_,
+                  schema_, s);
+    if (!s) {
+        return nullptr;
+    }
+    return pool;
+}
+
+void LoadBalancedPool::eject(Host& host,
+                             std::chrono::steady_clock::time_point now) {
+    if (host.backoff.count() == 0) {
+        host.backoff = std::chrono::milliseconds(options_.ejectBaseMs);
+    } else {
+        host.backoff = std::min(host.backoff * 2,
+                                std::chrono::milliseconds(options_.ejectMaxMs));
+    }
+    host.ejectedUntil = now + host.backoff;
+    host.ejected = true;
+}
+
+LoadBalancedPool::Host* LoadBalancedPool::pickHost() {
+    std::minstd_rand& random = localRandom();
+
+    // 从可用的服务器中随机选两个
+    Host* choices[2] = {nullptr, nullptr};
+    size_t count = 0;
+    for (auto& host : hosts_) {
+        if (host->ejected.load()) {
+            continue;
+        }
+
+        ++count;
+        if (count <= 2) {
+            choices[count - 1] = host.get();
+        } else {
+            size_t index = random() % count;
+            if (index < 2) {
+                choices[index] = host.get();
+            }
+        }
+    }
+
+    if (count == 0) {
+        // 所有服务器都被摘除时，仍然使用有连接池的服务器，而不是全部拒绝
+        for (auto& host : hosts_) {
+            if (!host->connected.load()) {
+                continue;
+            }
+            if (choices[0] == nullptr || cost(*host) < cost(*choices[0])) {
+                choices[0] = host.get();
+            }
+        }
+        return choices[0];
+    }
+
+    if (count == 1) {
+        return choices[0];
+    }
+    return cost(*choices[0]) <= cost(*choices[1]) ? choices[0] : choices[1];
+}
+
+uint64_t LoadBalancedPool::cost(const Host& host) {
+    return (host.load->outstanding.load() + 1) *
+           (host.load->latency.load(std::memory_order_relaxed) + 1);
+}
+
+void LoadBalancedPool::checkLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopping_) {
+        cond_.wait_for(lock,
+                       std::chrono::milliseconds(options_.checkIntervalMs),
+                       [this] { return stopping_; });
+        if (stopping_) {
+            break;
+        }
+
+        lock.unlock();
+        checkHosts();
+        lock.lock();
+    }
+}
+
+}  // namespace db
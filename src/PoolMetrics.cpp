@@ -0,0 +1,191 @@
+//
+// Created by m8792 on 2021/1/3.
+//
+
+#include "PoolMetrics.h"
+
+#include <fmt/printf.h>
+
+namespace db {
+
+const int Histogram::kSubBucketBits;
+const uint64_t Histogram::kSubBucketCount;
+const int Histogram::kMaxBits;
+const size_t Histogram::kBucketCount;
+
+void HistogramSnapshot::merge(const HistogramSnapshot& other) {
+    if (counts.size() < other.counts.size()) {
+        counts.resize(other.counts.size(), 0);
+    }
+    for (size_t i = 0; i < other.counts.size(); ++i) {
+        counts[i] += other.counts[i];
+    }
+    count += other.count;
+    sum += other.sum;
+}
+
+uint64_t HistogramSnapshot::percentile(double quantile) const {
+    if (count == 0) {
+        return 0;
+    }
+
+    uint64_t rank = static_cast<uint64_t>(quantile * count);
+    if (rank >= count) {
+        rank = count - 1;
+    }
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts.size(); ++i) {
+        seen += counts[i];
+        if (seen > rank) {
+            return Histogram::bucketUpperBound(i);
+        }
+    }
+    return Histogram::bucketUpperBound(counts.size() - 1);
+}
+
+void Histogram::collect(HistogramSnapshot& snapshot) const {
+    if (snapshot.counts.size() < kBucketCount) {
+        snapshot.counts.resize(kBucketCount, 0);
+    }
+    for (size_t i = 0; i < kBucketCount; ++i) {
+        snapshot.counts[i] += counts_[i].load(std::memory_order_relaxed);
+    }
+    snapshot.count += count_.load(std::memory_order_relaxed);
+    snapshot.sum += sum_.load(std::memory_order_relaxed);
+}
+
+size_t Histogram::bucketIndex(uint64_t value) {
+    if (value < kSubBucketCount) {
+        return value;
+    }
+
+    int magnitude = 63 - __builtin_clzll(value);
+    if (magnitude >= kMaxBits) {
+        return kBucketCount - 1;
+    }
+
+    // 最高位之后的kSubBucketBits位决定子桶
+    int shift = magnitude - kSubBucketBits;
+    size_t sub = (value >> shift) & (kSubBucketCount - 1);
+    return (shift + 1) * kSubBucketCount + sub;
+}
+
+uint64_t Histogram::bucketUpperBound(size_t index) {
+    if (index < kSubBucketCount) {
+        return index;
+    }
+
+    int shift = index / kSubBucketCount - 1;
+    uint64_t sub = index % kSubBucketCount;
+    return ((kSubBucketCount + sub + 1) << shift) - 1;
+}
+
+void PoolStats::collect(const PoolCounters& counters) {
+    uint64_t out = counters.checkouts.load(std::memory_order_relaxed);
+    uint64_t back = counters.returns.load(std::memory_order_relaxed);
+    checkouts += out;
+    // 取出和归还可能发生在不同的分片，汇总之后再相减
+    busy += out;
+    busy -= back;
+    exhausted += counters.exhausted.load(std::memory_order_relaxed);
+    timeouts += counters.timeouts.load(std::memory_order_relaxed);
+    counters.waitTime.collect(waitTime);
+    counters.holdTime.collect(holdTime);
+}
+
+namespace {
+
+/**
+ * 拼接标签
+ * @param labels    附加的标签
+ * @param extra     指标自己的标签
+ * @return          {a="b",c="d"}，都为空时返回空字符串
+ */
+std::string formatLabels(const std::string& labels, const std::string& extra) {
+    if (labels.empty() && extra.empty()) {
+        return "";
+    }
+    if (labels.empty()) {
+        return "{" + extra + "}";
+    }
+    if (extra.empty()) {
+        return "{" + labels + "}";
+    }
+    return "{" + labels + "," + extra + "}";
+}
+
+void appendMetric(std::string& out, const std::string& name,
+                  const std::string& type, const std::string& help) {
+    out += fmt::sprintf("# HELP %s %s\n", name, help);
+    out += fmt::sprintf("# TYPE %s %s\n", name, type);
+}
+
+void appendSummary(std::string& out, const std::string& name,
+                   const std::string& help, const std::string& labels,
+                   const HistogramSnapshot& snapshot) {
+    static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+    appendMetric(out, name, "summary", help);
+    for (double quantile : quantiles) {
+        out += fmt::sprintf(
+            "%s%s %.6f\n", name,
+            formatLabels(labels, fmt::sprintf("quantile=\"%g\"", quantile)),
+            snapshot.percentile(quantile) / 1e6);
+    }
+    out += fmt::sprintf("%s_sum%s %.6f\n", name, formatLabels(labels, ""),
+                        snapshot.sum / 1e6);
+    out += fmt::sprintf("%s_count%s %d\n", name, formatLabels(labels, ""),
+                        snapshot.count);
+}
+
+}  // namespace
+
+std::string toPrometheusText(const PoolStats& stats, const std::string& prefix,
+                             const std::string& labels) {
+    std::string out;
+
+    std::string name = prefix + "_connections";
+    appendMetric(out, name, "gauge", "Connections managed by the pool.");
+    out += fmt::sprintf("%s%s %d\n", name,
+                        formatLabels(labels, "state=\"idle\""), stats.idle);
+    out += fmt::sprintf("%s%s %d\n", name,
+                        formatLabels(labels, "state=\"busy\""), stats.busy);
+    out += fmt::sprintf("%s%s %d\n", name,
+                        formatLabels(labels, "state=\"total\""), stats.total);
+
+    name = prefix + "_waiters";
+    appendMetric(out, name, "gauge", "Threads waiting for a connection.");
+    out += fmt::sprintf("%s%s %d\n", name, formatLabels(labels, ""),
+                        stats.waiters);
+
+    struct {
+        const char* suffix;
+        const char* help;
+        uint64_t value;
+    } counters[] = {
+        {"_checkouts_total", "Connections checked out.", stats.checkouts},
+        {"_exhausted_total", "Checkouts that found no idle connection.",
+         stats.exhausted},
+        {"_timeouts_total", "Checkouts that timed out.", stats.timeouts},
+        {"_connects_total", "Connections established.", stats.creations},
+        {"_connect_failures_total", "Connection attempts that failed.",
+         stats.creationFailures},
+    };
+    for (const auto& counter : counters) {
+        name = prefix + counter.suffix;
+        appendMetric(out, name, "counter", counter.help);
+        out += fmt::sprintf("%s%s %d\n", name, formatLabels(labels, ""),
+                            counter.value);
+    }
+
+    appendSummary(out, prefix + "_wait_seconds",
+                  "Time spent waiting in getConnection.", labels,
+                  stats.waitTime);
+    appendSummary(out, prefix + "_hold_seconds",
+                  "Time a connection was held before release.", labels,
+                  stats.holdTime);
+    return out;
+}
+
+}  // namespace db
@@ -4,4 +4,146 @@
 
 #include "../include/PreparedStatement.h"
 
-namespace db {}
\ No newline at end of file
+#include <algorithm>
+
+#include "../include/Connection.h"
+
+namespace db {
+
+void PreparedStatement::execute(std::chrono::steady_clock::time_point deadline,
+                                Status& s) {
+    s.clear();
+
+    checkValid(s);
+    if (!s) {
+        return;
+    }
+
+    size_t expectedParamCount = mysql_stmt_param_count(stmt_.get());
+    if (expectedParamCount != params_.getBindCount()) {
+        s.assign(Status::ERROR, "params not bind");
+        return;
+    }
+
+    // 这个stmt上次执行的结果可以丢弃，重新执行不需要先读完
+    mysql_stmt_free_result(stmt_.get());
+    if (conn_ != nullptr && conn_->streaming()) {
+        s.assign(Status::ERROR, "streaming result set not finished");
+        return;
+    }
+
+    // prepare之后不能再加MAX_EXECUTION_TIME，只能在超时时中断
+    QueryWatch watch;
+    if (conn_ != nullptr) {
+        deadline = std::min(deadline, conn_->getDeadline());
+        if (deadline != std::chrono::steady_clock::time_point::max()) {
+            if (std::chrono::steady_clock::now() >= deadline) {
+                s.assign(Status::TIMEOUT, "deadline exceeded");
+                return;
+            }
+            watch.start(conn_->getWatchdog(), conn_->get(), deadline);
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    int ret = mysql_stmt_execute(stmt_.get());
+    if (conn_ != nullptr) {
+        conn_->recordQuery(start);
+    }
+    if (ret != 0) {
+        s.assign(Status::ERROR, fmt::sprintf("statement execute failed, %s",
+                                             getLastError(stmt_.get())));
+    }
+    watch.finish(mysql_stmt_errno(stmt_.get()), s);
+}
+
+void PreparedStatement::setCursor(unsigned long prefetchRows, Status& s) {
+    s.clear();
+
+    checkValid(s);
+    if (!s) {
+        return;
+    }
+
+    unsigned long cursorType =
+        prefetchRows > 0 ? CURSOR_TYPE_READ_ONLY : CURSOR_TYPE_NO_CURSOR;
+    if (mysql_stmt_attr_set(stmt_.get(), STMT_ATTR_CURSOR_TYPE,
+                            &cursorType) != 0) {
+        s.assign(Status::ERROR, fmt::sprintf("set cursor type failed, %s",
+                                             getLastError(stmt_.get())));
+        return;
+    }
+
+    if (prefetchRows == 0) {
+        return;
+    }
+    if (mysql_stmt_attr_set(stmt_.get(), STMT_ATTR_PREFETCH_ROWS,
+                            &prefetchRows) != 0) {
+        s.assign(Status::ERROR, fmt::sprintf("set prefetch rows failed, %s",
+                                             getLastError(stmt_.get())));
+    }
+}
+
+PreparedResultSet PreparedStatement::getResultSet(
+    std::chrono::steady_clock::time_point deadline, Status& s) {
+    s.clear();
+
+    checkValid(s);
+    if (!s) {
+        return PreparedResultSet();
+    }
+
+    if (conn_ != nullptr) {
+        deadline = std::min(deadline, conn_->getDeadline());
+    }
+    if (deadline == std::chrono::steady_clock::time_point::max()) {
+        return PreparedResultSet(stmt_.get(), false, getMetaData());
+    }
+
+    QueryWatch watch;
+    if (conn_ != nullptr) {
+        watch.start(conn_->getWatchdog(), conn_->get(), deadline);
+    }
+    try {
+        PreparedResultSet resultSet(stmt_.get(), false, getMetaData());
+        watch.finish(0, s);
+        return resultSet;
+    } catch (const std::runtime_error& e) {
+        s.assign(Status::RUNTIME_ERROR, e.what());
+        watch.finish(mysql_stmt_errno(stmt_.get()), s);
+        return PreparedResultSet();
+    }
+}
+
+PreparedResultSet PreparedStatement::getStreamingResultSet(
+    std::chrono::steady_clock::time_point deadline, Status& s) {
+    s.clear();
+
+    checkValid(s);
+    if (!s) {
+        return PreparedResultSet();
+    }
+
+    if (conn_ != nullptr) {
+        deadline = std::min(deadline, conn_->getDeadline());
+    }
+    if (deadline != std::chrono::steady_clock::time_point::max() &&
+        std::chrono::steady_clock::now() >= deadline) {
+        s.assign(Status::TIMEOUT, "deadline exceeded");
+        return PreparedResultSet();
+    }
+
+    try {
+        PreparedResultSet resultSet(stmt_.get(), true, getMetaData());
+        if (conn_ != nullptr &&
+            deadline != std::chrono::steady_clock::time_point::max()) {
+            resultSet.watchUntil(conn_->getWatchdog(), conn_->get(), deadline);
+        }
+        return resultSet;
+    } catch (const std::runtime_error& e) {
+        s.assign(Status::RUNTIME_ERROR, e.what());
+        return PreparedResultSet();
+    }
+}
+
+}  // namespace db
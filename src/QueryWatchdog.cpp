@@ -0,0 +1,178 @@
+//
+// Created by m8792 on 2021/1/12.
+//
+
+#include "QueryWatchdog.h"
+
+#include "Connection.h"
+#include "Option.h"
+
+namespace db {
+
+namespace {
+
+/**
+ * MAX_EXECUTION_TIME到达时服务器返回的错误码，ER_QUERY_TIMEOUT
+ */
+const unsigned int kQueryTimeoutError = 3024;
+
+}  // namespace
+
+QueryWatchdog::QueryWatchdog() : port_(0), nextId_(0), stopping_(false) {}
+
+QueryWatchdog::~QueryWatchdog() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cond_.notify_all();
+
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void QueryWatchdog::setServer(const std::string& host, unsigned short port,
+                              const std::string& user,
+                              const std::string& password) {
+    std::lock_guard<std::mutex> lock(killMutex_);
+    host_ = host;
+    port_ = port;
+    user_ = user;
+    password_ = password;
+    sideChannel_.reset();
+}
+
+uint64_t QueryWatchdog::watch(unsigned long threadId,
+                              std::chrono::steady_clock::time_point deadline) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!thread_.joinable()) {
+        thread_ = std::thread(&QueryWatchdog::loop, this);
+    }
+
+    uint64_t id = ++nextId_;
+    entries_[id] = Entry{threadId, deadline, WATCHING};
+    auto it = deadlines_.emplace(deadline, id).first;
+    if (it == deadlines_.begin()) {
+        cond_.notify_one();
+    }
+    return id;
+}
+
+bool QueryWatchdog::unwatch(uint64_t id) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto found = entries_.find(id);
+    if (found == entries_.end()) {
+        return false;
+    }
+
+    // 等待KILL QUERY发送完成，连接在这之前不会被用来执行其他sql
+    if (found->second.state == KILLING) {
+        killedCond_.wait(lock, [this, id] {
+            return entries_.find(id)->second.state != KILLING;
+        });
+        found = entries_.find(id);
+    }
+
+    bool killed = found->second.state != WATCHING;
+    if (!killed) {
+        deadlines_.erase(std::make_pair(found->second.deadline, id));
+    }
+    entries_.erase(found);
+    return killed;
+}
+
+void QueryWatchdog::kill(unsigned long threadId, Status& s) {
+    std::lock_guard<std::mutex> lock(killMutex_);
+    killLocked(threadId, s);
+}
+
+void QueryWatchdog::killLocked(unsigned long threadId, Status& s) {
+    s.clear();
+
+    if (host_.empty()) {
+        s.assign(Status::ERROR, "server not set");
+        return;
+    }
+
+    std::string sql = fmt::sprintf("KILL QUERY %lu", threadId);
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        if (!sideChannel_) {
+            sideChannel_.reset(new Connection());
+            sideChannel_->setOption(option::ConnectTimeout(3), s);
+            if (s) {
+                sideChannel_->connect(host_, port_, user_, password_, s);
+            }
+            if (!s) {
+                sideChannel_.reset();
+                return;
+            }
+        }
+
+        MYSQL* mysql = sideChannel_->get();
+        if (mysql_real_query(mysql, sql.c_str(), sql.size()) == 0) {
+            s.clear();
+            return;
+        }
+
+        s.assign(Status::RUNTIME_ERROR,
+                 fmt::sprintf("kill query failed, %s", getLastError(mysql)));
+        // 连接可能已经断开，重新建立之后再试一次
+        sideChannel_.reset();
+    }
+}
+
+void QueryWatchdog::loop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopping_) {
+        if (deadlines_.empty()) {
+            cond_.wait(lock);
+            continue;
+        }
+
+        auto first = *deadlines_.begin();
+        if (std::chrono::steady_clock::now() < first.first) {
+            cond_.wait_until(lock, first.first);
+            continue;
+        }
+
+        deadlines_.erase(deadlines_.begin());
+        Entry& entry = entries_[first.second];
+        entry.state = KILLING;
+        unsigned long threadId = entry.threadId;
+
+        // 发送时不持有mutex_，unwatch这个查询的线程会等待发送完成
+        lock.unlock();
+        Status s;
+        kill(threadId, s);
+        lock.lock();
+
+        entries_[first.second].state = KILLED;
+        killedCond_.notify_all();
+    }
+}
+
+void QueryWatch::start(QueryWatchdog* watchdog, MYSQL* mysql,
+                       std::chrono::steady_clock::time_point deadline) {
+    if (watchdog == nullptr || mysql == nullptr) {
+        return;
+    }
+
+    watchdog_ = watchdog;
+    id_ = watchdog->watch(mysql_thread_id(mysql), deadline);
+}
+
+void QueryWatch::finish(unsigned int error, Status& s) {
+    bool killed = false;
+    if (id_ != 0) {
+        killed = watchdog_->unwatch(id_);
+        id_ = 0;
+    }
+
+    if (!s && (killed || error == kQueryTimeoutError)) {
+        s.assign(Status::TIMEOUT,
+                 fmt::sprintf("deadline exceeded, %s", s.message()));
+    }
+}
+
+}  // namespace db
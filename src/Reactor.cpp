@@ -0,0 +1,366 @@
+//
+// Created by m8792 on 2021/1/9.
+//
+
+#include "Reactor.h"
+
+#ifdef MYSQL_CONNECTOR_HAS_NONBLOCKING
+
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <limits>
+
+namespace db {
+
+namespace {
+
+/**
+ * 一次epoll_wait最多处理的事件数
+ */
+const int kMaxEvents = 128;
+
+}  // namespace
+
+Reactor::Reactor()
+    : epollFd_(-1), eventFd_(-1), stopping_(false), pendingCount_(0) {}
+
+Reactor::~Reactor() {
+    stop();
+    if (eventFd_ >= 0) {
+        ::close(eventFd_);
+    }
+    if (epollFd_ >= 0) {
+        ::close(epollFd_);
+    }
+}
+
+void Reactor::start(Status& s) {
+    s.clear();
+
+    if (thread_.joinable() || epollFd_ >= 0) {
+        s.assign(Status::RUNTIME_ERROR, "start already invoked");
+        return;
+    }
+
+    epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd_ < 0) {
+        s.assign(Status::RUNTIME_ERROR,
+                 fmt::sprintf("epoll_create1 failed, %s", strerror(errno)));
+        return;
+    }
+
+    eventFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (eventFd_ < 0) {
+        s.assign(Status::RUNTIME_ERROR,
+                 fmt::sprintf("eventfd failed, %s", strerror(errno)));
+        return;
+    }
+
+    // data.ptr为空的事件来自eventfd
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = nullptr;
+    if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, eventFd_, &event) != 0) {
+        s.assign(Status::RUNTIME_ERROR,
+                 fmt::sprintf("epoll_ctl failed, %s", strerror(errno)));
+        return;
+    }
+
+    thread_ = std::thread(&Reactor::loop, this);
+}
+
+void Reactor::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_) {
+            return;
+        }
+        stopping_ = true;
+    }
+    wakeUp();
+
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+
+    // 没有启动过时，提交的请求还在队列里
+    std::vector<Operation*> submitted;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        submitted.swap(submitted_);
+    }
+    for (auto op : submitted) {
+        complete(op, ResultSet(), Status(Status::ERROR, "reactor stopped"));
+    }
+}
+
+void Reactor::connect(Connection& connection, const std::string& host,
+                      unsigned short port, const std::string& user,
+                      const std::string& password, const std::string& schema,
+                      ConnectCallback callback) {
+    connect(connection, host, port, user, password, schema,
+            std::chrono::steady_clock::time_point::max(), std::move(callback));
+}
+
+void Reactor::connect(Connection& connection, const std::string& host,
+                      unsigned short port, const std::string& user,
+                      const std::string& password, const std::string& schema,
+                      std::chrono::steady_clock::time_point deadline,
+                      ConnectCallback callback) {
+    Operation* op = new Operation(Operation::CONNECT, &connection);
+    op->deadline = deadline;
+    op->host = host;
+    op->port = port;
+    op->user = user;
+    op->password = password;
+    op->schema = schema;
+    op->onConnect = std::move(callback);
+    submit(op);
+}
+
+void Reactor::executeQuery(Connection& connection, const std::string& sql,
+                           QueryCallback callback) {
+    executeQuery(connection, sql, std::chrono::steady_clock::time_point::max(),
+                 std::move(callback));
+}
+
+void Reactor::executeQuery(Connection& connection, const std::string& sql,
+                           std::chrono::steady_clock::time_point deadline,
+                           QueryCallback callback) {
+    Operation* op = new Operation(Operation::QUERY, &connection);
+    op->deadline = std::min(deadline, connection.getDeadline());
+    op->sql = sql;
+    op->onQuery = std::move(callback);
+    submit(op);
+}
+
+void Reactor::submit(Operation* op) {
+    pendingCount_.fetch_add(1);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!stopping_) {
+            submitted_.push_back(op);
+            op = nullptr;
+        }
+    }
+
+    if (op != nullptr) {
+        complete(op, ResultSet(), Status(Status::ERROR, "reactor stopped"));
+        return;
+    }
+    wakeUp();
+}
+
+void Reactor::advance(Operation* op) {
+    Connection& connection = *op->connection;
+    MYSQL* mysql = connection.get();
+    Status s;
+
+    while (true) {
+        net_async_status status = NET_ASYNC_ERROR;
+        switch (op->stage) {
+        case Operation::CONNECT:
+            status = connection.connectNonblocking(
+                op->host, op->port, op->user, op->password, op->schema, s);
+            if (status == NET_ASYNC_COMPLETE) {
+                complete(op, ResultSet(), s);
+                return;
+            }
+            break;
+
+        case Operation::QUERY:
+            if (!connection.connected()) {
+                complete(op, ResultSet(),
+                         Status(Status::ERROR, "not connected"));
+                return;
+            }
+            if (!op->registered) {
+                connection.trackSql(op->sql);
+            }
+            status = mysql_real_query_nonblocking(mysql, op->sql.c_str(),
+                                                  op->sql.size());
+            if (status == NET_ASYNC_COMPLETE) {
+                if (mysql_field_count(mysql) == 0) {
+                    complete(op, ResultSet(), s);
+                    return;
+                }
+                op->stage = Operation::STORE;
+                continue;
+            }
+            if (status == NET_ASYNC_ERROR) {
+                s.assign(Status::RUNTIME_ERROR,
+                         fmt::sprintf("execute sql failed, %s",
+                                      getLastError(mysql)));
+            }
+            break;
+
+        case Operation::STORE: {
+            MYSQL_RES* res = nullptr;
+            status = mysql_store_result_nonblocking(mysql, &res);
+            if (status == NET_ASYNC_COMPLETE && res == nullptr) {
+                status = NET_ASYNC_ERROR;
+            }
+            if (status == NET_ASYNC_COMPLETE) {
+                complete(op, ResultSet(res), s);
+                return;
+            }
+            if (status == NET_ASYNC_ERROR) {
+                s.assign(Status::RUNTIME_ERROR,
+                         fmt::sprintf("get query result failed, %s",
+                                      getLastError(mysql)));
+            }
+            break;
+        }
+        }
+
+        if (status != NET_ASYNC_NOT_READY) {
+            complete(op, ResultSet(), s);
+            return;
+        }
+        break;
+    }
+
+    if (op->registered) {
+        return;
+    }
+
+    // 边沿触发，写完请求之后不会一直报告可写，加入时已经就绪的也会报告一次
+    epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    event.data.ptr = op;
+    if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, mysql_get_socket(mysql), &event) !=
+        0) {
+        complete(op, ResultSet(),
+                 Status(Status::RUNTIME_ERROR,
+                        fmt::sprintf("epoll_ctl failed, %s", strerror(errno))));
+        return;
+    }
+    op->registered = true;
+}
+
+void Reactor::complete(Operation* op, ResultSet result, const Status& s) {
+    if (op->registered) {
+        epoll_ctl(epollFd_, EPOLL_CTL_DEL,
+                  mysql_get_socket(op->connection->get()), nullptr);
+    }
+    if (op->inflight) {
+        inflight_.erase(op);
+    }
+    if (op->timed) {
+        timers_.erase(op->timer);
+    }
+    pendingCount_.fetch_sub(1);
+
+    // 回调中可能释放Connection或者提交新的请求
+    if (op->onConnect) {
+        op->onConnect(s);
+    } else {
+        op->onQuery(std::move(result), s);
+    }
+    delete op;
+}
+
+void Reactor::expire(std::chrono::steady_clock::time_point now) {
+    // 回调中可能结束其他的请求，每次重新取第一个
+    while (!timers_.empty() && timers_.begin()->first <= now) {
+        Operation* op = timers_.begin()->second;
+        if (op->registered) {
+            epoll_ctl(epollFd_, EPOLL_CTL_DEL,
+                      mysql_get_socket(op->connection->get()), nullptr);
+            op->registered = false;
+        }
+        op->connection->close();
+        complete(op, ResultSet(),
+                 Status(Status::TIMEOUT, "deadline exceeded"));
+    }
+}
+
+int Reactor::waitTimeoutMs() const {
+    if (timers_.empty()) {
+        return -1;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    auto deadline = timers_.begin()->first;
+    if (deadline <= now) {
+        return 0;
+    }
+    // 向上取整，避免在deadline之前醒来空转
+    auto timeout =
+        std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now) +
+        std::chrono::milliseconds(1);
+    return static_cast<int>(
+        std::min<int64_t>(timeout.count(), std::numeric_limits<int>::max()));
+}
+
+void Reactor::wakeUp() {
+    if (eventFd_ < 0) {
+        return;
+    }
+
+    uint64_t one = 1;
+    ssize_t n = ::write(eventFd_, &one, sizeof(one));
+    (void)n;
+}
+
+void Reactor::loop() {
+    epoll_event events[kMaxEvents];
+    std::vector<Operation*> submitted;
+    bool stopping = false;
+
+    while (!stopping) {
+        int n = epoll_wait(epollFd_, events, kMaxEvents, waitTimeoutMs());
+        if (n < 0 && errno != EINTR) {
+            break;
+        }
+
+        for (int i = 0; i < n; ++i) {
+            if (events[i].data.ptr == nullptr) {
+                uint64_t count;
+                ssize_t ret = ::read(eventFd_, &count, sizeof(count));
+                (void)ret;
+                continue;
+            }
+            advance(static_cast<Operation*>(events[i].data.ptr));
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            submitted.swap(submitted_);
+            stopping = stopping_;
+        }
+        for (auto op : submitted) {
+            if (stopping) {
+                complete(op, ResultSet(),
+                         Status(Status::ERROR, "reactor stopped"));
+            } else {
+                op->inflight = true;
+                inflight_.insert(op);
+                if (op->deadline !=
+                    std::chrono::steady_clock::time_point::max()) {
+                    op->timed = true;
+                    op->timer = timers_.emplace(op->deadline, op);
+                }
+                advance(op);
+            }
+        }
+        submitted.clear();
+
+        expire(std::chrono::steady_clock::now());
+    }
+
+    // 回调中不会再提交新的请求，stopping_已经设置
+    while (!inflight_.empty()) {
+        complete(*inflight_.begin(), ResultSet(),
+                 Status(Status::ERROR, "reactor stopped"));
+    }
+}
+
+}  // namespace db
+
+#endif  // MYSQL_CONNECTOR_HAS_NONBLOCKING
@@ -4,4 +4,121 @@
 
 #include "../include/ResultMetaData.h"
 
-namespace db {}
\ No newline at end of file
+#include <string.h>
+
+#include <list>
+#include <mutex>
+
+namespace db {
+
+namespace {
+
+/**
+ * 进程内缓存的ResultShape数量的上限，超过之后淘汰最久没有使用的
+ */
+const size_t kMaxCachedShapes = 4096;
+
+/**
+ * 每个线程记住最近使用的几个ResultShape，命中时不需要拼接签名和加锁
+ */
+const size_t kLocalShapes = 4;
+
+/**
+ * 列的签名，名字、类型、标志都相同的结果集签名相同
+ * @param fields
+ * @param fieldCount
+ * @return
+ */
+std::string signature(const MYSQL_FIELD* fields, size_t fieldCount) {
+    std::string key;
+    for (size_t i = 0; i < fieldCount; ++i) {
+        key += fields[i].name;
+        key += fmt::sprintf("\x01%d,%u\x02", fields[i].type, fields[i].flags);
+    }
+    return key;
+}
+
+}  // namespace
+
+ResultShapePtr ResultShape::intern(const MYSQL_FIELD* fields,
+                                   size_t fieldCount) {
+    thread_local ResultShapePtr recent[kLocalShapes];
+    thread_local size_t next = 0;
+
+    for (auto& shape : recent) {
+        if (shape && shape->matches(fields, fieldCount)) {
+            return shape;
+        }
+    }
+
+    using ShapeList = std::list<std::pair<std::string, ResultShapePtr>>;
+
+    static std::mutex mutex;
+    // 最近使用的在前面
+    static ShapeList lru;
+    static std::unordered_map<std::string, ShapeList::iterator> shapes;
+
+    std::string key = signature(fields, fieldCount);
+    ResultShapePtr shape;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = shapes.find(key);
+        if (it != shapes.end()) {
+            lru.splice(lru.begin(), lru, it->second);
+            shape = it->second->second;
+        }
+    }
+
+    if (!shape) {
+        shape = std::make_shared<ResultShape>(fields, fieldCount);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = shapes.find(key);
+        if (it != shapes.end()) {
+            // 其他线程已经放进去了，使用先放进去的那个
+            lru.splice(lru.begin(), lru, it->second);
+            shape = it->second->second;
+        } else {
+            lru.emplace_front(key, shape);
+            shapes[key] = lru.begin();
+            if (lru.size() > kMaxCachedShapes) {
+                shapes.erase(lru.back().first);
+                lru.pop_back();
+            }
+        }
+    }
+
+    recent[next++ % kLocalShapes] = shape;
+    return shape;
+}
+
+ResultShape::ResultShape(const MYSQL_FIELD* fields, size_t fieldCount) {
+    columns_.reserve(fieldCount);
+    for (size_t i = 0; i < fieldCount; ++i) {
+        Column column;
+        column.name = fields[i].name;
+        column.type = fields[i].type;
+        column.dataType = mysqlTypeToDataType(fields[i].type);
+        column.flags = fields[i].flags;
+        columns_.push_back(column);
+
+        nameToIndex_[column.name] = i;
+    }
+}
+
+bool ResultShape::matches(const MYSQL_FIELD* fields, size_t fieldCount) const {
+    if (fieldCount != columns_.size()) {
+        return false;
+    }
+
+    for (size_t i = 0; i < fieldCount; ++i) {
+        const Column& column = columns_[i];
+        if (column.type != fields[i].type || column.flags != fields[i].flags ||
+            strcmp(column.name.c_str(), fields[i].name) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}  // namespace db
@@ -0,0 +1,169 @@
+//
+// Created by m8792 on 2021/1/5.
+//
+
+#include "RoutingPool.h"
+
+#include <mysql/mysqld_error.h>
+
+#include "Statement.h"
+
+namespace db {
+
+RoutingPool::RoutingPool(ConnectionPoolPtr primary,
+                         std::vector<ConnectionPoolPtr> replicas,
+                         const RoutingOptions& options)
+    : primary_(std::move(primary)),
+      options_(options),
+      nextReplica_(0),
+      stopping_(false) {
+    for (auto& replica : replicas) {
+        replicas_.emplace_back(new Replica(std::move(replica)));
+    }
+
+    if (options_.maxLagMs > 0 && !replicas_.empty()) {
+        lagThread_ = std::thread(&RoutingPool::lagCheckLoop, this);
+    }
+}
+
+RoutingPool::~RoutingPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cond_.notify_all();
+    if (lagThread_.joinable()) {
+        lagThread_.join();
+    }
+}
+
+ConnectionPtr RoutingPool::getReadConnection(int timeoutMs) {
+    size_t count = replicas_.size();
+    size_t start = nextReplica_.fetch_add(1, std::memory_order_relaxed);
+
+    Replica* first = nullptr;
+    for (size_t i = 0; i < count; ++i) {
+        Replica& replica = *replicas_[(start + i) % count];
+        if (!replica.available.load()) {
+            continue;
+        }
+        if (first == nullptr) {
+            first = &replica;
+        }
+
+        if (replica.pool->getIdleCount() > 0) {
+            ConnectionPtr ptr = replica.pool->getConnection(0);
+            if (ptr) {
+                return ptr;
+            }
+        }
+    }
+
+    if (first != nullptr) {
+        return first->pool->getConnection(timeoutMs);
+    }
+    if (options_.readFromPrimary) {
+        return primary_->getConnection(timeoutMs);
+    }
+    return ConnectionPtr();
+}
+
+void RoutingPool::checkReplicaLag() {
+    // 后台线程和调用者可能同时检查，monitor连接不能同时使用
+    std::lock_guard<std::mutex> lock(checkMutex_);
+    for (auto& replica : replicas_) {
+        Status s;
+        int64_t lag = queryLag(*replica, s);
+        if (!s) {
+            // 连不上的从库也不能读
+            lag = -1;
+        }
+
+        replica->lagMs = lag;
+        replica->available =
+            options_.maxLagMs <= 0 || (lag >= 0 && lag <= options_.maxLagMs);
+    }
+}
+
+int64_t RoutingPool::queryLag(Replica& replica, Status& s) {
+    s.clear();
+    if (!replica.monitor) {
+        std::unique_ptr<Connection> monitor(new Connection());
+        replica.pool->connectDedicated(*monitor, s);
+        if (!s) {
+            return -1;
+        }
+        replica.monitor = std::move(monitor);
+    }
+
+    int64_t lag = queryLag(replica, *replica.monitor, s);
+    if (!s) {
+        // 连接可能已经断开，下次重新建立
+        replica.monitor.reset();
+    }
+    return lag;
+}
+
+int64_t RoutingPool::queryLag(Replica& replica, Connection& conn, Status& s) {
+    Statement stmt(conn);
+    if (!options_.lagQuery.empty()) {
+        ResultSet rs = stmt.executeQuery(options_.lagQuery, s);
+        if (!s) {
+            return -1;
+        }
+        if (!rs.next()) {
+            s.assign(Status::RUNTIME_ERROR, "lag query returned no rows");
+            return -1;
+        }
+        return rs.getInt64(0);
+    }
+
+    ResultSet rs;
+    if (!replica.legacyStatus) {
+        rs = stmt.executeQuery("SHOW REPLICA STATUS", s);
+        // 8.0.22之前的版本不支持
+        if (!s && mysql_errno(conn.get()) == ER_PARSE_ERROR) {
+            replica.legacyStatus = true;
+        }
+    }
+    if (replica.legacyStatus) {
+        rs = stmt.executeQuery("SHOW SLAVE STATUS", s);
+    }
+    if (!s) {
+        return -1;
+    }
+
+    // 没有配置复制，不存在延迟
+    if (!rs.next()) {
+        return 0;
+    }
+
+    const ResultMetaData& metaData = rs.getResultMetaData(s);
+    for (size_t i = 0; i < metaData.getFieldCount(); ++i) {
+        std::string name = metaData.getFieldName(i);
+        if (name == "Seconds_Behind_Source" ||
+            name == "Seconds_Behind_Master") {
+            // 复制停止时为NULL
+            std::string value = rs.getString(i);
+            return value.empty() ? -1 : std::stoll(value) * 1000;
+        }
+    }
+
+    s.assign(Status::RUNTIME_ERROR, "replication lag not found");
+    return -1;
+}
+
+void RoutingPool::lagCheckLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopping_) {
+        lock.unlock();
+        checkReplicaLag();
+        lock.lock();
+
+        cond_.wait_for(lock,
+                       std::chrono::milliseconds(options_.lagCheckIntervalMs),
+                       [this] { return stopping_; });
+    }
+}
+
+}  // namespace db
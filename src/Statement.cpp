@@ -4,21 +4,83 @@
 
 #include "Statement.h"
 
+#include <ctype.h>
+#include <strings.h>
+
+#include <algorithm>
+
 #include "Connection.h"
 
 namespace db {
 
+namespace {
+
+/**
+ * 拼接的sql之外，为请求的包头预留的长度
+ */
+const size_t kPacketReserved = 1024;
+
+/**
+ * 去掉末尾的空白和分号之后的长度，避免拼接后出现空语句
+ * @param sql
+ * @return
+ */
+size_t trimmedLength(const std::string& sql) {
+    size_t length = sql.size();
+    while (length > 0) {
+        char c = sql[length - 1];
+        if (!isspace(static_cast<unsigned char>(c)) && c != ';') {
+            break;
+        }
+        --length;
+    }
+    return length;
+}
+
+/**
+ * 给select语句加上MAX_EXECUTION_TIME，由服务器限制执行时间
+ * @param sql
+ * @param timeoutMs
+ * @return      不是select语句或者已经有优化器提示时返回空
+ */
+std::string withMaxExecutionTime(const std::string& sql, int64_t timeoutMs) {
+    size_t begin = 0;
+    while (begin < sql.size() &&
+           isspace(static_cast<unsigned char>(sql[begin]))) {
+        ++begin;
+    }
+
+    const size_t keywordLength = 6;
+    if (sql.size() - begin <= keywordLength ||
+        strncasecmp(sql.c_str() + begin, "SELECT", keywordLength) != 0 ||
+        !isspace(static_cast<unsigned char>(sql[begin + keywordLength])) ||
+        sql.find("/*+", begin) != std::string::npos) {
+        return std::string();
+    }
+
+    std::string hinted = sql.substr(0, begin + keywordLength);
+    hinted += fmt::sprintf(" /*+ MAX_EXECUTION_TIME(%d) */", timeoutMs);
+    hinted.append(sql, begin + keywordLength, std::string::npos);
+    return hinted;
+}
+
+}  // namespace
+
 ResultSet Statement::executeQuery(const std::string& sql, Status& s) {
+    return executeQuery(sql, std::chrono::steady_clock::time_point::max(), s);
+}
+
+ResultSet Statement::executeQuery(
+    const std::string& sql, std::chrono::steady_clock::time_point deadline,
+    Status& s) {
     s.clear();
     checkValid(s);
     if (!s) {
         return ResultSet();
     }
 
-    if (mysql_real_query(conn_.get(), sql.c_str(), sql.size()) != 0) {
-        s.assign(
-            Status::RUNTIME_ERROR,
-            fmt::sprintf("execute sql failed, %s", getLastError(conn_.get())));
+    QueryWatch watch;
+    if (!send(sql, deadline, watch, s)) {
         return ResultSet();
     }
 
@@ -27,13 +89,50 @@ ResultSet Statement::executeQuery(const std::string& sql, Status& s) {
         s.assign(Status::RUNTIME_ERROR,
                  fmt::sprintf("get query result failed, %s",
                               getLastError(conn_.get())));
+    }
+    watch.finish(mysql_errno(conn_.get()), s);
+    if (res == nullptr) {
         return ResultSet();
     }
 
     return ResultSet(res);
 }
 
+ResultSet Statement::executeStreamingQuery(const std::string& sql,
+                                           Status& s) {
+    s.clear();
+    checkValid(s);
+    if (!s) {
+        return ResultSet();
+    }
+
+    QueryWatch watch;
+    if (!send(sql, std::chrono::steady_clock::time_point::max(), watch, s)) {
+        return ResultSet();
+    }
+
+    // 只读取了列的信息，行在next时读取
+    MYSQL_RES* res = mysql_use_result(conn_.get());
+    if (res == nullptr) {
+        s.assign(Status::RUNTIME_ERROR,
+                 fmt::sprintf("get query result failed, %s",
+                              getLastError(conn_.get())));
+    }
+    watch.finish(mysql_errno(conn_.get()), s);
+    if (res == nullptr) {
+        return ResultSet();
+    }
+
+    return ResultSet(res, conn_.get());
+}
+
 int Statement::executeUpdate(const std::string& sql, Status& s) {
+    return executeUpdate(sql, std::chrono::steady_clock::time_point::max(), s);
+}
+
+int Statement::executeUpdate(const std::string& sql,
+                             std::chrono::steady_clock::time_point deadline,
+                             Status& s) {
     s.clear();
 
     checkValid(s);
@@ -41,17 +140,22 @@ int Statement::executeUpdate(const std::string& sql, Status& s) {
         return -1;
     }
 
-    if (mysql_real_query(conn_.get(), sql.c_str(), sql.size()) != 0) {
-        s.assign(
-            Status::RUNTIME_ERROR,
-            fmt::sprintf("execute sql failed, %s", getLastError(conn_.get())));
+    QueryWatch watch;
+    if (!send(sql, deadline, watch, s)) {
         return -1;
     }
+    watch.finish(0, s);
 
     return getAffectedRowCount(s);
 }
 
 void Statement::execute(const std::string& sql, Status& s) {
+    execute(sql, std::chrono::steady_clock::time_point::max(), s);
+}
+
+void Statement::execute(const std::string& sql,
+                        std::chrono::steady_clock::time_point deadline,
+                        Status& s) {
     s.clear();
 
     checkValid(s);
@@ -59,12 +163,195 @@ void Statement::execute(const std::string& sql, Status& s) {
         return;
     }
 
-    if (mysql_real_query(conn_.get(), sql.c_str(), sql.size()) != 0) {
+    QueryWatch watch;
+    if (send(sql, deadline, watch, s)) {
+        watch.finish(0, s);
+    }
+}
+
+std::vector<BatchResult> Statement::executeBatch(
+    const std::vector<std::string>& sqls, Status& s) {
+    return executeBatch(sqls, std::chrono::steady_clock::time_point::max(), s);
+}
+
+std::vector<BatchResult> Statement::executeBatch(
+    const std::vector<std::string>& sqls,
+    std::chrono::steady_clock::time_point deadline, Status& s) {
+    s.clear();
+
+    std::vector<BatchResult> results(sqls.size());
+    if (sqls.empty()) {
+        return results;
+    }
+
+    size_t limit = 0;
+    checkValid(s);
+    if (s && conn_.streaming()) {
+        s.assign(Status::ERROR, "streaming result set not finished");
+    }
+    if (s) {
+        limit = conn_.getMaxAllowedPacket(s);
+    }
+    // 执行完之后保持开启，连续的批量执行不用再切换
+    if (s) {
+        conn_.setMultiStatements(true, s);
+    }
+    if (!s) {
+        for (auto& result : results) {
+            result.status = s;
+        }
+        return results;
+    }
+    limit = limit > kPacketReserved ? limit - kPacketReserved : limit;
+    deadline = std::min(deadline, conn_.getDeadline());
+
+    size_t begin = 0;
+    while (begin < sqls.size()) {
+        std::string packed;
+        size_t end = begin;
+        while (end < sqls.size()) {
+            size_t length = trimmedLength(sqls[end]);
+            // 单独超过限制的语句也要发送，由服务器报错
+            if (end > begin && packed.size() + 2 + length > limit) {
+                break;
+            }
+            // 分隔符前换行，结尾的--注释不会注释掉分号
+            if (end > begin) {
+                packed += "\n;";
+            }
+            packed.append(sqls[end], 0, length);
+            conn_.trackSql(sqls[end]);
+            ++end;
+        }
+
+        size_t stopped =
+            executePacked(packed, results, begin, end, deadline, s);
+        if (!s) {
+            begin = stopped + 1;
+            break;
+        }
+        begin = end;
+    }
+
+    for (size_t i = begin; i < sqls.size(); ++i) {
+        results[i].status.assign(Status::ERROR,
+                                 "not executed due to a previous error");
+    }
+    return results;
+}
+
+size_t Statement::executePacked(const std::string& sql,
+                                std::vector<BatchResult>& results,
+                                size_t begin, size_t end,
+                                std::chrono::steady_clock::time_point deadline,
+                                Status& s) {
+    MYSQL* mysql = conn_.get();
+
+    // 多条语句不能加MAX_EXECUTION_TIME，只能在超时时中断
+    QueryWatch watch;
+    if (deadline != std::chrono::steady_clock::time_point::max()) {
+        if (std::chrono::steady_clock::now() >= deadline) {
+            s.assign(Status::TIMEOUT, "deadline exceeded");
+            results[begin].status = s;
+            return begin;
+        }
+        watch.start(conn_.getWatchdog(), mysql, deadline);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    int status = mysql_real_query(mysql, sql.c_str(), sql.size());
+    conn_.recordQuery(start);
+    size_t index = begin;
+    while (true) {
+        // 出错之后服务器不会再返回后面的结果
+        if (status > 0) {
+            s.assign(Status::RUNTIME_ERROR,
+                     fmt::sprintf("execute sql failed, %s",
+                                  getLastError(mysql)));
+            break;
+        }
+        if (status < 0) {
+            return index;
+        }
+
+        if (mysql_field_count(mysql) > 0) {
+            MYSQL_RES* res = mysql_store_result(mysql);
+            if (res == nullptr) {
+                s.assign(Status::RUNTIME_ERROR,
+                         fmt::sprintf("get query result failed, %s",
+                                      getLastError(mysql)));
+                // 读完剩下的结果，连接才能继续使用
+                while (mysql_next_result(mysql) == 0) {
+                    mysql_free_result(mysql_store_result(mysql));
+                }
+                break;
+            }
+            if (index < end) {
+                results[index].resultSet = ResultSet(res);
+            } else {
+                mysql_free_result(res);
+            }
+        } else if (index < end) {
+            results[index].affectedRows = mysql_affected_rows(mysql);
+            results[index].insertId = mysql_insert_id(mysql);
+        }
+
+        ++index;
+        status = mysql_next_result(mysql);
+    }
+
+    watch.finish(mysql_errno(mysql), s);
+    if (index < end) {
+        results[index].status = s;
+    }
+    return index;
+}
+
+bool Statement::send(const std::string& sql,
+                     std::chrono::steady_clock::time_point deadline,
+                     QueryWatch& watch, Status& s) {
+    if (conn_.streaming()) {
+        s.assign(Status::ERROR, "streaming result set not finished");
+        return false;
+    }
+
+    // 单条执行的sql不能夹带其他语句
+    conn_.setMultiStatements(false, s);
+    if (!s) {
+        return false;
+    }
+
+    const std::string* query = &sql;
+    std::string hinted;
+    deadline = std::min(deadline, conn_.getDeadline());
+    if (deadline != std::chrono::steady_clock::time_point::max()) {
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now());
+        if (remaining.count() <= 0) {
+            s.assign(Status::TIMEOUT, "deadline exceeded");
+            return false;
+        }
+
+        hinted = withMaxExecutionTime(sql, remaining.count());
+        if (!hinted.empty()) {
+            query = &hinted;
+        } else {
+            watch.start(conn_.getWatchdog(), conn_.get(), deadline);
+        }
+    }
+
+    conn_.trackSql(sql);
+    auto start = std::chrono::steady_clock::now();
+    int ret = mysql_real_query(conn_.get(), query->c_str(), query->size());
+    conn_.recordQuery(start);
+    if (ret != 0) {
         s.assign(
             Status::RUNTIME_ERROR,
             fmt::sprintf("execute sql failed, %s", getLastError(conn_.get())));
-        return;
+        watch.finish(mysql_errno(conn_.get()), s);
+        return false;
     }
+    return true;
 }
 
 int64_t Statement::getLastInsertId(Status& s) {
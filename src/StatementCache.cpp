@@ -0,0 +1,106 @@
+//
+// Created by m8792 on 2021/1/7.
+//
+
+#include "StatementCache.h"
+
+#include <iterator>
+
+namespace db {
+
+MYSQL_STMT* StatementCache::acquire(
+    const std::string& sql, std::unique_ptr<StatementMetaData>* metaData) {
+    auto found = bySql_.find(sql);
+    if (found == bySql_.end() || found->second->leased) {
+        ++misses_;
+        return nullptr;
+    }
+
+    ++hits_;
+    EntryList::iterator it = found->second;
+    it->leased = true;
+    entries_.splice(entries_.begin(), entries_, it);
+    if (metaData != nullptr) {
+        *metaData = std::move(it->metaData);
+    }
+    return it->stmt;
+}
+
+bool StatementCache::add(const std::string& sql, MYSQL_STMT* stmt) {
+    if (capacity_ == 0 || bySql_.count(sql) != 0) {
+        return false;
+    }
+    if (entries_.size() >= capacity_ && !evict()) {
+        return false;
+    }
+
+    entries_.push_front(Entry{sql, stmt, true, nullptr});
+    bySql_[sql] = entries_.begin();
+    byStmt_[stmt] = entries_.begin();
+    return true;
+}
+
+void StatementCache::release(MYSQL_STMT* stmt,
+                             std::unique_ptr<StatementMetaData> metaData) {
+    auto found = byStmt_.find(stmt);
+    if (found == byStmt_.end()) {
+        metaData.reset();
+        mysql_stmt_close(stmt);
+        return;
+    }
+
+    // 丢弃没有读完的结果，服务器上的语句仍然保留
+    mysql_stmt_free_result(stmt);
+    if (mysql_stmt_reset(stmt) != 0) {
+        metaData.reset();
+        erase(found->second);
+        return;
+    }
+
+    // 游标是使用者设置的，不带给下一个使用者
+    unsigned long cursorType = CURSOR_TYPE_NO_CURSOR;
+    mysql_stmt_attr_set(stmt, STMT_ATTR_CURSOR_TYPE, &cursorType);
+    found->second->leased = false;
+    found->second->metaData = std::move(metaData);
+}
+
+void StatementCache::clear() {
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+        if (!it->leased) {
+            it->metaData.reset();
+            mysql_stmt_close(it->stmt);
+        }
+    }
+    entries_.clear();
+    bySql_.clear();
+    byStmt_.clear();
+}
+
+bool StatementCache::inUse() const {
+    for (auto& entry : entries_) {
+        if (entry.leased) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool StatementCache::evict() {
+    for (auto it = entries_.rbegin(); it != entries_.rend(); ++it) {
+        if (!it->leased) {
+            erase(std::next(it).base());
+            return true;
+        }
+    }
+    return false;
+}
+
+void StatementCache::erase(EntryList::iterator it) {
+    it->metaData.reset();
+    mysql_stmt_close(it->stmt);
+    bySql_.erase(it->sql);
+    byStmt_.erase(it->stmt);
+    entries_.erase(it);
+}
+
+}  // namespace db
@@ -4,6 +4,9 @@
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <atomic>
+#include <future>
 #include <thread>
 
 #include "ConnectionPool.h"
@@ -114,4 +117,592 @@ TEST(ConnectionPoolTest, theadMayLeak) {
         std::cout << *ptr << std::endl;
     }).detach();
     std::this_thread::sleep_for(std::chrono::seconds(1));
-}
\ No newline at end of file
+}
+TEST(ConnectionPoolTest, shardedGetConnection) {
+    PoolOptions options;
+    options.shardCount = 4;
+    ConnectionPoolPtr pool = std::make_shared<ConnectionPool>(4, options);
+    ASSERT_EQ(4, pool->getShardCount());
+
+    Status s;
+    pool->connect("127.0.0.1", 0, "root", "wylj", s);
+    ASSERT_TRUE(s);
+
+    // 各个线程都能从其他分片窃取到连接
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 8; ++i) {
+        threads.emplace_back([pool]() {
+            for (int j = 0; j < 100; ++j) {
+                ConnectionPtr ptr = pool->getConnection(2000);
+                ASSERT_TRUE(bool(ptr));
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    std::vector<ConnectionPtr> ptrs;
+    for (int i = 0; i < 4; ++i) {
+        ptrs.emplace_back(pool->getConnection(0));
+        ASSERT_TRUE(bool(ptrs.back()));
+    }
+    ASSERT_FALSE(bool(pool->getConnection(0)));
+}
+
+TEST(ConnectionPoolTest, stableSlot) {
+    ConnectionPoolPtr pool = std::make_shared<ConnectionPool>(1);
+    Status s;
+    pool->connect("127.0.0.1", 0, "root", "wylj", s);
+    ASSERT_TRUE(s);
+
+    ConnectionPtr ptr = pool->getConnection();
+    ASSERT_TRUE(bool(ptr));
+    ASSERT_TRUE(ptr->checkConnected());
+    Connection* connection = ptr.get();
+    ptr.release();
+    ASSERT_EQ(nullptr, ptr.get());
+
+    // 归还后再取出的是同一个槽位中的连接
+    ptr = pool->getConnection();
+    ASSERT_TRUE(bool(ptr));
+    ASSERT_EQ(connection, ptr.get());
+
+    // 缩小时正在使用的连接在归还时关闭
+    pool->resize(0);
+    ASSERT_EQ(0, pool->getConnectionCount());
+    ptr.release();
+    ASSERT_FALSE(bool(pool->getConnection(0)));
+}
+
+TEST(ConnectionPoolTest, connectAsync) {
+    PoolOptions options;
+    options.warmUpConcurrency = 8;
+    ConnectionPoolPtr pool = std::make_shared<ConnectionPool>(16, options);
+
+    Status s;
+    pool->connectAsync("127.0.0.1", 0, "root", "wylj", "", s);
+    ASSERT_TRUE(s);
+
+    // 第一个连接就绪后就可以取用
+    s = pool->whenReady(1).get();
+    ASSERT_TRUE(s) << s.message();
+    ConnectionPtr ptr = pool->getConnection(0);
+    ASSERT_TRUE(bool(ptr));
+
+    std::promise<Status> allReady;
+    pool->onReady(16, [&allReady](const Status& s) { allReady.set_value(s); });
+    s = allReady.get_future().get();
+    ASSERT_TRUE(s) << s.message();
+
+    pool->connectAsync("127.0.0.1", 0, "root", "wylj", "", s);
+    ASSERT_FALSE(s);
+}
+
+TEST(ConnectionPoolTest, parallelConnectToInvalidAddress) {
+    PoolOptions options;
+    options.warmUpConcurrency = 4;
+    ConnectionPoolPtr pool = std::make_shared<ConnectionPool>(4, options);
+
+    Status s;
+    pool->connect("10.12.0.2", 0, "root", "wylj", s);
+    ASSERT_FALSE(s);
+    ASSERT_FALSE(bool(pool->getConnection(0)));
+}
+
+TEST(ConnectionPoolTest, elasticGrowAndReap) {
+    PoolOptions options;
+    options.minIdle = 1;
+    options.maxTotal = 4;
+    options.idleTimeoutMs = 200;
+    ConnectionPoolPtr pool = std::make_shared<ConnectionPool>(1, options);
+
+    Status s;
+    pool->connect("127.0.0.1", 0, "root", "wylj", s);
+    ASSERT_TRUE(s);
+
+    // 有人等待时在后台新建连接，最多到maxTotal
+    std::vector<ConnectionPtr> ptrs;
+    for (int i = 0; i < 4; ++i) {
+        ptrs.emplace_back(pool->getConnection(5000));
+        ASSERT_TRUE(bool(ptrs.back()));
+    }
+    ASSERT_EQ(4, pool->getConnectionCount());
+    ASSERT_FALSE(bool(pool->getConnection(500)));
+
+    ptrs.clear();
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+
+    // 空闲超时后归还连接时回收，至少保留minIdle个
+    pool->getConnection().release();
+    ASSERT_EQ(1, pool->getConnectionCount());
+    ASSERT_EQ(1, pool->getIdleCount());
+}
+
+TEST(ConnectionPoolTest, idleTimeoutWithFixedSize) {
+    PoolOptions options;
+    options.idleTimeoutMs = 100;
+    ConnectionPoolPtr pool = std::make_shared<ConnectionPool>(2, options);
+
+    Status s;
+    pool->connect("127.0.0.1", 0, "root", "wylj", s);
+    ASSERT_TRUE(s);
+
+    pool->getConnection().release();
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    pool->getConnection().release();
+
+    // 连接数固定时不回收，回收了也不会再补充
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    ConnectionPtr ptr = pool->getConnection(1000);
+    ASSERT_TRUE(bool(ptr));
+    ASSERT_EQ(2, pool->getConnectionCount());
+}
+
+TEST(ConnectionPoolTest, healthCheck) {
+    PoolOptions options;
+    options.healthCheckIntervalMs = 100;
+    options.pingIdleMs = 100;
+    options.autoReconnect = false;
+    ConnectionPoolPtr pool = std::make_shared<ConnectionPool>(1, options);
+
+    Status s;
+    pool->connect("127.0.0.1", 0, "root", "wylj", s);
+    ASSERT_TRUE(s);
+
+    unsigned long threadId = 0;
+    {
+        ConnectionPtr ptr = pool->getConnection();
+        ASSERT_TRUE(bool(ptr));
+        threadId = mysql_thread_id(ptr->get());
+    }
+
+    // 在服务器端断开空闲的连接
+    Connection killer;
+    killer.connect("127.0.0.1", 0, "root", "wylj", s);
+    ASSERT_TRUE(s);
+    Statement statement = killer.createStatement(s);
+    ASSERT_TRUE(s);
+    statement.execute(fmt::sprintf("KILL %d", threadId), s);
+    ASSERT_TRUE(s) << s.message();
+
+    // 维护线程会在取用之前替换断开的连接
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    ConnectionPtr ptr = pool->getConnection();
+    ASSERT_TRUE(bool(ptr));
+    ASSERT_TRUE(ptr->checkConnected());
+    ASSERT_NE(threadId, mysql_thread_id(ptr->get()));
+}
+
+TEST(ConnectionPoolTest, healthCheckKeepsIdleTime) {
+    PoolOptions options;
+    options.maxTotal = 4;
+    options.idleTimeoutMs = 300;
+    options.healthCheckIntervalMs = 50;
+    options.pingIdleMs = 50;
+    ConnectionPoolPtr pool = std::make_shared<ConnectionPool>(2, options);
+
+    Status s;
+    pool->connect("127.0.0.1", 0, "root", "wylj", s);
+    ASSERT_TRUE(s);
+
+    // ping过的连接仍然会空闲超时被回收
+    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+    ASSERT_EQ(0, pool->getConnectionCount());
+
+    ConnectionPtr ptr = pool->getConnection(5000);
+    ASSERT_TRUE(bool(ptr));
+}
+
+TEST(ConnectionPoolTest, stats) {
+    ConnectionPoolPtr pool = std::make_shared<ConnectionPool>(2);
+    Status s;
+    pool->connect("127.0.0.1", 0, "root", "wylj", s);
+    ASSERT_TRUE(s);
+
+    {
+        ConnectionPtr first = pool->getConnection();
+        ConnectionPtr second = pool->getConnection();
+        ASSERT_FALSE(bool(pool->getConnection(100)));
+        // 不等待的也算超时
+        ASSERT_FALSE(bool(pool->getConnection(0)));
+
+        PoolStats stats = pool->getStats();
+        ASSERT_EQ(2, stats.total);
+        ASSERT_EQ(0, stats.idle);
+        ASSERT_EQ(2, stats.busy);
+        ASSERT_EQ(2, stats.checkouts);
+        ASSERT_EQ(2, stats.timeouts);
+        ASSERT_EQ(2, stats.creations);
+        ASSERT_EQ(3, stats.waitTime.count);
+        ASSERT_GE(stats.waitTime.percentile(1), 100000);
+    }
+
+    PoolStats stats = pool->getStats();
+    ASSERT_EQ(2, stats.idle);
+    ASSERT_EQ(0, stats.busy);
+    ASSERT_EQ(2, stats.holdTime.count);
+
+    std::string text = toPrometheusText(stats, "mysql_pool", "pool=\"test\"");
+    ASSERT_NE(std::string::npos,
+              text.find("mysql_pool_connections{pool=\"test\","
+                        "state=\"idle\"} 2"));
+    ASSERT_NE(std::string::npos, text.find("mysql_pool_timeouts_total"));
+}
+
+TEST(ConnectionPoolTest, priorityWaiters) {
+    ConnectionPoolPtr pool = std::make_shared<ConnectionPool>(1);
+    Status s;
+    pool->connect("127.0.0.1", 0, "root", "wylj", s);
+    ASSERT_TRUE(s);
+
+    ConnectionPtr held = pool->getConnection();
+    ASSERT_TRUE(bool(held));
+
+    // 截止时间已经过了，不会等待
+    ASSERT_FALSE(bool(pool->getConnection(std::chrono::steady_clock::now())));
+
+    std::mutex mutex;
+    std::vector<int> order;
+    auto waiter = [&](int id, ConnectionPool::Priority priority) {
+        ConnectionPtr ptr = pool->getConnection(
+            std::chrono::steady_clock::now() + std::chrono::seconds(5),
+            priority);
+        ASSERT_TRUE(bool(ptr));
+        std::lock_guard<std::mutex> lock(mutex);
+        order.push_back(id);
+    };
+
+    std::thread batch(waiter, 1, ConnectionPool::BATCH);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    std::thread first(waiter, 2, ConnectionPool::INTERACTIVE);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    std::thread second(waiter, 3, ConnectionPool::INTERACTIVE);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    ASSERT_EQ(3, pool->getStats().waiters);
+
+    held.release();
+    batch.join();
+    first.join();
+    second.join();
+
+    // 在线请求先于批处理，同一优先级按到达顺序
+    ASSERT_EQ((std::vector<int>{2, 3, 1}), order);
+}
+
+TEST(ConnectionPoolTest, tenant) {
+    ConnectionPoolPtr pool = std::make_shared<ConnectionPool>(1);
+    Status s;
+    pool->connect("127.0.0.1", 0, "root", "wylj", s);
+    ASSERT_TRUE(s);
+
+    TenantOptions options;
+    options.maxShare = 5;
+    TenantPtr light = pool->addTenant("light", options);
+    options.weight = 3;
+    TenantPtr heavy = pool->addTenant("heavy", options);
+
+    ConnectionPtr held = pool->getConnection(heavy, -1);
+    ASSERT_TRUE(bool(held));
+    ASSERT_EQ(1, heavy->getActiveCount());
+
+    std::mutex mutex;
+    std::vector<std::string> order;
+    auto waiter = [&](const TenantPtr& tenant) {
+        ConnectionPtr ptr = pool->getConnection(tenant, 5000);
+        ASSERT_TRUE(bool(ptr));
+        std::lock_guard<std::mutex> lock(mutex);
+        order.push_back(tenant->getName());
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back(waiter, light);
+        threads.emplace_back(waiter, heavy);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    ASSERT_EQ(8, pool->getStats().waiters);
+
+    // 超过份额的调用立即失败，不会排队
+    auto start = std::chrono::steady_clock::now();
+    ASSERT_FALSE(bool(pool->getConnection(heavy, 5000)));
+    ASSERT_LT(std::chrono::steady_clock::now() - start,
+              std::chrono::milliseconds(100));
+    ASSERT_EQ(1, heavy->getRejectedCount());
+
+    held.release();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    // 权重为3的租户在前4个连接中分到3个
+    ASSERT_EQ(8, order.size());
+    ASSERT_EQ(3, std::count(order.begin(), order.begin() + 4, "heavy"));
+    ASSERT_EQ(0, light->getActiveCount());
+    ASSERT_EQ(0, heavy->getActiveCount());
+}
+
+TEST(ConnectionPoolTest, stickyCache) {
+    PoolOptions options;
+    options.stickyCache = true;
+    ConnectionPoolPtr pool = std::make_shared<ConnectionPool>(2, options);
+    Status s;
+    pool->connect("127.0.0.1", 0, "root", "wylj", s);
+    ASSERT_TRUE(s);
+
+    ConnectionPtr ptr = pool->getConnection();
+    MYSQL* parked = ptr->get();
+    ptr.release();
+    // 缓存在当前线程，不在共享的分片里，但也算空闲连接
+    ASSERT_EQ(2, pool->getIdleCount());
+
+    ptr = pool->getConnection();
+    ASSERT_EQ(parked, ptr->get());
+    ptr.release();
+
+    // 其他线程取完分片里的连接后，从缓存格里回收
+    std::thread other([&] {
+        ConnectionPtr first = pool->getConnection(0);
+        ConnectionPtr second = pool->getConnection(0);
+        ASSERT_TRUE(bool(first));
+        ASSERT_TRUE(bool(second));
+        ASSERT_TRUE(first->get() == parked || second->get() == parked);
+    });
+    other.join();
+}
+
+TEST(ConnectionPoolTest, stickyCacheReap) {
+    PoolOptions options;
+    options.stickyCache = true;
+    options.maxTotal = 4;
+    options.idleTimeoutMs = 300;
+    options.healthCheckIntervalMs = 50;
+    ConnectionPoolPtr pool = std::make_shared<ConnectionPool>(2, options);
+
+    Status s;
+    pool->connect("127.0.0.1", 0, "root", "wylj", s);
+    ASSERT_TRUE(s);
+
+    pool->getConnection().release();
+    ASSERT_EQ(2, pool->getIdleCount());
+
+    // 缓存格里的连接也会空闲超时被回收
+    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+    ASSERT_EQ(0, pool->getConnectionCount());
+    ASSERT_EQ(0, pool->getIdleCount());
+}
+
+TEST(ConnectionPoolTest, preparedStatements) {
+    const std::string sql = "select 1";
+    PoolOptions options;
+    options.statementCacheSize = 8;
+    options.preparedStatements = {sql, "select * from no_such_table"};
+    ConnectionPoolPtr pool = std::make_shared<ConnectionPool>(1, options);
+    Status s;
+    pool->connect("127.0.0.1", 0, "root", "wylj", s);
+    ASSERT_TRUE(s);
+
+    ConnectionPtr ptr = pool->getConnection();
+    StatementCache* cache = ptr->getStatementCache();
+    ASSERT_NE(nullptr, cache);
+    ASSERT_EQ(1, cache->size());
+
+    PreparedStatement statement = ptr->prepareStatement(sql, s);
+    ASSERT_TRUE(s);
+    ASSERT_EQ(1, cache->getHitCount());
+}
+
+TEST(ConnectionPoolTest, resetSession) {
+    PoolOptions options;
+    options.resetPolicy = PoolOptions::RESET_RESTORE;
+    ConnectionPoolPtr pool = std::make_shared<ConnectionPool>(1, options);
+    Status s;
+    pool->connect("127.0.0.1", 0, "root", "wylj", "mysql", s);
+    ASSERT_TRUE(s);
+
+    {
+        ConnectionPtr ptr = pool->getConnection();
+        ptr->setAutoCommit(false, s);
+        ASSERT_TRUE(s);
+        ptr->selectSchema("information_schema", s);
+        ASSERT_TRUE(s);
+        Statement statement = ptr->createStatement(s);
+        statement.execute("select 1", s);
+        ASSERT_TRUE(s);
+        ASSERT_TRUE(ptr->inTransaction());
+        ASSERT_FALSE(ptr->sessionClean());
+    }
+
+    {
+        ConnectionPtr ptr = pool->getConnection();
+        ASSERT_TRUE(ptr->sessionClean());
+        ASSERT_TRUE(ptr->getAutoCommit(s));
+
+        // 用户变量无法跟踪，归还时重置会话
+        Statement statement = ptr->createStatement(s);
+        statement.execute("set @reset_session = 1", s);
+        ASSERT_TRUE(s);
+        ASSERT_FALSE(ptr->sessionClean());
+    }
+
+    ConnectionPtr ptr = pool->getConnection();
+    Statement statement = ptr->createStatement(s);
+    ResultSet rs = statement.executeQuery(
+        "select @reset_session is null as cleared, database() as db", s);
+    ASSERT_TRUE(s);
+    ASSERT_TRUE(rs.next());
+    ASSERT_EQ(1, rs.getInt32("cleared"));
+    ASSERT_EQ("mysql", rs.getString("db"));
+}
+
+TEST(ConnectionPoolTest, resetSessionWithoutSchema) {
+    PoolOptions options;
+    options.resetPolicy = PoolOptions::RESET_RESTORE;
+    ConnectionPoolPtr pool = std::make_shared<ConnectionPool>(1, options);
+    Status s;
+    pool->connect("127.0.0.1", 0, "root", "wylj", s);
+    ASSERT_TRUE(s);
+
+    {
+        ConnectionPtr ptr = pool->getConnection();
+        ptr->selectSchema("mysql", s);
+        ASSERT_TRUE(s);
+        ASSERT_FALSE(ptr->sessionClean());
+    }
+
+    // 连接建立时没有schema，下一个使用者也不应该有schema
+    ConnectionPtr ptr = pool->getConnection();
+    ASSERT_TRUE(ptr->sessionClean());
+    Statement statement = ptr->createStatement(s);
+    ResultSet rs =
+        statement.executeQuery("select database() is null as cleared", s);
+    ASSERT_TRUE(s);
+    ASSERT_TRUE(rs.next());
+    ASSERT_EQ(1, rs.getInt32("cleared"));
+}
+
+TEST(ConnectionPoolTest, getConnectionAsync) {
+    ConnectionPoolPtr pool = std::make_shared<ConnectionPool>(1);
+    Status s;
+    pool->connect("127.0.0.1", 0, "root", "wylj", s);
+    ASSERT_TRUE(s);
+
+    // 有空闲连接时立即完成
+    std::future<ConnectionPtr> ready = pool->getConnectionAsync();
+    ASSERT_EQ(std::future_status::ready,
+              ready.wait_for(std::chrono::seconds(0)));
+    ConnectionPtr held = ready.get();
+    ASSERT_TRUE(bool(held));
+
+    // 超时由后台线程完成
+    std::future<ConnectionPtr> timeout = pool->getConnectionAsync(50);
+    ASSERT_EQ(std::future_status::ready,
+              timeout.wait_for(std::chrono::seconds(5)));
+    ASSERT_FALSE(bool(timeout.get()));
+
+    // 归还的连接直接交给回调
+    std::promise<Connection*> handed;
+    pool->getConnectionAsync(
+        -1, [&handed](ConnectionPtr ptr) { handed.set_value(ptr.get()); });
+    ASSERT_EQ(1, pool->getStats().waiters);
+    Connection* connection = held.get();
+    held.release();
+    ASSERT_EQ(connection, handed.get_future().get());
+    ASSERT_EQ(1, pool->getIdleCount());
+}
+
+TEST(ConnectionPoolTest, getConnectionAsyncExecutor) {
+    std::atomic<int> executed(0);
+    PoolOptions options;
+    options.executor = [&executed](std::function<void()> task) {
+        ++executed;
+        std::thread(task).detach();
+    };
+    ConnectionPoolPtr pool = std::make_shared<ConnectionPool>(1, options);
+    Status s;
+    pool->connect("127.0.0.1", 0, "root", "wylj", s);
+    ASSERT_TRUE(s);
+
+    ConnectionPtr held = pool->getConnection();
+    std::future<ConnectionPtr> waiting = pool->getConnectionAsync(5000);
+    held.release();
+    ASSERT_TRUE(bool(waiting.get()));
+    ASSERT_EQ(1, executed.load());
+}
+
+TEST(ConnectionPoolTest, getConnectionUntil) {
+    ConnectionPoolPtr pool = std::make_shared<ConnectionPool>(1);
+    Status s;
+    pool->connect("127.0.0.1", 0, "root", "wylj", s);
+    ASSERT_TRUE(s);
+
+    auto start = std::chrono::steady_clock::now();
+    ConnectionPtr ptr = pool->getConnectionUntil(
+        start + std::chrono::milliseconds(300));
+    ASSERT_TRUE(bool(ptr));
+
+    // prepared语句不能加MAX_EXECUTION_TIME，由连接池的QueryWatchdog中断
+    PreparedStatement statement = ptr->prepareStatement(
+        "SELECT SLEEP(5) FROM (SELECT 1 UNION ALL SELECT 2) t", s);
+    ASSERT_TRUE(s);
+    statement.execute(s);
+    if (s) {
+        statement.getResultSet(s);
+    }
+    ASSERT_EQ(Status::TIMEOUT, s.code()) << s.message();
+    ASSERT_LT(std::chrono::steady_clock::now() - start,
+              std::chrono::seconds(3));
+
+    statement.close();
+    ptr.release();
+    ptr = pool->getConnection();
+    ASSERT_EQ(std::chrono::steady_clock::time_point::max(),
+              ptr->getDeadline());
+}
+
+TEST(ConnectionPoolTest, releaseUnfinishedStreaming) {
+    ConnectionPoolPtr pool = std::make_shared<ConnectionPool>(1);
+    Status s;
+    pool->connect("127.0.0.1", 0, "root", "wylj", s);
+    ASSERT_TRUE(s);
+
+    ConnectionPtr ptr = pool->getConnection();
+    PreparedStatement statement = ptr->prepareStatement(
+        "SELECT 1 UNION ALL SELECT 2", s);
+    ASSERT_TRUE(s);
+    statement.execute(s);
+    ASSERT_TRUE(s);
+    PreparedResultSet resultSet = statement.getStreamingResultSet(s);
+    ASSERT_TRUE(s);
+    ASSERT_TRUE(resultSet.next(s));
+    ASSERT_TRUE(ptr->streaming());
+
+    // 归还时还没有读完，连接会被重新建立
+    ptr.release();
+    ptr = pool->getConnection();
+    ASSERT_TRUE(bool(ptr));
+    ASSERT_FALSE(ptr->streaming());
+    Statement stmt(*ptr);
+    ResultSet rs = stmt.executeQuery("SELECT 3", s);
+    ASSERT_TRUE(s) << s.message();
+    ASSERT_TRUE(rs.next());
+    ASSERT_EQ(3, rs.getInt32(0));
+}
+
+TEST(HistogramTest, percentile) {
+    Histogram histogram;
+    for (uint64_t i = 1; i <= 1000; ++i) {
+        histogram.record(i);
+    }
+
+    HistogramSnapshot snapshot;
+    histogram.collect(snapshot);
+    ASSERT_EQ(1000, snapshot.count);
+    ASSERT_EQ(500500, snapshot.sum);
+
+    // 误差在1/8以内
+    ASSERT_NEAR(500, snapshot.percentile(0.5), 500 / 8);
+    ASSERT_NEAR(990, snapshot.percentile(0.99), 990 / 8);
+    ASSERT_EQ(Histogram::kBucketCount - 1,
+              Histogram::bucketIndex(uint64_t(1) << 50));
+}
@@ -124,3 +124,92 @@ TEST(ConnectionTest, prepareStatement) {
     ASSERT_TRUE(s);
     ASSERT_TRUE(preparedStatement.valid());
 }
+
+TEST(ConnectionTest, sessionOptions) {
+    Connection connection;
+    SessionOptions options;
+    options.autoCommit = false;
+    options.isolationLevel = Connection::READ_COMMITTED;
+    options.charset = "utf8mb4";
+    options.timeZone = "+08:00";
+    options.variables.emplace_back("group_concat_max_len", "4096");
+    connection.setSessionOptions(options);
+
+    Status s;
+    connection.connect("127.0.0.1", 0, "root", "wylj", s);
+    ASSERT_TRUE(s);
+    ASSERT_FALSE(connection.getAutoCommit(s));
+    ASSERT_TRUE(connection.sessionClean());
+
+    Statement statement = connection.createStatement(s);
+    ResultSet rs = statement.executeQuery(
+        "select @@autocommit as autocommit, @@time_zone as tz, "
+        "@@transaction_isolation as level, "
+        "@@group_concat_max_len as max_len",
+        s);
+    ASSERT_TRUE(s);
+    ASSERT_TRUE(rs.next());
+    ASSERT_EQ(0, rs.getInt32("autocommit"));
+    ASSERT_EQ("+08:00", rs.getString("tz"));
+    ASSERT_EQ("READ-COMMITTED", rs.getString("level"));
+    ASSERT_EQ(4096, rs.getInt32("max_len"));
+
+    // 重置会话之后重新应用
+    connection.resetConnection(s);
+    ASSERT_TRUE(s);
+    ASSERT_FALSE(connection.getAutoCommit(s));
+    rs = statement.executeQuery("select @@time_zone as tz", s);
+    ASSERT_TRUE(s);
+    ASSERT_TRUE(rs.next());
+    ASSERT_EQ("+08:00", rs.getString("tz"));
+}
+
+TEST(ConnectionTest, sessionOptionsNoBackslashEscapes) {
+    Connection connection;
+    SessionOptions options;
+    options.sqlMode = "NO_BACKSLASH_ESCAPES";
+    options.timeZone = "+08:00";
+    connection.setSessionOptions(options);
+
+    Status s;
+    connection.connect("127.0.0.1", 0, "root", "wylj", s);
+    ASSERT_TRUE(s) << s.message();
+
+    Statement statement = connection.createStatement(s);
+    ResultSet rs = statement.executeQuery(
+        "select @@sql_mode as mode, @@time_zone as tz", s);
+    ASSERT_TRUE(s);
+    ASSERT_TRUE(rs.next());
+    ASSERT_EQ("NO_BACKSLASH_ESCAPES", rs.getString("mode"));
+    ASSERT_EQ("+08:00", rs.getString("tz"));
+}
+
+TEST(ConnectionTest, trackSessionChanges) {
+    Connection connection;
+    Status s;
+    connection.connect("127.0.0.1", 0, "root", "wylj", s);
+    ASSERT_TRUE(s);
+    Statement statement = connection.createStatement(s);
+    ASSERT_TRUE(s);
+
+    // 字符串中的@和名字中的LOCK不会修改会话
+    statement.execute("select 'a@b.com' as mail, 1 as block_id", s);
+    ASSERT_TRUE(s);
+    statement.execute(
+        "select get_lock_count from (select 1 as get_lock_count) t", s);
+    ASSERT_TRUE(s);
+    ASSERT_TRUE(connection.sessionClean());
+
+    const char* dirty[] = {"select @session_test := 1",
+                           "select 1 into @session_test",
+                           "set @session_test = 1",
+                           "set session wait_timeout = 600"};
+    for (const char* sql : dirty) {
+        connection.resetConnection(s);
+        ASSERT_TRUE(s);
+        ASSERT_TRUE(connection.sessionClean());
+        statement.execute(sql, s);
+        ASSERT_TRUE(s) << s.message();
+        ASSERT_FALSE(connection.sessionClean()) << sql;
+    }
+}
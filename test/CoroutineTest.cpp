@@ -0,0 +1,117 @@
+//
+// Created by m8792 on 2021/1/10.
+//
+
+#include "Coroutine.h"
+
+#if defined(MYSQL_CONNECTOR_WITH_COROUTINE) && __cplusplus >= 202002L
+
+#include <gtest/gtest.h>
+
+#include <thread>
+
+using namespace db;
+
+namespace {
+
+coro::Task<int> add(int a, int b) { co_return a + b; }
+
+coro::Task<int> sum() {
+    int x = co_await add(1, 2);
+    int y = co_await add(x, 3);
+    co_return y;
+}
+
+coro::Executor threadExecutor() {
+    return [](std::function<void()> task) { std::thread(task).detach(); };
+}
+
+}  // namespace
+
+TEST(CoroutineTest, task) { ASSERT_EQ(6, coro::syncWait(sum())); }
+
+TEST(CoroutineTest, scheduler) {
+    coro::Scheduler scheduler;
+    int result = 0;
+    scheduler.spawn([&]() -> coro::Task<> {
+        result = co_await sum();
+        scheduler.stop();
+    }());
+    scheduler.run();
+    ASSERT_EQ(6, result);
+}
+
+TEST(CoroutineTest, getConnection) {
+    ConnectionPoolPtr pool = std::make_shared<ConnectionPool>(1);
+    Status s;
+    pool->connect("127.0.0.1", 0, "root", "wylj", s);
+    ASSERT_TRUE(s);
+
+    ConnectionPtr held = pool->getConnection();
+    auto wait = [](ConnectionPoolPtr pool) -> coro::Task<ConnectionPtr> {
+        co_return co_await coro::getConnection(pool, 5000);
+    };
+
+    std::thread releaser([&held] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        held.release();
+    });
+    ConnectionPtr ptr = coro::syncWait(wait(pool));
+    releaser.join();
+    ASSERT_TRUE(bool(ptr));
+
+    ptr = coro::syncWait(wait(pool));
+    ASSERT_TRUE(bool(ptr));
+}
+
+TEST(CoroutineTest, preparedStatement) {
+    Connection connection;
+    Status s;
+    connection.connect("127.0.0.1", 0, "root", "wylj", "", s);
+    ASSERT_TRUE(s);
+
+    PreparedStatement statement =
+        connection.prepareStatement("select 1 + ?", s);
+    ASSERT_TRUE(s);
+    statement.bind(1, s);
+    ASSERT_TRUE(s);
+
+    auto query = [&]() -> coro::Task<PreparedResultSet> {
+        co_return co_await coro::executeQuery(statement, s, threadExecutor());
+    };
+    PreparedResultSet rs = coro::syncWait(query());
+    ASSERT_TRUE(s);
+    ASSERT_TRUE(rs.next());
+    ASSERT_EQ(2, rs.getInt32(0));
+}
+
+#ifdef MYSQL_CONNECTOR_HAS_NONBLOCKING
+
+TEST(CoroutineTest, reactor) {
+    Reactor reactor;
+    Status s;
+    reactor.start(s);
+    ASSERT_TRUE(s);
+
+    Connection connection;
+    auto run = [&]() -> coro::Task<int64_t> {
+        co_await coro::connect(reactor, connection, "127.0.0.1", 0, "root",
+                               "wylj", "", s);
+        if (!s) {
+            co_return -1;
+        }
+        Statement statement(connection);
+        ResultSet rs =
+            co_await coro::executeQuery(reactor, statement, "select 1", s);
+        if (!s || !rs.next()) {
+            co_return -1;
+        }
+        co_return rs.getInt32(0);
+    };
+    ASSERT_EQ(1, coro::syncWait(run()));
+    ASSERT_TRUE(s);
+}
+
+#endif  // MYSQL_CONNECTOR_HAS_NONBLOCKING
+
+#endif
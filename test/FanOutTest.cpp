@@ -0,0 +1,126 @@
+//
+// Created by m8792 on 2021/1/11.
+//
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+
+#include "FanOut.h"
+#include "TestUtil.h"
+
+using namespace db;
+
+TEST(FanOutTest, gather) {
+    std::vector<ConnectionPoolPtr> shards = {createPool(1), createPool(1)};
+    FanOut fanOut(4);
+
+    std::vector<FanOutTask> tasks;
+    for (int i = 0; i < 4; ++i) {
+        FanOutTask task;
+        task.pool = shards[i % shards.size()];
+        if (i % 2 == 0) {
+            task.sql = fmt::sprintf("SELECT %d", i);
+        } else {
+            task.sql = "SELECT ?";
+            task.bind = [i](PreparedStatement& statement, Status& s) {
+                statement.bind(i, s);
+            };
+        }
+        tasks.push_back(task);
+    }
+
+    // 每个分片只有一个连接，取出的结果一直持有，也不会占着连接
+    FanOutCallPtr call = fanOut.submit(tasks, 5000);
+    std::vector<FanOutResult> results(tasks.size());
+    std::vector<bool> seen(tasks.size(), false);
+    FanOutResult result;
+    while (call->next(result)) {
+        ASSERT_TRUE(result.status) << result.status.message();
+        ASSERT_FALSE(seen[result.index]);
+        seen[result.index] = true;
+        results[result.index] = std::move(result);
+    }
+    ASSERT_EQ(std::vector<bool>(tasks.size(), true), seen);
+
+    for (size_t i = 0; i < results.size(); ++i) {
+        if (tasks[i].bind) {
+            ASSERT_EQ(1, results[i].rows.size());
+            ASSERT_EQ(i, results[i].rows[0][0].getInt64());
+            ASSERT_EQ(1, results[i].shape->getFieldCount());
+        } else {
+            ASSERT_TRUE(results[i].resultSet.next());
+            ASSERT_EQ(i, results[i].resultSet.getInt32(0));
+        }
+    }
+}
+
+TEST(FanOutTest, deadline) {
+    ConnectionPoolPtr pool = createPool(2);
+    FanOut fanOut(2);
+
+    FanOutTask fast;
+    fast.pool = pool;
+    fast.sql = "SELECT 1";
+    FanOutTask slow;
+    slow.pool = pool;
+    slow.sql = "SELECT SLEEP(10)";
+
+    auto start = std::chrono::steady_clock::now();
+    FanOutCallPtr call = fanOut.submit({fast, slow}, 500);
+    FanOutResult result;
+    size_t failed = 0;
+    while (call->next(result)) {
+        if (!result.status) {
+            ASSERT_EQ(1, result.index);
+            ++failed;
+        }
+    }
+    ASSERT_EQ(1, failed);
+    ASSERT_LT(std::chrono::steady_clock::now() - start,
+              std::chrono::seconds(5));
+
+    // 被中断的连接归还之后仍然可以使用
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    ASSERT_EQ(2, pool->getIdleCount());
+}
+
+TEST(FanOutTest, cancel) {
+    ConnectionPoolPtr pool = createPool(1);
+    FanOut fanOut(1);
+
+    FanOutTask slow;
+    slow.pool = pool;
+    slow.sql = "SELECT SLEEP(10)";
+
+    auto start = std::chrono::steady_clock::now();
+    FanOutCallPtr call = fanOut.submit({slow});
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    call->cancel();
+
+    FanOutResult result;
+    ASSERT_TRUE(call->next(result));
+    ASSERT_FALSE(result.status);
+    ASSERT_FALSE(call->next(result));
+
+    // 查询被中断，连接归还之后仍然可以使用
+    ConnectionPtr conn = pool->getConnection(5000);
+    ASSERT_TRUE(bool(conn));
+    ASSERT_LT(std::chrono::steady_clock::now() - start,
+              std::chrono::seconds(5));
+}
+
+TEST(FanOutTest, withoutResultSet) {
+    FanOut fanOut(1);
+
+    FanOutTask task;
+    task.pool = createPool(1);
+    task.sql = "SET @fan_out = 1";
+
+    FanOutCallPtr call = fanOut.submit({task}, 5000);
+    FanOutResult result;
+    ASSERT_TRUE(call->next(result));
+    ASSERT_TRUE(result.status) << result.status.message();
+    ASSERT_FALSE(result.resultSet.valid());
+    ASSERT_EQ(0, result.affectedRows);
+}
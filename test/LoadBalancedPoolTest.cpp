@@ -0,0 +1,102 @@
+//
+// Created by m8792 on 2021/1/6.
+//
+
+#include <gtest/gtest.h>
+
+#include <thread>
+
+#include "LoadBalancedPool.h"
+#include "Statement.h"
+
+using namespace db;
+
+TEST(LoadBalancedPoolTest, leastOutstanding) {
+    LoadBalancerOptions options;
+    options.connectionsPerHost = 4;
+    LoadBalancedPool pool({Endpoint("127.0.0.1"), Endpoint("localhost")},
+                          options);
+
+    Status s;
+    pool.connect("root", "wylj", "", s);
+    ASSERT_TRUE(s) << s.message();
+    ASSERT_FALSE(pool.isEjected(0));
+    ASSERT_FALSE(pool.isEjected(1));
+
+    // 只有两个服务器时每次都比较这两个，连接会均匀分配
+    std::vector<ConnectionPtr> conns;
+    for (int i = 0; i < 6; ++i) {
+        conns.push_back(pool.getConnection(0));
+        ASSERT_TRUE(bool(conns.back()));
+    }
+    ASSERT_EQ(3, pool.getOutstanding(0));
+    ASSERT_EQ(3, pool.getOutstanding(1));
+
+    // 只持有连接不执行sql不算延迟
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    ASSERT_EQ(0, pool.getLatency(0));
+
+    for (auto& conn : conns) {
+        Statement statement(*conn);
+        statement.execute("select sleep(0.01)", s);
+        ASSERT_TRUE(s) << s.message();
+    }
+    conns.clear();
+    ASSERT_EQ(0, pool.getOutstanding(0));
+    ASSERT_EQ(0, pool.getOutstanding(1));
+    ASSERT_GE(pool.getLatency(0), 10000);
+}
+
+TEST(LoadBalancedPoolTest, ejectFailedHost) {
+    LoadBalancerOptions options;
+    options.connectionsPerHost = 2;
+    options.poolOptions.warmUpConcurrency = 2;
+    options.ejectBaseMs = 100;
+    options.checkIntervalMs = 0;
+    LoadBalancedPool pool({Endpoint("127.0.0.1"), Endpoint("10.12.0.2")},
+                          options);
+
+    Status s;
+    pool.connect("root", "wylj", "", s);
+    ASSERT_TRUE(s) << s.message();
+    ASSERT_FALSE(pool.isEjected(0));
+    ASSERT_TRUE(pool.isEjected(1));
+
+    for (int i = 0; i < 10; ++i) {
+        ASSERT_TRUE(bool(pool.getConnection(0)));
+    }
+    ASSERT_EQ(0, pool.getOutstanding(1));
+
+    // 到期之后重试，仍然失败，继续摘除
+    std::this_thread::sleep_for(std::chrono::milliseconds(150));
+    pool.checkHosts();
+    ASSERT_TRUE(pool.isEjected(1));
+}
+
+TEST(LoadBalancedPoolTest, ejectOnError) {
+    LoadBalancerOptions options;
+    options.connectionsPerHost = 2;
+    options.ejectBaseMs = 100;
+    options.checkIntervalMs = 0;
+    LoadBalancedPool pool({Endpoint("127.0.0.1"), Endpoint("localhost")},
+                          options);
+
+    Status s;
+    pool.connect("root", "wylj", "", s);
+    ASSERT_TRUE(s) << s.message();
+
+    // 使用中出错的服务器在下次检查时摘除
+    {
+        ConnectionPtr ptr = pool.getConnection(0);
+        ASSERT_TRUE(bool(ptr));
+        pool.markFailure(ptr);
+    }
+    pool.checkHosts();
+    ASSERT_NE(pool.isEjected(0), pool.isEjected(1));
+
+    // 到期之后建立连接成功，恢复分配
+    std::this_thread::sleep_for(std::chrono::milliseconds(150));
+    pool.checkHosts();
+    ASSERT_FALSE(pool.isEjected(0));
+    ASSERT_FALSE(pool.isEjected(1));
+}
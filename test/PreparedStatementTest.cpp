@@ -7,6 +7,7 @@
 #include "Connection.h"
 #include "Option.h"
 #include "PreparedStatement.h"
+#include "Statement.h"
 
 using namespace db;
 
@@ -193,4 +194,221 @@ TEST_F(ValidPreparedStatement, rewind) {
         ++count;
     }
     ASSERT_EQ(count, originalRowCount);
-}
\ No newline at end of file
+}
+TEST_F(ValidPreparedStatement, statementCache) {
+    Status s;
+    connection_.setStatementCacheSize(1, s);
+    ASSERT_TRUE(s);
+    StatementCache* cache = connection_.getStatementCache();
+    ASSERT_NE(nullptr, cache);
+
+    const std::string sql = "select * from t_person where id = ?";
+    MYSQL_STMT* stmt = nullptr;
+    {
+        PreparedStatement statement = connection_.prepareStatement(sql, s);
+        ASSERT_TRUE(s);
+        ASSERT_TRUE(statement.cached());
+        stmt = statement.get();
+
+        // 同一条sql正在使用时，新prepare一个不缓存的
+        PreparedStatement other = connection_.prepareStatement(sql, s);
+        ASSERT_TRUE(s);
+        ASSERT_FALSE(other.cached());
+        ASSERT_NE(stmt, other.get());
+    }
+    ASSERT_EQ(1, cache->size());
+
+    {
+        PreparedStatement statement = connection_.prepareStatement(sql, s);
+        ASSERT_TRUE(s);
+        ASSERT_EQ(stmt, statement.get());
+
+        statement.bind(1, s);
+        ASSERT_TRUE(s);
+        statement.execute(s);
+        ASSERT_TRUE(s);
+    }
+    ASSERT_EQ(1, cache->getHitCount());
+
+    // 超过容量时淘汰最久没有使用的
+    PreparedStatement statement =
+        connection_.prepareStatement("select * from t_person", s);
+    ASSERT_TRUE(s);
+    ASSERT_TRUE(statement.cached());
+    ASSERT_EQ(1, cache->size());
+
+    // 有取出的stmt时不能替换缓存
+    connection_.setStatementCacheSize(2, s);
+    ASSERT_FALSE(s);
+    ASSERT_EQ(cache, connection_.getStatementCache());
+}
+
+TEST_F(ValidPreparedStatement, sharedMetaData) {
+    Connection other;
+    Status s;
+    other.connect("127.0.0.1", 0, "root", "wylj", "mysql_connector_test", s);
+    ASSERT_TRUE(s);
+
+    const std::string sql = "select * from t_person where id >= ?";
+    ResultShapePtr shapes[2];
+    Connection* connections[2] = {&connection_, &other};
+    for (int i = 0; i < 2; ++i) {
+        PreparedStatement statement = connections[i]->prepareStatement(sql, s);
+        ASSERT_TRUE(s);
+        statement.bind(1, s);
+        ASSERT_TRUE(s);
+        statement.execute(s);
+        ASSERT_TRUE(s);
+
+        PreparedResultSet resultSet = statement.getResultSet(s);
+        ASSERT_TRUE(s);
+        shapes[i] = resultSet.getMetaData().getShape();
+        ASSERT_TRUE(bool(shapes[i]));
+    }
+
+    // 不同连接上同样的结果集共用同一份元数据
+    ASSERT_EQ(shapes[0], shapes[1]);
+    ASSERT_EQ(0, shapes[0]->fieldNameToIndex(shapes[0]->getFieldName(0)));
+}
+
+TEST_F(ValidPreparedStatement, reuseMetaData) {
+    Status s;
+    connection_.setStatementCacheSize(4, s);
+    ASSERT_TRUE(s);
+    auto query = [&s](PreparedStatement& statement) {
+        statement.bind(1, s);
+        EXPECT_TRUE(s);
+        statement.execute(s);
+        EXPECT_TRUE(s);
+        PreparedResultSet resultSet = statement.getResultSet(s);
+        EXPECT_TRUE(s);
+        return resultSet.getMetaData().getShape();
+    };
+
+    const std::string sql = "select * from t_person where id >= ?";
+    ResultShapePtr shapes[3];
+    {
+        PreparedStatement statement = connection_.prepareStatement(sql, s);
+        ASSERT_TRUE(s);
+        shapes[0] = query(statement);
+        // 同一个stmt再次执行
+        shapes[1] = query(statement);
+    }
+    {
+        // 从缓存中取出，元数据和stmt一起缓存
+        PreparedStatement statement = connection_.prepareStatement(sql, s);
+        ASSERT_TRUE(s);
+        shapes[2] = query(statement);
+    }
+
+    ASSERT_TRUE(bool(shapes[0]));
+    ASSERT_EQ(shapes[0], shapes[1]);
+    ASSERT_EQ(shapes[0], shapes[2]);
+    ASSERT_EQ(1, connection_.getStatementCache()->getHitCount());
+}
+
+TEST_F(ValidPreparedStatement, streamingResultSet) {
+    Status s;
+    PreparedStatement statement = connection_.prepareStatement(
+        "select id, repeat('a', 5000) from t_person where id >= ?", s);
+    ASSERT_TRUE(s);
+
+    statement.bind(1, s);
+    ASSERT_TRUE(s);
+    statement.execute(s);
+    ASSERT_TRUE(s);
+
+    PreparedResultSet resultSet = statement.getStreamingResultSet(s);
+    ASSERT_TRUE(s);
+    ASSERT_TRUE(resultSet.isStreaming());
+    ASSERT_THROW(resultSet.rewind(), std::runtime_error);
+
+    int count = 0;
+    while (resultSet.next(s)) {
+        ++count;
+        // 比固定的缓冲区长，读取时重新获取完整的值
+        ASSERT_EQ(std::string(5000, 'a'), resultSet.getString(1));
+
+        size_t chunks = 0;
+        std::string value;
+        resultSet.readColumn(
+            1,
+            [&](const char* data, size_t size) {
+                ++chunks;
+                value.append(data, size);
+            },
+            s, 1000);
+        ASSERT_TRUE(s);
+        ASSERT_EQ(5, chunks);
+        ASSERT_EQ(std::string(5000, 'a'), value);
+
+        resultSet.readColumn(0, [](const char*, size_t) {}, s);
+        ASSERT_FALSE(s);
+    }
+    ASSERT_TRUE(s);
+    ASSERT_GT(count, 0);
+    ASSERT_FALSE(connection_.streaming());
+}
+
+TEST_F(ValidPreparedStatement, unfinishedStreamingResultSet) {
+    Status s;
+    PreparedStatement statement = connection_.prepareStatement(
+        "select id from t_person where id >= ?", s);
+    ASSERT_TRUE(s);
+    statement.bind(1, s);
+    ASSERT_TRUE(s);
+    statement.execute(s);
+    ASSERT_TRUE(s);
+
+    {
+        PreparedResultSet resultSet = statement.getStreamingResultSet(s);
+        ASSERT_TRUE(s);
+        ASSERT_TRUE(resultSet.next(s));
+    }
+    // 没有读完，连接上不能执行其他sql
+    ASSERT_TRUE(connection_.streaming());
+    connection_.prepareStatement("select 1", s);
+    ASSERT_FALSE(s);
+
+    // 同一个stmt可以直接重新执行
+    statement.execute(s);
+    ASSERT_TRUE(s) << s.message();
+    PreparedResultSet resultSet = statement.getResultSet(s);
+    ASSERT_TRUE(s);
+    ASSERT_FALSE(connection_.streaming());
+}
+
+TEST_F(ValidPreparedStatement, cursor) {
+    Status s;
+    PreparedStatement statement =
+        connection_.prepareStatement("select * from t_person where id >= ?", s);
+    ASSERT_TRUE(s);
+
+    statement.setCursor(1, s);
+    ASSERT_TRUE(s);
+    statement.bind(1, s);
+    ASSERT_TRUE(s);
+    statement.execute(s);
+    ASSERT_TRUE(s);
+
+    PreparedResultSet resultSet = statement.getStreamingResultSet(s);
+    ASSERT_TRUE(s);
+
+    int count = 0;
+    while (resultSet.next(s)) {
+        ++count;
+
+        // 结果集保存在服务器上，读取过程中可以执行其他sql
+        Statement other(connection_);
+        ResultSet one = other.executeQuery("select 1", s);
+        ASSERT_TRUE(s);
+    }
+    ASSERT_TRUE(s);
+
+    Statement counter(connection_);
+    ResultSet stored =
+        counter.executeQuery("select count(*) from t_person where id >= 1", s);
+    ASSERT_TRUE(s);
+    ASSERT_TRUE(stored.next());
+    ASSERT_EQ(count, stored.getInt64(0));
+}
@@ -0,0 +1,135 @@
+//
+// Created by m8792 on 2021/1/9.
+//
+
+#include "Reactor.h"
+
+#ifdef MYSQL_CONNECTOR_HAS_NONBLOCKING
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <future>
+#include <memory>
+#include <vector>
+
+using namespace db;
+
+TEST(ReactorTest, executeQuery) {
+    Reactor reactor;
+    Status s;
+    reactor.start(s);
+    ASSERT_TRUE(s);
+
+    Connection connection;
+    std::promise<Status> connected;
+    reactor.connect(connection, "127.0.0.1", 0, "root", "wylj", "",
+                    [&connected](const Status& s) { connected.set_value(s); });
+    ASSERT_TRUE(connected.get_future().get());
+    ASSERT_TRUE(connection.connected());
+
+    std::promise<int> value;
+    reactor.executeQuery(connection, "select 1 + 1 as value",
+                         [&value](ResultSet rs, const Status& s) {
+                             if (!s || !rs.next()) {
+                                 value.set_value(-1);
+                                 return;
+                             }
+                             value.set_value(rs.getInt32("value"));
+                         });
+    ASSERT_EQ(2, value.get_future().get());
+
+    std::promise<Status> failed;
+    reactor.executeQuery(connection, "select * from no_such_table",
+                         [&failed](ResultSet, const Status& s) {
+                             failed.set_value(s);
+                         });
+    ASSERT_FALSE(failed.get_future().get());
+    ASSERT_EQ(0, reactor.getPendingCount());
+}
+
+TEST(ReactorTest, manyConnections) {
+    Reactor reactor;
+    Status s;
+    reactor.start(s);
+    ASSERT_TRUE(s);
+
+    const int count = 32;
+    std::vector<std::unique_ptr<Connection>> connections;
+    std::atomic<int> remaining(count);
+    std::atomic<int> succeeded(0);
+    std::promise<void> done;
+    for (int i = 0; i < count; ++i) {
+        connections.emplace_back(new Connection());
+        Connection* connection = connections.back().get();
+        // 连接建立之后接着执行一个需要等待的查询
+        reactor.connect(
+            *connection, "127.0.0.1", 0, "root", "wylj", "",
+            [&, connection](const Status& s) {
+                if (!s) {
+                    if (--remaining == 0) {
+                        done.set_value();
+                    }
+                    return;
+                }
+                reactor.executeQuery(
+                    *connection, "select sleep(0.2)",
+                    [&](ResultSet rs, const Status& s) {
+                        if (s && rs.next()) {
+                            ++succeeded;
+                        }
+                        if (--remaining == 0) {
+                            done.set_value();
+                        }
+                    });
+            });
+    }
+
+    // 在一个线程上并发执行，总耗时接近一次查询
+    auto start = std::chrono::steady_clock::now();
+    done.get_future().wait();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    ASSERT_EQ(count, succeeded.load());
+    ASSERT_LT(elapsed, std::chrono::seconds(3));
+}
+
+TEST(ReactorTest, deadline) {
+    Reactor reactor;
+    Status s;
+    reactor.start(s);
+    ASSERT_TRUE(s);
+
+    Connection connection;
+    std::promise<Status> connected;
+    reactor.connect(connection, "127.0.0.1", 0, "root", "wylj", "",
+                    [&connected](const Status& s) { connected.set_value(s); });
+    ASSERT_TRUE(connected.get_future().get());
+
+    auto start = std::chrono::steady_clock::now();
+    std::promise<Status> timedOut;
+    reactor.executeQuery(connection, "select sleep(5)",
+                         start + std::chrono::milliseconds(200),
+                         [&timedOut](ResultSet, const Status& s) {
+                             timedOut.set_value(s);
+                         });
+    ASSERT_EQ(Status::TIMEOUT, timedOut.get_future().get().code());
+    ASSERT_LT(std::chrono::steady_clock::now() - start,
+              std::chrono::seconds(2));
+
+    // 请求进行到一半，连接已经被关闭
+    ASSERT_FALSE(connection.connected());
+    ASSERT_EQ(0, reactor.getPendingCount());
+}
+
+TEST(ReactorTest, stop) {
+    Reactor reactor;
+    reactor.stop();
+
+    Connection connection;
+    Status result;
+    reactor.connect(connection, "127.0.0.1", 0, "root", "wylj", "",
+                    [&result](const Status& s) { result = s; });
+    ASSERT_FALSE(result);
+}
+
+#endif  // MYSQL_CONNECTOR_HAS_NONBLOCKING
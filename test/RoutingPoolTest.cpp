@@ -0,0 +1,65 @@
+//
+// Created by m8792 on 2021/1/5.
+//
+
+#include <gtest/gtest.h>
+
+#include "RoutingPool.h"
+#include "Statement.h"
+#include "TestUtil.h"
+
+using namespace db;
+
+TEST(RoutingPoolTest, readFromReplicas) {
+    ConnectionPoolPtr primary = createPool(1);
+    std::vector<ConnectionPoolPtr> replicas = {createPool(1), createPool(1)};
+    RoutingPool pool(primary, replicas);
+
+    ConnectionPtr write = pool.getConnection();
+    ASSERT_TRUE(bool(write));
+    ASSERT_EQ(0, primary->getIdleCount());
+
+    // 两个从库轮流分配
+    ConnectionPtr first = pool.getReadConnection();
+    ConnectionPtr second = pool.getReadConnection();
+    ASSERT_TRUE(bool(first));
+    ASSERT_TRUE(bool(second));
+    ASSERT_EQ(0, replicas[0]->getIdleCount());
+    ASSERT_EQ(0, replicas[1]->getIdleCount());
+    ASSERT_FALSE(bool(pool.getReadConnection(0)));
+}
+
+TEST(RoutingPoolTest, excludeLaggingReplica) {
+    ConnectionPoolPtr primary = createPool(1);
+    std::vector<ConnectionPoolPtr> replicas = {createPool(1)};
+
+    RoutingOptions options;
+    options.maxLagMs = 1000;
+    options.lagCheckIntervalMs = 100;
+    options.lagQuery = "SELECT 5000";
+    RoutingPool pool(primary, replicas, options);
+
+    pool.checkReplicaLag();
+    ASSERT_EQ(5000, pool.getReplicaLag(0));
+    ASSERT_FALSE(pool.isReplicaAvailable(0));
+
+    // 从库延迟过大时读主库
+    ConnectionPtr read = pool.getReadConnection(0);
+    ASSERT_TRUE(bool(read));
+    ASSERT_EQ(0, primary->getIdleCount());
+    ASSERT_EQ(1, replicas[0]->getIdleCount());
+}
+
+TEST(RoutingPoolTest, replicaStatus) {
+    ConnectionPoolPtr primary = createPool(1);
+    std::vector<ConnectionPoolPtr> replicas = {createPool(1)};
+
+    RoutingOptions options;
+    options.maxLagMs = 1000;
+    RoutingPool pool(primary, replicas, options);
+
+    // 测试服务器没有配置复制，延迟为0
+    pool.checkReplicaLag();
+    ASSERT_EQ(0, pool.getReplicaLag(0));
+    ASSERT_TRUE(pool.isReplicaAvailable(0));
+}
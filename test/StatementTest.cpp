@@ -162,3 +162,125 @@ TEST_F(ValidStatementTest, getLastInsertId) {
     int64_t lastInsertId2 = statement_->getLastInsertId();
     ASSERT_EQ(lastInsertId2, lastInsertId);
 }
+
+TEST_F(ValidStatementTest, executeBatch) {
+    Status s;
+    std::vector<std::string> sqls = {
+        "update t_person set name = 'batch' where id = 1;",
+        "insert into t_person(name, birthday, gender) values('batch', "
+        "'2020-01-01', '0') -- comment",
+        "select id from t_person where id = 1", "select * from t_missing",
+        "update t_person set name = 'woo' where id = 1"};
+    std::vector<BatchResult> results = statement_->executeBatch(sqls, s);
+    ASSERT_FALSE(s);
+    ASSERT_EQ(sqls.size(), results.size());
+
+    ASSERT_TRUE(results[0].status);
+    ASSERT_EQ(1, results[0].affectedRows);
+    ASSERT_TRUE(results[1].status);
+    ASSERT_GT(results[1].insertId, 0);
+    ASSERT_TRUE(results[2].status);
+    ASSERT_TRUE(results[2].resultSet.next());
+    ASSERT_EQ(1, results[2].resultSet.getInt32(0));
+    ASSERT_FALSE(results[3].status);
+    ASSERT_FALSE(results[4].status);
+    ASSERT_TRUE(conn_.multiStatements());
+
+    // 执行单条sql之前关闭多语句，一个sql只能执行一条语句
+    statement_->execute("select 1; select 2", s);
+    ASSERT_FALSE(s);
+    ASSERT_FALSE(conn_.multiStatements());
+}
+
+TEST_F(ValidStatementTest, deadline) {
+    auto watchdog = std::make_shared<QueryWatchdog>();
+    watchdog->setServer("127.0.0.1", 0, "root", "wylj");
+    conn_.setWatchdog(watchdog);
+
+    Status s;
+    auto start = std::chrono::steady_clock::now();
+
+    // select语句由MAX_EXECUTION_TIME中断
+    statement_->executeQuery(
+        "SELECT SLEEP(5) FROM t_person",
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(200), s);
+    ASSERT_EQ(Status::TIMEOUT, s.code()) << s.message();
+
+    // 其他语句通过KILL QUERY中断
+    statement_->executeUpdate(
+        "UPDATE t_person SET name = name WHERE SLEEP(5) = 0",
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(200), s);
+    ASSERT_EQ(Status::TIMEOUT, s.code()) << s.message();
+
+    // 批量执行的语句也一样
+    statement_->executeBatch(
+        {"SELECT 1", "UPDATE t_person SET name = name WHERE SLEEP(5) = 0"},
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(200), s);
+    ASSERT_EQ(Status::TIMEOUT, s.code()) << s.message();
+    ASSERT_LT(std::chrono::steady_clock::now() - start,
+              std::chrono::seconds(3));
+
+    // 已经过了deadline的不会发送
+    statement_->execute("SELECT 1", start, s);
+    ASSERT_EQ(Status::TIMEOUT, s.code());
+
+    ResultSet resultSet = statement_->executeQuery("SELECT 1", s);
+    ASSERT_TRUE(s);
+    ASSERT_TRUE(resultSet.next());
+}
+
+TEST_F(ValidStatementTest, executeStreamingQuery) {
+    Status s;
+    ResultSet resultSet =
+        statement_->executeStreamingQuery("select id from t_person", s);
+    ASSERT_TRUE(s);
+    ASSERT_TRUE(resultSet.isStreaming());
+
+    resultSet.rewind(s);
+    ASSERT_FALSE(s);
+
+    // 读完之前不能执行其他sql
+    ASSERT_TRUE(conn_.streaming());
+    statement_->execute("select 1", s);
+    ASSERT_FALSE(s);
+
+    size_t count = 0;
+    while (resultSet.next(s)) {
+        ++count;
+    }
+    ASSERT_TRUE(s);
+    ASSERT_GT(count, 0);
+    ASSERT_FALSE(conn_.streaming());
+
+    ResultSet stored =
+        statement_->executeQuery("select count(*) from t_person", s);
+    ASSERT_TRUE(s);
+    ASSERT_TRUE(stored.next());
+    ASSERT_EQ(count, stored.getInt64(0));
+}
+
+TEST_F(ValidStatementTest, getStringView) {
+    Status s;
+    ResultSet resultSet = statement_->executeQuery(
+        "select 'a\\0b', null, 42, cast(x'00ff' as binary)", s);
+    ASSERT_TRUE(s);
+    ASSERT_TRUE(resultSet.next());
+
+    // 包含'\0'的数据不会被截断
+    StringView view = resultSet.getStringView(0);
+    ASSERT_EQ(3, view.size());
+    ASSERT_EQ(StringView("a\0b", 3), view);
+    ASSERT_EQ(std::string("a\0b", 3), resultSet.getString(0));
+
+    ASSERT_EQ(nullptr, resultSet.getStringView(1).data());
+    ASSERT_TRUE(resultSet.getValueView(1).isNull());
+
+    ValueView value = resultSet.getValueView(2);
+    ASSERT_EQ(DataType::SIGNED_INTEGER, value.getType());
+    ASSERT_EQ(42, value.getInt64());
+    ASSERT_EQ(StringView("42"), value.getStringView());
+
+    StringView bytes = resultSet.getBytes(3);
+    ASSERT_EQ(2, bytes.size());
+    ASSERT_EQ('\xff', bytes[1]);
+}
@@ -0,0 +1,31 @@
+//
+// Created by m8792 on 2021/1/11.
+//
+
+#ifndef MYSQL_CONNECTOR_TESTUTIL_H
+#define MYSQL_CONNECTOR_TESTUTIL_H
+
+#include <gtest/gtest.h>
+
+#include <memory>
+
+#include "ConnectionPool.h"
+
+namespace db {
+
+/**
+ * 创建连接到测试数据库的连接池
+ * @param count     连接数
+ * @return
+ */
+inline ConnectionPoolPtr createPool(size_t count) {
+    ConnectionPoolPtr pool = std::make_shared<ConnectionPool>(count);
+    Status s;
+    pool->connect("127.0.0.1", 0, "root", "wylj", s);
+    EXPECT_TRUE(s) << s.message();
+    return pool;
+}
+
+}  // namespace db
+
+#endif  // MYSQL_CONNECTOR_TESTUTIL_H